@@ -0,0 +1,344 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <format>
+
+#include <PseudoNix/System.h>
+
+//
+// Benchmarks for the scheduler and streams.
+//
+// Results are written to standard output as a single JSON
+// document so they can be compared between runs. Progress is
+// written to standard error.
+//
+//   PseudoNix-bench [--quick] [--filter <name>]
+//
+
+using namespace PseudoNix;
+using clock_type = std::chrono::steady_clock;
+
+struct Result
+{
+    std::string                                  name;
+    std::vector<std::pair<std::string, double>>  params;
+    double                                       value = 0.0;
+    std::string                                  unit;
+};
+
+struct Bench
+{
+    bool                quick = false;
+    std::string         filter;
+    std::vector<Result> results;
+
+    bool enabled(std::string_view name) const
+    {
+        return filter.empty() || name.find(filter) != std::string_view::npos;
+    }
+
+    void report(Result r)
+    {
+        std::string p;
+        for(auto & [k, v] : r.params)
+            p += std::format(" {}={}", k, v);
+        std::cerr << std::format("{:<22}{:<30} {:>14.1f} {}\n", r.name, p, r.value, r.unit);
+        results.push_back(std::move(r));
+    }
+
+    void print_json(std::ostream & out) const
+    {
+        out << "{\n  \"benchmarks\": [\n";
+        for(size_t i=0;i<results.size();i++)
+        {
+            auto & r = results[i];
+            out << std::format("    {{\"name\": \"{}\", \"params\": {{", r.name);
+            for(size_t j=0;j<r.params.size();j++)
+            {
+                out << std::format("{}\"{}\": {}", j ? ", " : "", r.params[j].first, r.params[j].second);
+            }
+            out << std::format("}}, \"value\": {:.3f}, \"unit\": \"{}\"}}{}\n", r.value, r.unit, i+1 < results.size() ? "," : "");
+        }
+        out << "  ]\n}\n";
+    }
+};
+
+static double seconds_since(clock_type::time_point T0)
+{
+    return std::chrono::duration<double>(clock_type::now() - T0).count();
+}
+
+// Register the helper processes used by the benchmarks
+static void setBenchFunctions(System & M)
+{
+    // yield N times
+    M.setFunction("yielder", [](System::e_type ctrl) -> System::task_type {
+        PSEUDONIX_PROC_START(ctrl);
+        size_t count = 0;
+        to_number(ARGS[1], count);
+        for(size_t i=0;i<count;i++)
+        {
+            HANDLE_AWAIT_INT_TERM(co_await ctrl->await_yield(), ctrl);
+        }
+        co_return 0;
+    });
+
+    // wait until signaled
+    M.setFunction("blocked", [](System::e_type ctrl) -> System::task_type {
+        PSEUDONIX_PROC_START(ctrl);
+        while(true)
+        {
+            HANDLE_AWAIT_INT_TERM(co_await ctrl->await_signal(), ctrl);
+        }
+        co_return 0;
+    });
+
+    // hop onto the THREADPOOL queue and do some
+    // work between each yield
+    M.setFunction("worker", [](System::e_type ctrl) -> System::task_type {
+        PSEUDONIX_PROC_START(ctrl);
+        size_t count = 0;
+        to_number(ARGS[1], count);
+        uint32_t x = static_cast<uint32_t>(PID);
+        for(size_t i=0;i<count;i++)
+        {
+            HANDLE_AWAIT_INT_TERM(co_await ctrl->await_yield("THREADPOOL"), ctrl);
+            for(int k=0;k<20000;k++)
+                x = x * 1664525u + 1013904223u;
+        }
+        HANDLE_AWAIT_INT_TERM(co_await ctrl->await_yield(System::DEFAULT_QUEUE), ctrl);
+        co_return static_cast<int>(x & 1u);
+    });
+}
+
+// Number of processes spawned and reaped per second
+static void bench_spawn_reap(Bench & B)
+{
+    if(!B.enabled("spawn_reap"))
+        return;
+
+    size_t batch  = 1000;
+    size_t rounds = B.quick ? 5 : 50;
+
+    System M;
+    auto T0 = clock_type::now();
+    for(size_t r=0;r<rounds;r++)
+    {
+        for(size_t i=0;i<batch;i++)
+            M.spawnProcess({"true"});
+        while(M.taskQueueExecute());
+    }
+    auto t = seconds_since(T0);
+
+    B.report({"spawn_reap", {{"batch", static_cast<double>(batch)}}, static_cast<double>(batch*rounds) / t, "processes/s"});
+}
+
+// Same as spawn_reap, but the processes are started with spawnBatch
+static void bench_spawn_batch(Bench & B)
+{
+    if(!B.enabled("spawn_batch"))
+        return;
+
+    size_t batch  = 1000;
+    size_t rounds = B.quick ? 5 : 50;
+
+    System M;
+    auto T0 = clock_type::now();
+    for(size_t r=0;r<rounds;r++)
+    {
+        M.spawnBatch(System::Exec({"true"}), batch);
+        while(M.taskQueueExecute());
+    }
+    auto t = seconds_since(T0);
+
+    B.report({"spawn_batch", {{"batch", static_cast<double>(batch)}}, static_cast<double>(batch*rounds) / t, "processes/s"});
+}
+
+// Cost of resolving a path in the virtual filesystem
+static void bench_path_lookup(Bench & B)
+{
+    if(!B.enabled("path_lookup"))
+        return;
+
+    size_t lookups = B.quick ? 100000 : 1000000;
+
+    System M;
+    M.mkdir("/usr");
+    M.mkdir("/usr/local");
+    M.mkdir("/usr/local/bin");
+    M.mkfile("/usr/local/bin/tool");
+
+    size_t found = 0;
+    auto T0 = clock_type::now();
+    for(size_t i=0;i<lookups;i++)
+        found += M.exists("/usr/local/bin/tool") == FSResult::True;
+    auto t = seconds_since(T0);
+    if(found != lookups)
+        std::cerr << "path_lookup: lookup failed\n";
+
+    B.report({"path_lookup", {{"depth", 4}}, t * 1e9 / static_cast<double>(lookups), "ns/lookup"});
+}
+
+// Cost of suspending one process and resuming another
+static void bench_yield_pingpong(Bench & B)
+{
+    if(!B.enabled("yield_pingpong"))
+        return;
+
+    size_t count = B.quick ? 20000 : 200000;
+
+    System M;
+    setBenchFunctions(M);
+    auto p1 = M.spawnProcess({"yielder", std::to_string(count)});
+    auto p2 = M.spawnProcess({"yielder", std::to_string(count)});
+
+    auto T0 = clock_type::now();
+    while(M.isRunning(p1) || M.isRunning(p2))
+        M.taskQueueExecute();
+    auto t = seconds_since(T0);
+
+    B.report({"yield_pingpong", {{"processes", 2}}, t * 1e9 / static_cast<double>(2*count), "ns/switch"});
+}
+
+// Throughput of cat | rev | wc over a file
+static void bench_pipeline(Bench & B, StreamBackend backend, size_t capacity)
+{
+    if(!B.enabled("pipeline"))
+        return;
+
+    size_t megabytes = B.quick ? 1 : 16;
+
+    System M;
+    std::string line(79, 'x');
+    line += '\n';
+    std::string data;
+    data.reserve(megabytes << 20);
+    while(data.size() + line.size() <= (megabytes << 20))
+        data += line;
+    M.mkfile("/bench.txt");
+    M.fs("/bench.txt") << data;
+
+    auto E = System::genPipeline({{"cat", "/bench.txt"}, {"rev"}, {"wc"}}, backend, capacity);
+    auto out = E.back().out;
+
+    auto T0 = clock_type::now();
+    auto pids = M.runPipeline(E);
+    while(!M.isAllComplete(pids))
+        M.taskQueueExecute();
+    auto t = seconds_since(T0);
+
+    if(out->str() != std::format("{}\n", data.size()))
+    {
+        std::cerr << std::format("pipeline: unexpected output: {}", out->str());
+    }
+
+    B.report({backend == StreamBackend::RING ? "pipeline_ring" : "pipeline_chunked",
+              {{"megabytes", static_cast<double>(megabytes)}, {"capacity", static_cast<double>(capacity)}},
+              static_cast<double>(data.size()) / t / double(1<<20), "MB/s"});
+}
+
+// Time taken by taskQueueExecute() when most processes are blocked
+static void bench_blocked(Bench & B, size_t blocked)
+{
+    if(!B.enabled("blocked"))
+        return;
+
+    size_t iterations = B.quick ? 200 : 2000;
+
+    System M;
+    setBenchFunctions(M);
+    for(size_t i=0;i<blocked;i++)
+        M.spawnProcess({"blocked"});
+
+    // let the blocked processes start and park
+    M.taskQueueExecute();
+    M.taskQueueExecute();
+
+    auto p = M.spawnProcess({"yielder", std::to_string(iterations * 2)});
+    M.taskQueueExecute();
+
+    auto T0 = clock_type::now();
+    for(size_t i=0;i<iterations;i++)
+        M.taskQueueExecute();
+    auto t = seconds_since(T0);
+
+    B.report({"blocked", {{"blocked", static_cast<double>(blocked)}}, t * 1e6 / static_cast<double>(iterations), "us/execute"});
+
+    M.kill(p);
+    M.destroy();
+}
+
+// Throughput of a CPU bound workload on the THREADPOOL queue
+static void bench_threadpool(Bench & B, size_t threads)
+{
+    if(!B.enabled("threadpool"))
+        return;
+
+    size_t processes = 64;
+    size_t count     = B.quick ? 10 : 100;
+
+    System M;
+    setBenchFunctions(M);
+    M.taskQueueCreate("THREADPOOL");
+    auto bg = M.spawnProcess({"bgrunner", "THREADPOOL", std::to_string(threads)});
+    M.taskQueueExecute();
+
+    std::vector<System::pid_type> pids;
+    auto T0 = clock_type::now();
+    for(size_t i=0;i<processes;i++)
+        pids.push_back(M.spawnProcess({"worker", std::to_string(count)}));
+
+    while(!M.isAllComplete(pids))
+    {
+        M.taskQueueExecute();
+        std::this_thread::yield();
+    }
+    auto t = seconds_since(T0);
+
+    B.report({"threadpool", {{"threads", static_cast<double>(threads)}, {"processes", static_cast<double>(processes)}},
+              static_cast<double>(processes*count) / t, "tasks/s"});
+
+    M.interrupt(bg);
+    M.destroy();
+}
+
+int main(int argc, char ** argv)
+{
+    Bench B;
+    for(int i=1;i<argc;i++)
+    {
+        std::string_view a = argv[i];
+        if(a == "--quick")
+        {
+            B.quick = true;
+        }
+        else if(a == "--filter" && i+1 < argc)
+        {
+            B.filter = argv[++i];
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--quick] [--filter <name>]\n";
+            return 1;
+        }
+    }
+
+    bench_spawn_reap(B);
+    bench_spawn_batch(B);
+    bench_path_lookup(B);
+    bench_yield_pingpong(B);
+
+    bench_pipeline(B, StreamBackend::CHUNKED, 0);
+    bench_pipeline(B, StreamBackend::RING, 0);
+    bench_pipeline(B, StreamBackend::RING, 1<<20);
+
+    for(size_t blocked : {size_t(0), size_t(100), size_t(1000), size_t(10000)})
+        bench_blocked(B, blocked);
+
+    for(size_t threads : {size_t(1), size_t(2), size_t(4)})
+        bench_threadpool(B, threads);
+
+    B.print_json(std::cout);
+    return 0;
+}
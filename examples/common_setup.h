@@ -2,6 +2,7 @@
 #include <PseudoNix/Shell.h>
 #include <PseudoNix/HostMount.h>
 #include <PseudoNix/ArchiveMount.h>
+#include <PseudoNix/ProcMount.h>
 
 #include <PseudoNix/sample_archive.h>
 
@@ -126,11 +127,16 @@ echo " "
 echo "/bin contains in-memory scripts"
 echo "/etc contains the profile that sh reads"
 echo "/usr/bin a mounted directory"
+echo "/proc shows the running processes"
 echo " "
 echo "type 'help' for a list of commands"
 echo "###################################"
 )foo";
 
+    // Process information is generated when
+    // the files are read, eg: cat /proc/1/status
+    PseudoNix::mount_proc(sys);
+
     sys.mkdir("/mnt");
     sys.mkfile("/mnt/README.md");
     sys.fs("/mnt/README.md") <<
@@ -84,12 +84,9 @@ int main(int argc, char** argv)
     std::signal(SIGINT, handle_sigint);
     _M = &M;
 
-    // Spawn 2 background runners to process the
-    // THREADPOOL queue.
-    //
-    // Note:
-    M.spawnProcess({"bgrunner", "THREADPOOL"});
-    M.spawnProcess({"bgrunner", "THREADPOOL"});
+    // Run the THREADPOOL queue on 2 background
+    // worker threads.
+    M.spawnProcess({"bgrunner", "THREADPOOL", "2"});
 
 
     // This while loop is basically your system's gameloop
@@ -131,9 +128,19 @@ int main(int argc, char** argv)
             M.terminateAll();
             break;
         }
-        // sleep for 1 millisecond so we're not
-        // doing a busy loop
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        // If there are processes waiting to run, sleep for
+        // 1 millisecond so we're not doing a busy loop.
+        // Otherwise everything is blocked, so we can sleep
+        // until the next sleeping process needs to wake up.
+        // Keep the sleep capped, processes may still be woken
+        // up by the background threads.
+        auto now  = std::chrono::steady_clock::now();
+        auto wake = now + std::chrono::milliseconds(1);
+        if(M.taskQueueSize("PRE_MAIN") + M.taskQueueSize("MAIN") + M.taskQueueSize("POST_MAIN") == 0)
+        {
+            wake = std::min(M.nextTimerDeadline(), now + std::chrono::milliseconds(100));
+        }
+        std::this_thread::sleep_until(wake);
     }
 
     // Clean up the system by doing the following steps:
@@ -3,7 +3,16 @@
 
 #include <archive.h>
 #include <archive_entry.h>
+#include <zlib.h>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <list>
 #include <map>
+#include <mutex>
+#include <memory>
+#include <span>
+#include <unordered_map>
 #include <vector>
 #include <format>
 #include "FileSystemMount.h"
@@ -115,75 +124,895 @@ protected:
 
 };
 
-struct ArchiveMount : public FSMountBase
+
+/**
+ * @brief The ArchiveSource class
+ *
+ * Random access to the raw bytes of an archive, which is either a
+ * block of memory or a file on the host. Each copy of a file source
+ * opens the file again, so copies can be read from independently.
+ */
+class ArchiveSource
 {
-    path_type host_path;
-    void const * _data = nullptr;
-    size_t _length = 0;
-    std::string _info;
-    struct EntryInfo
+public:
+    ArchiveSource() = default;
+
+    ArchiveSource(void const * data, size_t length) : m_data(static_cast<char const*>(data)), m_length(length)
     {
-        bool is_dir = false;
-    };
+    }
 
-    std::map<path_type, EntryInfo> _files;
+    explicit ArchiveSource(std::filesystem::path const & path) : m_path(path)
+    {
+        _open();
+    }
 
-    ArchiveMount(path_type const & hostPath) : host_path(hostPath)
+    ArchiveSource(ArchiveSource const & other) : m_data(other.m_data), m_length(other.m_length), m_path(other.m_path)
+    {
+        if(!m_data)
+            _open();
+    }
+
+    ArchiveSource(ArchiveSource &&) = default;
+    ArchiveSource & operator=(ArchiveSource const & other) = delete;
+
+    /**
+     * @brief memory
+     * @return
+     *
+     * Returns the archive's bytes if it is in memory, nullptr otherwise
+     */
+    char const * memory() const
     {
-        ArchiveEntryStreamBuf buf;
-        if(!buf.open_archive(hostPath))
+        return m_data;
+    }
+
+    uint64_t size() const
+    {
+        return m_length;
+    }
+
+    /**
+     * @brief read_at
+     * @return
+     *
+     * Copy up to n bytes starting at offset and return the
+     * number of bytes copied
+     */
+    size_t read_at(uint64_t offset, void * out, size_t n)
+    {
+        if(offset >= m_length)
+            return 0;
+        n = static_cast<size_t>(std::min<uint64_t>(n, m_length - offset));
+        if(m_data)
+        {
+            std::memcpy(out, m_data + offset, n);
+            return n;
+        }
+        if(!m_file)
+            return 0;
+        // reading sequentially does not need a seek
+        if(m_pos != offset)
+        {
+            m_file->clear();
+            m_file->seekg(static_cast<std::streamoff>(offset));
+        }
+        m_file->read(static_cast<char*>(out), static_cast<std::streamsize>(n));
+        auto got = static_cast<size_t>(m_file->gcount());
+        m_pos = offset + got;
+        return got;
+    }
+
+protected:
+    void _open()
+    {
+        m_file = std::make_unique<std::ifstream>(m_path, std::ios::binary);
+        if(!*m_file)
         {
+            m_file.reset();
             return;
         }
+        std::error_code ec;
+        auto size = std::filesystem::file_size(m_path, ec);
+        m_length = ec ? 0 : size;
+    }
+
+    char const *                   m_data   = nullptr;
+    uint64_t                       m_length = 0;
+    std::filesystem::path          m_path;
+    std::unique_ptr<std::ifstream> m_file;
+    uint64_t                       m_pos    = 0;
+};
+
+/**
+ * @brief The ArchiveIndex struct
+ *
+ * Built when an archive is mounted. For a gzip compressed archive
+ * it holds a checkpoint about every checkpoint_span bytes of
+ * uncompressed data. A checkpoint is the state zlib needs to start
+ * inflating from the middle of the stream: where the deflate block
+ * starts and the 32KB of data before it. Any offset can then be
+ * reached by inflating at most checkpoint_span bytes.
+ *
+ * This is the method used by zran.c in the zlib examples.
+ */
+struct ArchiveIndex
+{
+    static constexpr size_t   window_size     = 32768;
+    static constexpr uint64_t checkpoint_span = 1u << 20;
 
-        do
+    struct Checkpoint
+    {
+        uint64_t                   in   = 0; // offset of the block in the compressed data
+        uint64_t                   out  = 0; // offset of the block in the uncompressed data
+        int                        bits = 0; // bits of the byte before `in` which belong to the block
+        std::vector<unsigned char> window;   // the uncompressed data before `out`
+    };
+
+    bool                    is_gzip = false;
+    std::vector<Checkpoint> checkpoints; // sorted by out
+
+    // the last checkpoint at or before the uncompressed offset
+    Checkpoint const * find(uint64_t out) const
+    {
+        auto it = std::upper_bound(checkpoints.begin(), checkpoints.end(), out, [](uint64_t o, auto const & c){ return o < c.out; });
+        if(it == checkpoints.begin())
+            return nullptr;
+        return &*std::prev(it);
+    }
+};
+
+/**
+ * @brief The ArchiveDataStreamBuf class
+ *
+ * Reads size bytes starting at offset in the uncompressed tar
+ * stream of a file on the host. Used for entries in uncompressed
+ * archives, which are read directly at their offset.
+ */
+class ArchiveDataStreamBuf : public std::streambuf
+{
+    static constexpr std::size_t BUFFER_SIZE = 64 * 1024;
+
+public:
+    ArchiveDataStreamBuf(ArchiveSource src, uint64_t offset, uint64_t size)
+        : m_src(std::move(src)), m_offset(offset), m_remaining(size), m_buffer(BUFFER_SIZE)
+    {
+        setg(m_buffer.data(), m_buffer.data(), m_buffer.data());
+    }
+
+protected:
+    int_type underflow() override
+    {
+        if(m_remaining == 0)
+            return traits_type::eof();
+        auto n = m_src.read_at(m_offset, m_buffer.data(), static_cast<size_t>(std::min<uint64_t>(m_buffer.size(), m_remaining)));
+        if(n == 0)
+            return traits_type::eof();
+        m_offset    += n;
+        m_remaining -= n;
+        setg(m_buffer.data(), m_buffer.data(), m_buffer.data() + n);
+        return traits_type::to_int_type(*gptr());
+    }
+
+    ArchiveSource     m_src;
+    uint64_t          m_offset;
+    uint64_t          m_remaining;
+    std::vector<char> m_buffer;
+};
+
+/**
+ * @brief The ArchiveMemoryStreamBuf class
+ *
+ * An entry in an uncompressed archive which is in memory. The
+ * entry is read straight out of the archive's memory.
+ */
+class ArchiveMemoryStreamBuf : public SpanStreamBuf
+{
+public:
+    explicit ArchiveMemoryStreamBuf(std::span<const char> s)
+    {
+        setSpan(s);
+    }
+};
+
+/**
+ * @brief The GzipEntryStreamBuf class
+ *
+ * Reads size bytes starting at offset in the uncompressed data of
+ * a gzip compressed archive. Inflating starts at the checkpoint
+ * before offset rather than at the start of the archive.
+ */
+class GzipEntryStreamBuf : public std::streambuf
+{
+    static constexpr std::size_t BUFFER_SIZE = 64 * 1024;
+
+public:
+    GzipEntryStreamBuf(ArchiveSource src, std::shared_ptr<ArchiveIndex const> index, uint64_t offset, uint64_t size)
+        : m_src(std::move(src)), m_index(std::move(index)), m_offset(offset), m_remaining(size), m_input(BUFFER_SIZE), m_buffer(BUFFER_SIZE)
+    {
+        setg(m_buffer.data(), m_buffer.data(), m_buffer.data());
+    }
+
+    ~GzipEntryStreamBuf()
+    {
+        if(m_started)
+            inflateEnd(&m_strm);
+    }
+
+    GzipEntryStreamBuf(GzipEntryStreamBuf const &) = delete;
+    GzipEntryStreamBuf & operator=(GzipEntryStreamBuf const &) = delete;
+
+protected:
+    bool _start()
+    {
+        auto cp = m_index->find(m_offset);
+        if(!cp)
+            return false;
+
+        m_strm = {};
+        if(inflateInit2(&m_strm, -15) != Z_OK) // raw deflate
+            return false;
+        m_started = true;
+
+        m_in = cp->in;
+        if(cp->bits)
         {
-            auto p = buf.next_entry();
-            if(p.empty())
-                break;
+            unsigned char c = 0;
+            if(m_src.read_at(cp->in - 1, &c, 1) != 1)
+                return false;
+            inflatePrime(&m_strm, cp->bits, c >> (8 - cp->bits));
+        }
+        if(!cp->window.empty())
+            inflateSetDictionary(&m_strm, cp->window.data(), static_cast<uInt>(cp->window.size()));
 
-            std::string path_s = p.generic_string();
-            std::filesystem::path pth = path_s;
-            _clean(pth);
-            EntryInfo e;
-            e.is_dir = path_s.back() == '/';
-            _files[pth] = e;
+        m_skip = m_offset - cp->out;
+        return true;
+    }
+
+    // inflate into the buffer, returns the number of bytes
+    size_t _inflate(char * out, size_t n)
+    {
+        m_strm.next_out  = reinterpret_cast<Bytef*>(out);
+        m_strm.avail_out = static_cast<uInt>(n);
+        while(m_strm.avail_out > 0 && !m_done)
+        {
+            if(m_strm.avail_in == 0)
+            {
+                auto got = m_src.read_at(m_in, m_input.data(), m_input.size());
+                if(got == 0)
+                {
+                    m_done = true;
+                    break;
+                }
+                m_in += got;
+                m_strm.next_in  = reinterpret_cast<Bytef*>(m_input.data());
+                m_strm.avail_in = static_cast<uInt>(got);
+            }
+            auto ret = inflate(&m_strm, Z_NO_FLUSH);
+            if(ret == Z_STREAM_END || (ret != Z_OK && ret != Z_BUF_ERROR))
+                m_done = true;
+        }
+        return n - m_strm.avail_out;
+    }
+
+    int_type underflow() override
+    {
+        if(m_remaining == 0)
+            return traits_type::eof();
+        if(!m_started && !_start())
+        {
+            m_remaining = 0;
+            return traits_type::eof();
+        }
 
-        } while(true);
+        // throw away the data between the checkpoint
+        // and the start of the entry
+        while(m_skip > 0 && !m_done)
+            m_skip -= _inflate(m_buffer.data(), static_cast<size_t>(std::min<uint64_t>(m_buffer.size(), m_skip)));
 
+        auto n = _inflate(m_buffer.data(), static_cast<size_t>(std::min<uint64_t>(m_buffer.size(), m_remaining)));
+        if(n == 0)
+        {
+            m_remaining = 0;
+            return traits_type::eof();
+        }
+        m_remaining -= n;
+        setg(m_buffer.data(), m_buffer.data(), m_buffer.data() + n);
+        return traits_type::to_int_type(*gptr());
     }
 
-    ArchiveMount(void const* data, size_t length)
-        :ArchiveMount(data, length, std::format("{}", data))
+    ArchiveSource                       m_src;
+    std::shared_ptr<ArchiveIndex const> m_index;
+    uint64_t                            m_offset;
+    uint64_t                            m_remaining;
+    uint64_t                            m_skip = 0;
+    uint64_t                            m_in   = 0;
+    z_stream                            m_strm = {};
+    bool                                m_started = false;
+    bool                                m_done    = false;
+    std::vector<char>                   m_input;
+    std::vector<char>                   m_buffer;
+};
+
+/**
+ * @brief The ArchiveIndexer class
+ *
+ * Reads an archive from start to end once, to list its entries and
+ * build its ArchiveIndex. libarchive only parses the tar headers:
+ * the data is handed to it through a read callback, which inflates
+ * gzip archives itself so that it can record the checkpoints on the
+ * way. Because of that, libarchive's byte count is the offset in the
+ * uncompressed tar stream, which is where each entry's data starts.
+ */
+class ArchiveIndexer
+{
+public:
+    struct Entry
     {
+        std::string path;
+        bool        is_dir = false;
+        uint32_t    mode   = 0;
+        int64_t     mtime  = 0;
+        uint64_t    offset = 0; // of the data in the uncompressed tar stream
+        uint64_t    size   = 0;
+    };
 
+    explicit ArchiveIndexer(ArchiveSource & src) : m_src(src), m_index(std::make_shared<ArchiveIndex>())
+    {
+        unsigned char magic[2] = {0, 0};
+        m_index->is_gzip = src.read_at(0, magic, 2) == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
     }
 
-    ArchiveMount(void const* data, size_t length, std::string info)
+    ~ArchiveIndexer()
     {
-        _data = data;
-        _length = length;
-        _info = info;
-        ArchiveEntryStreamBuf buf;
-        if(!buf.open_archive(data, length))
+        if(m_zinit)
+            inflateEnd(&m_strm);
+    }
+
+    ArchiveIndexer(ArchiveIndexer const &) = delete;
+    ArchiveIndexer & operator=(ArchiveIndexer const &) = delete;
+
+    /**
+     * @brief run
+     * @param f - called with each Entry
+     */
+    template<typename F>
+    void run(F && f)
+    {
+        auto a = archive_read_new();
+        archive_read_support_format_tar(a);
+        if(!m_index->is_gzip)
+            archive_read_set_skip_callback(a, &ArchiveIndexer::_skip);
+
+        if(archive_read_open(a, this, nullptr, &ArchiveIndexer::_read, nullptr) == ARCHIVE_OK)
         {
-            return;
+            struct archive_entry * entry;
+            while(archive_read_next_header(a, &entry) == ARCHIVE_OK)
+            {
+                Entry e;
+                e.path   = archive_entry_pathname(entry) ? archive_entry_pathname(entry) : "";
+                e.is_dir = (!e.path.empty() && e.path.back() == '/') || archive_entry_filetype(entry) == AE_IFDIR;
+                e.mode   = static_cast<uint32_t>(archive_entry_mode(entry));
+                e.mtime  = static_cast<int64_t>(archive_entry_mtime(entry));
+                e.offset = static_cast<uint64_t>(archive_filter_bytes(a, 0));
+                e.size   = archive_entry_size_is_set(entry) ? static_cast<uint64_t>(archive_entry_size(entry)) : 0;
+                if(!e.path.empty())
+                    f(e);
+            }
         }
+        archive_read_close(a);
+        archive_read_free(a);
+    }
+
+    std::shared_ptr<ArchiveIndex> index() const
+    {
+        return m_index;
+    }
 
-        do
+protected:
+    static la_ssize_t _read(struct archive *, void * client, const void ** buffer)
+    {
+        auto & I = *static_cast<ArchiveIndexer*>(client);
+        if(I.m_index->is_gzip)
+            return static_cast<la_ssize_t>(I._inflate(buffer));
+
+        // uncompressed archives in memory are handed over as they are
+        auto n = static_cast<size_t>(std::min<uint64_t>(BUFFER_SIZE, I.m_src.size() - std::min(I.m_in, I.m_src.size())));
+        if(auto m = I.m_src.memory())
         {
-            auto p = buf.next_entry();
-            if(p.empty())
+            *buffer = m + I.m_in;
+            I.m_in += n;
+            return static_cast<la_ssize_t>(n);
+        }
+        I.m_out.resize(BUFFER_SIZE);
+        n = I.m_src.read_at(I.m_in, I.m_out.data(), n);
+        I.m_in += n;
+        *buffer = I.m_out.data();
+        return static_cast<la_ssize_t>(n);
+    }
+
+    static la_int64_t _skip(struct archive *, void * client, la_int64_t request)
+    {
+        auto & I = *static_cast<ArchiveIndexer*>(client);
+        auto left = I.m_src.size() - std::min(I.m_in, I.m_src.size());
+        auto n = std::min<uint64_t>(static_cast<uint64_t>(request), left);
+        I.m_in += n;
+        return static_cast<la_int64_t>(n);
+    }
+
+    size_t _inflate(const void ** buffer)
+    {
+        if(!m_zinit)
+        {
+            m_strm = {};
+            if(inflateInit2(&m_strm, 47) != Z_OK) // gzip header
+                return 0;
+            m_zinit = true;
+            m_input.resize(BUFFER_SIZE);
+            m_window.assign(ArchiveIndex::window_size, 0);
+            m_out.resize(BUFFER_SIZE);
+        }
+
+        size_t n = 0;
+        while(n < m_out.size() && !m_done)
+        {
+            if(m_strm.avail_in == 0)
+            {
+                auto got = m_src.read_at(m_in, m_input.data(), m_input.size());
+                if(got == 0)
+                {
+                    m_done = true;
+                    break;
+                }
+                m_in += got;
+                m_strm.next_in  = reinterpret_cast<Bytef*>(m_input.data());
+                m_strm.avail_in = static_cast<uInt>(got);
+            }
+
+            // inflate into the circular window, a block at a time
+            auto in_before  = m_strm.avail_in;
+            auto out_before = static_cast<uInt>(std::min(ArchiveIndex::window_size - m_wpos, m_out.size() - n));
+            m_strm.next_out  = m_window.data() + m_wpos;
+            m_strm.avail_out = out_before;
+            auto ret = inflate(&m_strm, Z_BLOCK);
+
+            auto produced = out_before - m_strm.avail_out;
+            std::memcpy(m_out.data() + n, m_window.data() + m_wpos, produced);
+            n       += produced;
+            m_wpos   = (m_wpos + produced) % ArchiveIndex::window_size;
+            m_totin += in_before - m_strm.avail_in;
+            m_totout += produced;
+
+            // concatenated gzip members are not supported, the
+            // archive ends with the first member
+            if(ret == Z_STREAM_END || (ret != Z_OK && ret != Z_BUF_ERROR))
+            {
+                m_done = true;
                 break;
+            }
 
-            std::string path_s = p.generic_string();
-            std::filesystem::path pth = path_s;
-            _clean(pth);
-            EntryInfo e;
-            e.is_dir = path_s.back() == '/';
-            _files[pth] = e;
+            // at the end of a deflate block which is not the last one
+            if((m_strm.data_type & 128) && !(m_strm.data_type & 64) &&
+               (m_totout == 0 || m_totout - m_last > ArchiveIndex::checkpoint_span))
+            {
+                _addCheckpoint(m_strm.data_type & 7);
+                m_last = m_totout;
+            }
+        }
+        *buffer = m_out.data();
+        return n;
+    }
+
+    void _addCheckpoint(int bits)
+    {
+        ArchiveIndex::Checkpoint c;
+        c.in   = m_totin;
+        c.out  = m_totout;
+        c.bits = bits;
+        if(m_totout > 0)
+        {
+            // unroll the circular window
+            c.window.reserve(ArchiveIndex::window_size);
+            c.window.insert(c.window.end(), m_window.begin() + static_cast<std::ptrdiff_t>(m_wpos), m_window.end());
+            c.window.insert(c.window.end(), m_window.begin(), m_window.begin() + static_cast<std::ptrdiff_t>(m_wpos));
+        }
+        m_index->checkpoints.push_back(std::move(c));
+    }
+
+    static constexpr std::size_t BUFFER_SIZE = 64 * 1024;
 
-        } while(true);
+    ArchiveSource &                 m_src;
+    std::shared_ptr<ArchiveIndex>   m_index;
+    uint64_t                        m_in = 0;   // read position in the source
+
+    // gzip
+    z_stream                        m_strm = {};
+    bool                            m_zinit = false;
+    bool                            m_done  = false;
+    std::vector<char>               m_input;
+    std::vector<unsigned char>      m_window;
+    size_t                          m_wpos   = 0;
+    uint64_t                        m_totin  = 0;
+    uint64_t                        m_totout = 0;
+    uint64_t                        m_last   = 0;
+    std::vector<char>               m_out;
+};
+
+/**
+ * @brief The ArchiveTree class
+ *
+ * The directory tree of an archive, built once when it is mounted.
+ *
+ * The nodes are stored in a single vector and refer to each other by
+ * index, and all their names are stored in a single string. The
+ * children of a directory are stored next to each other, sorted by
+ * name, so listing a directory only visits its children and finding a
+ * path does a binary search at each level of the path.
+ *
+ * Tar files do not need to contain an entry for every directory. The
+ * missing parent directories are added when the tree is built.
+ */
+class ArchiveTree
+{
+public:
+    using index_type = uint32_t;
+    static constexpr index_type root = 0;
+    static constexpr index_type npos = std::numeric_limits<index_type>::max();
+
+    struct Node
+    {
+        uint32_t   name_offset = 0; // into the names string
+        uint32_t   name_length = 0;
+        index_type first_child = 0; // into the children array
+        index_type child_count = 0;
+        bool       is_dir      = false;
+        uint32_t   mode        = 0;
+        int64_t    mtime       = 0;
+        uint64_t   offset      = 0; // of the data in the uncompressed tar stream
+        uint64_t   size        = 0;
+    };
+
+    ArchiveTree()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        m_nodes.assign(1, Node{});
+        m_nodes[root].is_dir = true;
+        m_parents.assign(1, npos);
+        m_names.clear();
+        m_children.clear();
+        m_lookup.clear();
+    }
+
+    /**
+     * @brief insert
+     * @param path - a relative path, with / as the separator
+     * @param is_dir
+     * @return
+     *
+     * Add the path to the tree along with any of its parent
+     * directories which are not in the tree yet. Returns the
+     * index of the node, or npos if the path leaves the tree.
+     * Call finalize() once all the paths have been inserted.
+     */
+    index_type insert(std::string_view path, bool is_dir)
+    {
+        index_type parent = root;
+        size_t     start  = 0;
+        while(start <= path.size())
+        {
+            auto end = path.find('/', start);
+            if(end == std::string_view::npos)
+                end = path.size();
+            auto name = path.substr(start, end - start);
+            bool last = end == path.size();
+            start = end + 1;
+
+            if(name.empty() || name == ".")
+                continue;
+            if(name == "..")
+                return npos;
+
+            auto key = path.substr(0, end);
+            auto it  = m_lookup.find(std::string(key));
+            if(it == m_lookup.end())
+            {
+                Node n;
+                n.name_offset = static_cast<uint32_t>(m_names.size());
+                n.name_length = static_cast<uint32_t>(name.size());
+                m_names.append(name);
+                it = m_lookup.emplace(std::string(key), static_cast<index_type>(m_nodes.size())).first;
+                m_nodes.push_back(n);
+                m_parents.push_back(parent);
+            }
+            parent = it->second;
+            // a parent must be a directory, even if the
+            // archive says otherwise
+            if(!last)
+                m_nodes[parent].is_dir = true;
+        }
+        if(parent != root)
+            m_nodes[parent].is_dir = m_nodes[parent].is_dir || is_dir;
+        return parent;
+    }
+
+    /**
+     * @brief finalize
+     *
+     * Sort the children of every directory and release the
+     * memory which was only needed while inserting
+     */
+    void finalize()
+    {
+        m_children.resize(m_nodes.size() - 1);
+        for(index_type i=1; i<m_nodes.size(); i++)
+            m_children[i-1] = i;
+
+        std::sort(m_children.begin(), m_children.end(), [&](index_type a, index_type b)
+        {
+            if(m_parents[a] != m_parents[b])
+                return m_parents[a] < m_parents[b];
+            return name(a) < name(b);
+        });
+
+        for(index_type c=0; c<m_children.size(); c++)
+        {
+            auto & P = m_nodes[m_parents[m_children[c]]];
+            if(P.child_count++ == 0)
+                P.first_child = c;
+        }
+
+        m_lookup  = {};
+        m_parents = {};
+    }
+
+    /**
+     * @brief find
+     * @param path
+     * @return
+     *
+     * Returns the index of the node at the relative path, or npos
+     */
+    index_type find(std::filesystem::path const & path) const
+    {
+        index_type i = root;
+        for(auto & part : path)
+        {
+            auto const & s = part.native();
+            if(s.empty() || s == ".")
+                continue;
+            i = find_child(i, part.generic_string());
+            if(i == npos)
+                return npos;
+        }
+        return i;
+    }
+
+    index_type find_child(index_type dir, std::string_view name) const
+    {
+        auto C  = children(dir);
+        auto it = std::lower_bound(C.begin(), C.end(), name, [&](index_type c, std::string_view n){ return this->name(c) < n; });
+        if(it == C.end() || this->name(*it) != name)
+            return npos;
+        return *it;
+    }
+
+    std::span<const index_type> children(index_type dir) const
+    {
+        auto & N = m_nodes[dir];
+        if(N.child_count == 0)
+            return {};
+        return {m_children.data() + N.first_child, N.child_count};
+    }
+
+    std::string_view name(index_type i) const
+    {
+        auto & N = m_nodes[i];
+        return std::string_view(m_names).substr(N.name_offset, N.name_length);
+    }
+
+    Node & node(index_type i)
+    {
+        return m_nodes[i];
+    }
+    Node const & node(index_type i) const
+    {
+        return m_nodes[i];
+    }
+
+    // number of nodes, including the root
+    size_t size() const
+    {
+        return m_nodes.size();
+    }
+
+protected:
+    std::vector<Node>       m_nodes;
+    std::string             m_names;
+    std::vector<index_type> m_children;
+
+    // only used while inserting
+    std::vector<index_type>                     m_parents;
+    std::unordered_map<std::string, index_type> m_lookup;
+};
+
+/**
+ * @brief The ArchiveCache class
+ *
+ * A least recently used cache of the decompressed contents of archive
+ * entries, shared by everything that reads from the same ArchiveMount.
+ * The cache holds at most max_bytes of data, and entries larger than
+ * max_entry_size are never cached, so that reading one large file does
+ * not push out all the small ones.
+ *
+ * Contents are handed out as shared pointers, so evicting an entry
+ * does not affect the streams that are still reading it.
+ */
+class ArchiveCache
+{
+public:
+    using key_type   = uint32_t;
+    using value_type = std::shared_ptr<std::string const>;
+
+    static constexpr size_t default_max_bytes      = 16u * 1024u * 1024u;
+    static constexpr size_t default_max_entry_size = 1024u * 1024u;
+
+    struct Stats
+    {
+        uint64_t hits      = 0;
+        uint64_t misses    = 0;
+        uint64_t evictions = 0;
+        size_t   entries   = 0;
+        size_t   bytes     = 0;
+    };
+
+    /**
+     * @brief set_limits
+     * @param max_bytes - total size of the cached contents, 0 disables the cache
+     * @param max_entry_size - larger entries are not cached
+     */
+    void set_limits(size_t max_bytes, size_t max_entry_size = default_max_entry_size)
+    {
+        std::lock_guard L(m_mutex);
+        m_max_bytes      = max_bytes;
+        m_max_entry_size = max_entry_size;
+        _evict(0);
+    }
+
+    bool can_cache(uint64_t size) const
+    {
+        std::lock_guard L(m_mutex);
+        return size <= m_max_entry_size && size <= m_max_bytes;
+    }
+
+    /**
+     * @brief get
+     * @param key
+     * @return
+     *
+     * Returns the cached contents and marks them as the most
+     * recently used, or nullptr if they are not in the cache.
+     */
+    value_type get(key_type key)
+    {
+        std::lock_guard L(m_mutex);
+        auto it = m_map.find(key);
+        if(it == m_map.end())
+        {
+            ++m_stats.misses;
+            return nullptr;
+        }
+        ++m_stats.hits;
+        m_lru.splice(m_lru.begin(), m_lru, it->second);
+        return it->second->second;
+    }
+
+    void put(key_type key, value_type value)
+    {
+        std::lock_guard L(m_mutex);
+        if(!value || value->size() > m_max_entry_size || value->size() > m_max_bytes)
+            return;
+        // another reader may have added it first
+        if(m_map.count(key))
+            return;
+
+        _evict(value->size());
+        m_stats.bytes += value->size();
+        m_lru.emplace_front(key, std::move(value));
+        m_map[key] = m_lru.begin();
+        m_stats.entries = m_map.size();
+    }
+
+    void clear()
+    {
+        std::lock_guard L(m_mutex);
+        m_lru.clear();
+        m_map.clear();
+        m_stats.bytes   = 0;
+        m_stats.entries = 0;
+    }
+
+    Stats stats() const
+    {
+        std::lock_guard L(m_mutex);
+        return m_stats;
+    }
+
+protected:
+    // remove the least recently used entries until
+    // there is room for another n bytes
+    void _evict(size_t n)
+    {
+        while(!m_lru.empty() && m_stats.bytes + n > m_max_bytes)
+        {
+            auto & [key, value] = m_lru.back();
+            m_stats.bytes -= value->size();
+            m_map.erase(key);
+            m_lru.pop_back();
+            ++m_stats.evictions;
+        }
+        m_stats.entries = m_map.size();
+    }
+
+    using list_type = std::list<std::pair<key_type, value_type>>;
+
+    mutable std::mutex                                     m_mutex;
+    list_type                                              m_lru; // most recently used first
+    std::unordered_map<key_type, list_type::iterator>      m_map;
+    size_t                                                 m_max_bytes      = default_max_bytes;
+    size_t                                                 m_max_entry_size = default_max_entry_size;
+    Stats                                                  m_stats;
+};
+
+/**
+ * @brief The CachedEntryStreamBuf class
+ *
+ * Reads an entry out of the ArchiveCache. The contents are kept
+ * alive until the stream is closed.
+ */
+class CachedEntryStreamBuf : public SpanStreamBuf
+{
+public:
+    explicit CachedEntryStreamBuf(ArchiveCache::value_type contents) : m_contents(std::move(contents))
+    {
+        setSpan(*m_contents);
+    }
+
+protected:
+    ArchiveCache::value_type m_contents;
+};
+
+struct ArchiveMount : public FSMountBase
+{
+    path_type host_path;
+    void const * _data = nullptr;
+    size_t _length = 0;
+    std::string _info;
+    ArchiveTree _tree;
+    ArchiveCache _cache;
+    std::shared_ptr<ArchiveIndex const> _index;
+
+    ArchiveMount(path_type const & hostPath) : host_path(hostPath)
+    {
+        ArchiveSource src(hostPath);
+        _build(src);
+    }
+
+    ArchiveMount(void const* data, size_t length)
+        :ArchiveMount(data, length, std::format("{}", data))
+    {
+
+    }
+
+    ArchiveMount(void const* data, size_t length, std::string info)
+    {
+        _data = data;
+        _length = length;
+        _info = info;
+        ArchiveSource src(data, length);
+        _build(src);
     }
 
     virtual bool is_read_only() const override
@@ -200,8 +1029,7 @@ struct ArchiveMount : public FSMountBase
         if(path == ".")
             return result_type::True;
         assert(!path.has_root_directory());
-        auto it = _files.find(path);
-        return it != _files.end() ? result_type::True : result_type::False;
+        return _tree.find(path) != ArchiveTree::npos ? result_type::True : result_type::False;
     }
 
     virtual result_type mkdir(path_type relPath) override
@@ -220,11 +1048,11 @@ struct ArchiveMount : public FSMountBase
         if(relPath == "." || relPath.empty())
             return NodeType::MountDir;
 
-        auto it = _files.find(relPath);
-        if(it == _files.end())
+        auto i = _tree.find(relPath);
+        if(i == ArchiveTree::npos)
             return NodeType::NoExist;
 
-        return it->second.is_dir ? NodeType::MountDir : NodeType::MountFile;
+        return _tree.node(i).is_dir ? NodeType::MountDir : NodeType::MountFile;
     }
 
     virtual result_type remove(path_type relPath) override
@@ -237,21 +1065,76 @@ struct ArchiveMount : public FSMountBase
 
     PseudoNix::Generator<std::filesystem::path> list_dir(path_type path) override
     {
-        (void)path;
-        if(path == ".")
-            path.clear();
-        for(auto & [pth, info] : _files)
+        auto i = _tree.find(path);
+        if(i == ArchiveTree::npos || !_tree.node(i).is_dir)
+            co_return;
+        for(auto c : _tree.children(i))
         {
-            if(path.lexically_relative(pth) == "..")
-            {
-                co_yield pth.lexically_relative(path);
-            }
+            co_yield std::filesystem::path(_tree.name(c));
         }
     }
 
+    /**
+     * @brief cache
+     * @return
+     *
+     * Returns the cache of decompressed entries, which can be
+     * used to change its limits or read its hit/miss counts
+     */
+    ArchiveCache & cache()
+    {
+        return _cache;
+    }
+
     std::unique_ptr<std::streambuf> open(path_type relPath, std::ios::openmode mode) override
     {
         (void)mode;
+        auto i = _tree.find(relPath);
+        if(i == ArchiveTree::npos || _tree.node(i).is_dir)
+            return _openEntry(relPath, i);
+
+        // entries in an uncompressed tar in memory are
+        // already read without copying them
+        if(_data && _index && !_index->is_gzip)
+            return _openEntry(relPath, i);
+
+        auto size = _tree.node(i).size;
+        if(!_cache.can_cache(size))
+            return _openEntry(relPath, i);
+
+        if(auto c = _cache.get(i))
+            return std::make_unique<CachedEntryStreamBuf>(std::move(c));
+
+        auto buf = _openEntry(relPath, i);
+        auto contents = std::make_shared<std::string>(static_cast<size_t>(size), '\0');
+        auto n = buf->sgetn(contents->data(), static_cast<std::streamsize>(contents->size()));
+        if(static_cast<uint64_t>(n) != size)
+        {
+            // the entry could not be read, don't cache it
+            contents->resize(static_cast<size_t>(std::max<std::streamsize>(n, 0)));
+            return std::make_unique<CachedEntryStreamBuf>(std::move(contents));
+        }
+        _cache.put(i, contents);
+        return std::make_unique<CachedEntryStreamBuf>(std::move(contents));
+    }
+
+protected:
+    std::unique_ptr<std::streambuf> _openEntry(path_type const & relPath, ArchiveTree::index_type i)
+    {
+        if(_index && i != ArchiveTree::npos && !_tree.node(i).is_dir)
+        {
+            // read the entry at its offset rather than
+            // searching the archive for it
+            auto & e = _tree.node(i);
+            if(_data && !_index->is_gzip)
+                return std::make_unique<ArchiveMemoryStreamBuf>(std::span<const char>(static_cast<char const*>(_data) + e.offset, static_cast<size_t>(e.size)));
+
+            auto src = _data ? ArchiveSource(_data, _length) : ArchiveSource(host_path);
+            if(!_index->is_gzip)
+                return std::make_unique<ArchiveDataStreamBuf>(std::move(src), e.offset, e.size);
+            return std::make_unique<GzipEntryStreamBuf>(std::move(src), _index, e.offset, e.size);
+        }
+
         auto p = std::make_unique<ArchiveEntryStreamBuf>();
         if(!host_path.empty())
             p->open(host_path, relPath);
@@ -259,6 +1142,32 @@ struct ArchiveMount : public FSMountBase
             p->open(_data, _length, relPath);
         return p;
     }
+
+    void _build(ArchiveSource & src)
+    {
+        ArchiveIndexer indexer(src);
+        bool valid = true;
+        indexer.run([&](ArchiveIndexer::Entry const & entry)
+        {
+            std::filesystem::path pth = entry.path;
+            _clean(pth);
+            auto i = _tree.insert(pth.generic_string(), entry.is_dir);
+            if(i == ArchiveTree::npos || i == ArchiveTree::root)
+                return;
+            auto & e = _tree.node(i);
+            e.mode   = entry.mode;
+            e.mtime  = entry.mtime;
+            e.offset = entry.offset;
+            e.size   = entry.size;
+            // entries must lie inside the uncompressed stream
+            // for the offsets to be used
+            if(!indexer.index()->is_gzip && e.offset + e.size > src.size())
+                valid = false;
+        });
+        _tree.finalize();
+        if(valid)
+            _index = indexer.index();
+    }
 };
 
 inline void enable_archive_mount(System & sys)
@@ -298,6 +1207,28 @@ inline void enable_archive_mount(System & sys)
             co_return 0;
         }
 
+        // 0       1     2
+        // archive stats MNT
+        //
+        if(ARGS.size() == 3 && ARGS[1] == "stats")
+        {
+            PseudoNix::System::path_type MNT = ARGS[2];
+            HANDLE_PATH(CWD, MNT);
+
+            auto [node, rem] = SYSTEM.find_last_valid_virtual_node(MNT);
+            auto dir = std::dynamic_pointer_cast<PseudoNix::FSNodeDir>(node);
+            auto arc = dir && rem.empty() ? std::dynamic_pointer_cast<PseudoNix::ArchiveMount>(dir->mount) : nullptr;
+            if(!arc)
+            {
+                COUT << std::format("No archive is mounted on {}\n", MNT.generic_string());
+                co_return 1;
+            }
+            auto S = arc->cache().stats();
+            COUT << std::format("hits {}\nmisses {}\nevictions {}\nentries {}\nbytes {}\n",
+                                S.hits, S.misses, S.evictions, S.entries, S.bytes);
+            co_return 0;
+        }
+
         COUT << std::format("Unknown error\n");
 
         co_return 1;
@@ -0,0 +1,258 @@
+#ifndef PSEUDONIX_CONCURRENT_MAP_H
+#define PSEUDONIX_CONCURRENT_MAP_H
+
+#include <map>
+#include <array>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+namespace PseudoNix
+{
+
+/**
+ * @brief The ShardedMap_t class
+ *
+ * A map from Key to std::shared_ptr<T> which can be used from multiple
+ * threads. The keys are spread over a number of shards, each with its
+ * own reader/writer lock, so threads working on different keys rarely
+ * wait on each other and lookups never block other lookups.
+ *
+ * Values are held by shared_ptr, so a value returned by find() stays
+ * valid even if it is erased from the map by another thread.
+ */
+template<typename Key, typename T, size_t ShardCount = 16>
+class ShardedMap_t
+{
+public:
+    using key_type   = Key;
+    using value_ptr  = std::shared_ptr<T>;
+
+    value_ptr find(Key const & key) const
+    {
+        auto & S = _shard(key);
+        std::shared_lock L(S.m);
+        auto it = S.items.find(key);
+        return it == S.items.end() ? nullptr : it->second;
+    }
+
+    bool contains(Key const & key) const
+    {
+        auto & S = _shard(key);
+        std::shared_lock L(S.m);
+        return S.items.count(key) != 0;
+    }
+
+    /**
+     * @brief emplace
+     * @param key
+     * @param value
+     * @return
+     *
+     * Insert the value if the key does not exist. Returns false
+     * if the key was already in the map.
+     */
+    bool emplace(Key const & key, value_ptr value)
+    {
+        auto & S = _shard(key);
+        std::unique_lock L(S.m);
+        if(!S.items.emplace(key, std::move(value)).second)
+            return false;
+        m_size.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool erase(Key const & key)
+    {
+        value_ptr removed;
+        {
+            auto & S = _shard(key);
+            std::unique_lock L(S.m);
+            auto it = S.items.find(key);
+            if(it == S.items.end())
+                return false;
+            // destroy the value outside of the lock
+            removed = std::move(it->second);
+            S.items.erase(it);
+            m_size.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    size_t size() const
+    {
+        return m_size.load(std::memory_order_relaxed);
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    /**
+     * @brief snapshot
+     * @return
+     *
+     * Returns a copy of all the items in the map, sorted by key.
+     * The map can be modified while iterating through the copy.
+     */
+    std::vector<std::pair<Key, value_ptr>> snapshot() const
+    {
+        std::vector<std::pair<Key, value_ptr>> out;
+        out.reserve(size());
+        for(auto & S : m_shards)
+        {
+            std::shared_lock L(S.m);
+            out.insert(out.end(), S.items.begin(), S.items.end());
+        }
+        std::sort(out.begin(), out.end(), [](auto & a, auto & b){ return a.first < b.first; });
+        return out;
+    }
+
+    /**
+     * @brief for_each
+     * @param f
+     *
+     * Call f(key, value) for every item while holding each shard's
+     * read lock. f must not modify the map. The items are not visited
+     * in order, use snapshot() if the order matters.
+     */
+    template<typename callable_t>
+    void for_each(callable_t && f) const
+    {
+        for(auto & S : m_shards)
+        {
+            std::shared_lock L(S.m);
+            for(auto & [k, v] : S.items)
+                f(k, v);
+        }
+    }
+
+    void clear()
+    {
+        for(auto & S : m_shards)
+        {
+            std::map<Key, value_ptr> removed;
+            {
+                std::unique_lock L(S.m);
+                m_size.fetch_sub(S.items.size(), std::memory_order_relaxed);
+                removed.swap(S.items);
+            }
+        }
+    }
+
+protected:
+    struct alignas(64) Shard
+    {
+        mutable std::shared_mutex m;
+        std::map<Key, value_ptr>  items;
+    };
+
+    Shard & _shard(Key const & key)
+    {
+        return m_shards[std::hash<Key>{}(key) % ShardCount];
+    }
+    Shard const & _shard(Key const & key) const
+    {
+        return m_shards[std::hash<Key>{}(key) % ShardCount];
+    }
+
+    std::array<Shard, ShardCount> m_shards;
+    std::atomic<size_t>           m_size = 0;
+};
+
+/**
+ * @brief The CopyOnWriteMap_t class
+ *
+ * A map which is read far more often than it is written. Readers take
+ * a snapshot() of the map and can use it for as long as they like
+ * without holding any locks. Writers copy the map, modify the copy and
+ * then publish it, so existing snapshots never change.
+ *
+ * Only swapping the pointer to the current map is guarded by a
+ * mutex, the lookups themselves are done outside of it.
+ */
+template<typename Key, typename T>
+class CopyOnWriteMap_t
+{
+public:
+    using map_type      = std::map<Key, T>;
+    using snapshot_type = std::shared_ptr<map_type const>;
+
+    snapshot_type snapshot() const
+    {
+        std::lock_guard L(m_ptrMutex);
+        return m_map;
+    }
+
+    void set(Key const & key, T value)
+    {
+        update([&](map_type & m){ m[key] = std::move(value); });
+    }
+
+    void erase(Key const & key)
+    {
+        update([&](map_type & m){ m.erase(key); });
+    }
+
+    void clear()
+    {
+        update([](map_type & m){ m.clear(); });
+    }
+
+    /**
+     * @brief update
+     * @param f
+     *
+     * Apply f to a copy of the current map and publish the result.
+     * Writers are serialized, but never block readers for longer
+     * than it takes to swap the pointer.
+     */
+    template<typename callable_t>
+    void update(callable_t && f)
+    {
+        std::lock_guard W(m_writeMutex);
+        auto copy = std::make_shared<map_type>(*snapshot());
+        f(*copy);
+        snapshot_type old;
+        {
+            std::lock_guard L(m_ptrMutex);
+            old = std::exchange(m_map, std::move(copy));
+        }
+    }
+
+    /**
+     * @brief The Setter struct
+     *
+     * Allows map[key] = value syntax for writing a single item
+     */
+    struct Setter
+    {
+        CopyOnWriteMap_t & map;
+        Key                key;
+        Setter& operator=(T value)
+        {
+            map.set(key, std::move(value));
+            return *this;
+        }
+    };
+
+    Setter operator[](Key const & key)
+    {
+        return Setter{*this, key};
+    }
+
+protected:
+    mutable std::mutex m_ptrMutex;
+    std::mutex         m_writeMutex;
+    snapshot_type      m_map = std::make_shared<map_type const>();
+};
+
+}
+
+#endif
@@ -0,0 +1,270 @@
+#ifndef PSEUDONIX_ENVIRONMENT_H
+#define PSEUDONIX_ENVIRONMENT_H
+
+#include <map>
+#include <memory>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
+namespace PseudoNix
+{
+
+/**
+ * @brief The Environment class
+ *
+ * Stores a process's environment variables.
+ *
+ * Variables are kept in a small flat vector, which is faster to search
+ * than a map for the handful of variables a process normally has.
+ * Names are stored and compared by value. Most of them fit in
+ * std::string's small buffer, so they do not allocate.
+ *
+ * A child process does not copy its parent's exported variables.
+ * Instead, it shares an immutable snapshot of them (the base) and only
+ * keeps the variables it sets itself. Reading a variable checks the
+ * process's own variables first and then the base. Writing to a
+ * variable from the base copies just that variable. The parent's
+ * snapshot is reused for every child until the parent changes one of
+ * its exported variables.
+ */
+class Environment
+{
+public:
+    struct Entry
+    {
+        std::string first;  // name
+        std::string second; // value
+    };
+    using storage_type  = std::vector<Entry>;
+    using snapshot_type = std::shared_ptr<storage_type const>;
+
+    Environment() = default;
+
+    Environment(std::map<std::string, std::string> const & vars)
+    {
+        for(auto & [var, val] : vars)
+            (*this)[var] = val;
+    }
+
+    /**
+     * @brief inherit
+     * @param parent
+     *
+     * Share the parent's exported variables. Variables that
+     * have already been set in this environment are kept.
+     */
+    void inherit(Environment const & parent)
+    {
+        m_base = parent.exported_snapshot();
+        _invalidate();
+    }
+
+    /**
+     * @brief share
+     * @param base
+     *
+     * Use the snapshot as this environment's base. Many
+     * environments can share the same snapshot, see snapshot().
+     */
+    void share(snapshot_type base)
+    {
+        m_base = std::move(base);
+        _invalidate();
+    }
+
+    std::string const * get(std::string_view key) const
+    {
+        if(auto e = _find(m_local, key))
+            return &e->second;
+        if(m_base)
+        {
+            if(auto e = _find(*m_base, key))
+                return &e->second;
+        }
+        return nullptr;
+    }
+
+    size_t count(std::string_view key) const
+    {
+        return get(key) ? 1u : 0u;
+    }
+
+    std::string const & at(std::string_view key) const
+    {
+        if(auto v = get(key))
+            return *v;
+        throw std::out_of_range(std::string(key));
+    }
+
+    /**
+     * @brief operator []
+     * @param key
+     * @return
+     *
+     * Returns a reference to the variable, creating it if it does
+     * not exist. The reference is only valid until the next
+     * variable is added.
+     */
+    std::string & operator[](std::string_view key)
+    {
+        ++m_version;
+        if(is_exported(key))
+            _invalidate();
+
+        if(auto e = _find(m_local, key))
+            return e->second;
+
+        std::string value;
+        if(m_base)
+        {
+            if(auto e = _find(*m_base, key))
+                value = e->second;
+        }
+        m_local.push_back({std::string(key), std::move(value)});
+        return m_local.back().second;
+    }
+
+    size_t size() const
+    {
+        auto n = m_local.size();
+        if(m_base)
+        {
+            for(auto & e : *m_base)
+                if(!_find(m_local, e.first))
+                    ++n;
+        }
+        return n;
+    }
+
+    /**
+     * @brief set_exported
+     * @param key
+     *
+     * Mark the variable so that it is passed on to child processes.
+     */
+    void set_exported(std::string_view key)
+    {
+        if(is_exported(key))
+            return;
+        m_exported.emplace_back(key);
+        _invalidate();
+    }
+
+    bool is_exported(std::string_view key) const
+    {
+        return std::any_of(m_exported.begin(), m_exported.end(), [&](auto & k){ return k == key; });
+    }
+
+    std::vector<std::string> const & exported() const
+    {
+        return m_exported;
+    }
+
+    /**
+     * @brief exported_snapshot
+     * @return
+     *
+     * Returns the exported variables which are currently set. The
+     * snapshot is cached until one of the exported variables is
+     * written to.
+     */
+    snapshot_type exported_snapshot() const
+    {
+        if(m_exportCache)
+            return m_exportCache;
+
+        auto out = std::make_shared<storage_type>();
+        for(auto & k : m_exported)
+        {
+            if(auto v = get(k))
+                out->push_back({k, *v});
+        }
+        m_exportCache = std::move(out);
+        return m_exportCache;
+    }
+
+    /**
+     * @brief entries
+     * @return
+     *
+     * Returns a copy of all the variables, including the ones in the
+     * base, sorted by name. Use this to visit every variable.
+     */
+    storage_type entries() const
+    {
+        storage_type out = m_local;
+        if(m_base)
+        {
+            for(auto & e : *m_base)
+                if(!_find(m_local, e.first))
+                    out.push_back(e);
+        }
+        std::sort(out.begin(), out.end(), [](auto & a, auto & b){ return a.first < b.first; });
+        return out;
+    }
+
+    /**
+     * @brief snapshot
+     * @return
+     *
+     * Returns an immutable copy of all the variables, which
+     * can be shared with other environments using share().
+     * If none of the variables have been set in this
+     * environment, the base is returned rather than copied.
+     */
+    snapshot_type snapshot() const
+    {
+        if(m_local.empty() && m_base)
+            return m_base;
+        return std::make_shared<storage_type const>(entries());
+    }
+
+    /**
+     * @brief version
+     * @return
+     *
+     * Returns a number which changes whenever the environment may
+     * have been modified. Can be used to tell whether a snapshot
+     * is out of date.
+     */
+    uint64_t version() const
+    {
+        return m_version;
+    }
+
+protected:
+    static Entry const * _find(storage_type const & s, std::string_view key)
+    {
+        for(auto & e : s)
+            if(e.first == key)
+                return &e;
+        return nullptr;
+    }
+    static Entry * _find(storage_type & s, std::string_view key)
+    {
+        for(auto & e : s)
+            if(e.first == key)
+                return &e;
+        return nullptr;
+    }
+
+    void _invalidate()
+    {
+        ++m_version;
+        m_exportCache.reset();
+    }
+
+    storage_type                  m_local;
+    snapshot_type                 m_base;
+    std::vector<std::string>      m_exported;
+    mutable snapshot_type         m_exportCache;
+    uint64_t                      m_version = 0;
+};
+
+}
+
+#endif
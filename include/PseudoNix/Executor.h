@@ -0,0 +1,310 @@
+#ifndef PSEUDONIX_EXECUTOR_H
+#define PSEUDONIX_EXECUTOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace PseudoNix
+{
+
+/**
+ * @brief The Executor_t class
+ *
+ * Runs items on a pool of worker threads.
+ *
+ * Items come from a shared source (the pull function) and are handed
+ * to the process function. If the process function returns true, the
+ * item was not finished and it is placed on the back of the worker's
+ * own deque. Items pushed from a worker thread with push_local() also
+ * go onto that worker's deque.
+ *
+ * A worker takes items from the front of its own deque first, then
+ * from the shared source, and finally steals from the back of the other
+ * workers' deques. Workers with nothing to do sleep on a condition
+ * variable until notify() is called.
+ *
+ * An item is only ever held by one worker at a time, so as long as
+ * each item appears once, it is never processed on two threads at once.
+ */
+template<typename Item>
+class Executor_t
+{
+public:
+    using value_type       = Item;
+    using pull_function    = std::function<bool(Item&)>;
+    using process_function = std::function<bool(Item&)>;
+
+    struct WorkerStats
+    {
+        size_t                   resumes = 0;
+        size_t                   steals  = 0;
+        std::chrono::nanoseconds busy    = {};
+        std::chrono::nanoseconds total   = {};
+
+        // fraction of time spent processing items
+        double utilization() const
+        {
+            if(total.count() == 0)
+                return 0.0;
+            return static_cast<double>(busy.count()) / static_cast<double>(total.count());
+        }
+    };
+
+    Executor_t(size_t threads, pull_function pull, process_function process)
+        : m_pull(std::move(pull)), m_process(std::move(process))
+    {
+        threads = std::max<size_t>(1, threads);
+        for(size_t i=0;i<threads;i++)
+        {
+            auto w = std::make_unique<Worker>();
+            w->owner = this;
+            w->index = i;
+            m_workers.push_back(std::move(w));
+        }
+        for(auto & w : m_workers)
+        {
+            w->thread = std::thread([this, _w=w.get()]()
+            {
+                _run(*_w);
+            });
+        }
+    }
+
+    Executor_t(Executor_t const &) = delete;
+    Executor_t & operator=(Executor_t const &) = delete;
+
+    ~Executor_t()
+    {
+        stop();
+    }
+
+    /**
+     * @brief stop
+     * @return
+     *
+     * Stops all the workers and waits for them to exit. Any items
+     * that were left on the workers' deques are returned.
+     */
+    std::vector<Item> stop()
+    {
+        {
+            std::lock_guard<std::mutex> L(m_idleMutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+
+        std::vector<Item> remaining;
+        for(auto & w : m_workers)
+        {
+            if(w->thread.joinable())
+                w->thread.join();
+            std::lock_guard<std::mutex> L(w->m);
+            for(auto & i : w->items)
+                remaining.push_back(std::move(i));
+            w->items.clear();
+        }
+        return remaining;
+    }
+
+    /**
+     * @brief push_local
+     * @param item
+     * @return
+     *
+     * If called from one of this executor's worker threads, the item
+     * is placed on that worker's deque and true is returned. Otherwise
+     * returns false and the item is left untouched.
+     */
+    bool push_local(Item & item)
+    {
+        auto w = t_worker;
+        if(!w || w->owner != this)
+            return false;
+        {
+            std::lock_guard<std::mutex> L(w->m);
+            w->items.push_back(std::move(item));
+        }
+        notify();
+        return true;
+    }
+
+    /**
+     * @brief notify
+     *
+     * Wake up an idle worker. Must be called after an item has
+     * been added to the shared source.
+     */
+    void notify()
+    {
+        // pairs with the fence in _park
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(m_idle.load(std::memory_order_relaxed) == 0)
+            return;
+        {
+            std::lock_guard<std::mutex> L(m_idleMutex);
+            ++m_epoch;
+        }
+        m_cv.notify_one();
+    }
+
+    /**
+     * @brief notify_all
+     *
+     * Wake up all the idle workers. Used after many items have
+     * been added to the shared source at once.
+     */
+    void notify_all()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(m_idle.load(std::memory_order_relaxed) == 0)
+            return;
+        {
+            std::lock_guard<std::mutex> L(m_idleMutex);
+            ++m_epoch;
+        }
+        m_cv.notify_all();
+    }
+
+    size_t size() const
+    {
+        return m_workers.size();
+    }
+
+    std::vector<WorkerStats> stats() const
+    {
+        std::vector<WorkerStats> out;
+        auto now = std::chrono::steady_clock::now();
+        for(auto & w : m_workers)
+        {
+            WorkerStats s;
+            s.resumes = w->resumes.load(std::memory_order_relaxed);
+            s.steals  = w->steals.load(std::memory_order_relaxed);
+            s.busy    = std::chrono::nanoseconds(w->busy.load(std::memory_order_relaxed));
+            s.total   = std::chrono::duration_cast<std::chrono::nanoseconds>(now - w->start);
+            out.push_back(s);
+        }
+        return out;
+    }
+
+protected:
+    struct Worker
+    {
+        std::mutex          m;
+        std::deque<Item>    items;
+        std::thread         thread;
+        Executor_t         *owner = nullptr;
+        size_t              index = 0;
+
+        std::atomic<size_t>  resumes = 0;
+        std::atomic<size_t>  steals  = 0;
+        std::atomic<int64_t> busy    = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    };
+
+    static inline thread_local Worker * t_worker = nullptr;
+
+    bool _popLocal(Worker & w, Item & item)
+    {
+        std::lock_guard<std::mutex> L(w.m);
+        if(w.items.empty())
+            return false;
+        item = std::move(w.items.front());
+        w.items.pop_front();
+        return true;
+    }
+
+    bool _steal(Worker & w, Item & item)
+    {
+        auto n = m_workers.size();
+        for(size_t i=1;i<n;i++)
+        {
+            auto & victim = *m_workers[(w.index + i) % n];
+            std::lock_guard<std::mutex> L(victim.m);
+            if(!victim.items.empty())
+            {
+                item = std::move(victim.items.back());
+                victim.items.pop_back();
+                w.steals.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool _findWork(Worker & w, Item & item)
+    {
+        return _popLocal(w, item) || m_pull(item) || _steal(w, item);
+    }
+
+    // Sleep until notified. Returns true if an item was
+    // found while going to sleep
+    bool _park(Worker & w, Item & item)
+    {
+        std::unique_lock<std::mutex> L(m_idleMutex);
+        if(m_stop)
+            return false;
+        auto epoch = m_epoch;
+        m_idle.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        // check again now that notify() can see that we are idle
+        L.unlock();
+        bool found = _findWork(w, item);
+        L.lock();
+
+        if(!found)
+        {
+            m_cv.wait(L, [&]{ return m_stop || m_epoch != epoch; });
+        }
+        m_idle.fetch_sub(1);
+        return found;
+    }
+
+    void _run(Worker & w)
+    {
+        t_worker = &w;
+        Item item;
+        while(!m_stop.load(std::memory_order_relaxed))
+        {
+            if(!_findWork(w, item) && !_park(w, item))
+                continue;
+
+            auto T0 = std::chrono::steady_clock::now();
+            bool again = m_process(item);
+            auto T1 = std::chrono::steady_clock::now();
+
+            w.resumes.fetch_add(1, std::memory_order_relaxed);
+            w.busy.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(T1-T0).count(), std::memory_order_relaxed);
+
+            if(again)
+            {
+                std::lock_guard<std::mutex> L(w.m);
+                w.items.push_back(std::move(item));
+            }
+            item = {};
+        }
+        t_worker = nullptr;
+    }
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    pull_function                        m_pull;
+    process_function                     m_process;
+
+    std::mutex              m_idleMutex;
+    std::condition_variable m_cv;
+    std::atomic<size_t>     m_idle = 0;
+    uint64_t                m_epoch = 0;
+    std::atomic<bool>       m_stop = false;
+};
+
+}
+
+#endif
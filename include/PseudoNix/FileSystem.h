@@ -5,6 +5,9 @@
 #include <string>
 #include <cassert>
 #include <filesystem>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
 #include <vector>
 #include "FileSystemMount.h"
 #include "FileSystemHelpers.h"
@@ -118,6 +121,23 @@ public:
         _streamBuf(std::move(stream_buff))
     {
     }
+
+    /**
+     * @brief data
+     * @return
+     *
+     * Returns the unread contents of the file if the mount has the
+     * whole file in memory, eg: a memory mapped host file. Otherwise
+     * returns an empty span and the file must be read normally.
+     *
+     * The span is valid until the stream is destroyed.
+     */
+    std::span<const char> data() const
+    {
+        if(auto b = dynamic_cast<SpanStreamBuf const*>(_streamBuf.get()))
+            return b->remaining();
+        return {};
+    }
 private:
     std::unique_ptr<std::streambuf> _streamBuf;
 };
@@ -162,6 +182,100 @@ struct FSNodeDir : public FSNode
 };
 
 
+/**
+ * @brief The DentryCache class
+ *
+ * Caches the result of FileSystem::find_last_valid_virtual_node(),
+ * keyed by the cleaned absolute path, so that looking up a path
+ * which has been seen before, eg: /bin/ls, is a single hash lookup
+ * instead of a walk down the tree.
+ *
+ * The FileSystem removes the entries under a path whenever it adds,
+ * removes or moves a node or changes a mount on that path. Changes
+ * inside a mount do not affect the entries because the cache only
+ * goes as far as the mount point.
+ *
+ * Only paths which exist in the tree, or which lead into a mount,
+ * are cached. The cache is cleared once it holds max_size entries.
+ */
+class DentryCache
+{
+public:
+    using path_type  = std::filesystem::path;
+    using key_type   = path_type::string_type;
+    using value_type = std::pair<std::shared_ptr<FSNode>, path_type>;
+
+    static constexpr size_t max_size = 1024;
+
+    DentryCache() = default;
+
+    // a copied FileSystem starts with an empty cache
+    DentryCache(DentryCache const &)
+    {
+    }
+    DentryCache & operator=(DentryCache const &)
+    {
+        clear();
+        return *this;
+    }
+
+    bool find(key_type const & key, value_type & out) const
+    {
+        std::shared_lock L(m_mutex);
+        auto it = m_entries.find(key);
+        if(it == m_entries.end())
+            return false;
+        out = it->second;
+        return true;
+    }
+
+    void insert(key_type const & key, value_type const & value)
+    {
+        std::unique_lock L(m_mutex);
+        if(m_entries.size() >= max_size)
+            m_entries.clear();
+        m_entries.emplace(key, value);
+    }
+
+    /**
+     * @brief invalidate
+     * @param abs_path - a cleaned absolute path
+     *
+     * Remove the entry for the path and every path below it
+     */
+    void invalidate(path_type const & abs_path)
+    {
+        auto & p = abs_path.native();
+        std::unique_lock L(m_mutex);
+        if(p.size() <= 1)
+        {
+            m_entries.clear();
+            return;
+        }
+        std::erase_if(m_entries, [&](auto const & e)
+        {
+            auto & k = e.first;
+            return k.starts_with(p) && (k.size() == p.size() || k[p.size()] == '/');
+        });
+    }
+
+    void clear()
+    {
+        std::unique_lock L(m_mutex);
+        m_entries.clear();
+    }
+
+    size_t size() const
+    {
+        std::shared_lock L(m_mutex);
+        return m_entries.size();
+    }
+
+protected:
+    mutable std::shared_mutex                 m_mutex;
+    std::unordered_map<key_type, value_type>  m_entries;
+};
+
 struct FileSystem;
 struct NodeRef
 {
@@ -223,7 +337,8 @@ struct FileSystem
      */
     result_type exists(path_type abs_path)
     {
-        _clean(abs_path);
+        // find_last_valid_virtual_node() cleans the path
+        // if it is not already in the cache
         assert(abs_path.has_root_directory());
 
         auto [mnt, rem ] = find_last_valid_virtual_node(abs_path);
@@ -291,6 +406,7 @@ struct FileSystem
                     return result_type::ErrorParentDoesNotExist;
                 }
                 d->nodes[rem.generic_string()] = std::make_shared<FSNodeDir>(rem.generic_string());
+                m_dentries.invalidate(abs_path);
                 return result_type::True;
             }
         }
@@ -344,6 +460,7 @@ struct FileSystem
                 }
 
                 d->nodes[rem.generic_string()] = std::make_shared<FSNodeFile>(rem.generic_string());
+                m_dentries.invalidate(abs_path);
                 return result_type::True;
             }
         }
@@ -390,11 +507,13 @@ struct FileSystem
                         if(cp->mount)
                             return result_type::ErrorReadOnly;
                         d->nodes.erase(it);
+                        m_dentries.invalidate(abs_path);
                         return result_type::True;
                     }
                     else
                     {
                         d->nodes.erase(it);
+                        m_dentries.invalidate(abs_path);
                         return result_type::True;
                     }
                     return result_type::True;
@@ -424,6 +543,8 @@ struct FileSystem
                 return result_type::False;
 
             dir->mount = {};
+            _clean(abs_path_in_vfs);
+            m_dentries.invalidate(abs_path_in_vfs);
             return result_type::True;
         }
         return result_type::UnknownError;
@@ -465,6 +586,8 @@ struct FileSystem
                 return result_type::False;
 
             dir->mount = std::make_shared<_Tp>(std::forward<_Args>(__args)...);
+            _clean(abs_path_in_vfs);
+            m_dentries.invalidate(abs_path_in_vfs);
             return result_type::True;
         }
         return result_type::False;
@@ -485,7 +608,39 @@ struct FileSystem
     }
     std::pair<std::shared_ptr<FSNode>, path_type> find_last_valid_virtual_node(path_type abs_path)
     {
+        // most paths are already clean, so try
+        // the path as it is before cleaning it
+        DentryCache::value_type cached;
+        if(m_dentries.find(abs_path.native(), cached))
+            return cached;
         _clean(abs_path);
+        if(m_dentries.find(abs_path.native(), cached))
+            return cached;
+
+        // paths which do not exist are not cached, so that
+        // looking up many missing paths does not fill the cache
+        auto r = _resolve(abs_path);
+        auto d = std::dynamic_pointer_cast<FSNodeDir>(r.first);
+        if(r.second.empty() || (d && d->mount))
+            m_dentries.insert(abs_path.native(), r);
+        return r;
+    }
+
+    /**
+     * @brief dentry_cache
+     * @return
+     *
+     * The cache of resolved paths used by find_last_valid_virtual_node()
+     */
+    DentryCache & dentry_cache()
+    {
+        return m_dentries;
+    }
+
+protected:
+    // walk down the tree of virtual nodes
+    std::pair<std::shared_ptr<FSNode>, path_type> _resolve(path_type const & abs_path) const
+    {
         assert(abs_path.has_root_directory());
 
         auto rel_path_to_root = abs_path.relative_path();
@@ -525,6 +680,8 @@ struct FileSystem
         }
     }
 
+public:
+
     /**
      * @brief move
      * @param srcAbsPath
@@ -563,6 +720,8 @@ struct FileSystem
             auto dstDir_p  = std::dynamic_pointer_cast<FSNodeDir>(dstMnt);
 
             dstDir_p->nodes[dstAbsPath.filename().generic_string()] = srcFile_p;
+            _clean(dstAbsPath);
+            m_dentries.invalidate(dstAbsPath);
 
             remove(srcAbsPath);
 
@@ -585,6 +744,10 @@ struct FileSystem
                 assert(srcParent_p);
                 srcParent_p->nodes.erase(srcAbsPath.filename().generic_string());
             }
+            _clean(srcAbsPath);
+            _clean(dstAbsPath);
+            m_dentries.invalidate(srcAbsPath);
+            m_dentries.invalidate(dstAbsPath);
 
             return result_type::True;
         }
@@ -611,6 +774,54 @@ struct FileSystem
      * Copy a file from one location to another
      */
     result_type copy(path_type  srcAbsPath, path_type  dstAbsPath)
+    {
+        auto ret = prepare_copy(srcAbsPath, dstAbsPath);
+        if(ret != result_type::True)
+            return ret;
+
+        auto Fout = this->openWrite(dstAbsPath, false);
+        auto Fin  = this->openRead(srcAbsPath);
+
+        if(!Fout.good() )
+            return result_type::UnknownError;
+        if(!Fin.good() )
+            return result_type::UnknownError;
+
+        // the file is already in memory, copy straight from it
+        if(auto data = Fin.data(); !data.empty())
+        {
+            Fout.write(data.data(), static_cast<std::streamsize>(data.size()));
+            return result_type::True;
+        }
+
+        std::vector<char> _buff(1024 * 1024);
+
+        while(!Fin.eof())
+        {
+            Fin.read(&_buff[0], 1024*1024 - 1);
+            auto s = Fin.gcount();
+            if(s==0)
+                break;
+            Fout.write(&_buff[0], s);
+        }
+
+        return result_type::True;
+    }
+
+    /**
+     * @brief prepare_copy
+     * @param srcAbsPath
+     * @param dstAbsPath
+     * @return
+     *
+     * Does everything copy() does except copying the data: checks
+     * that the source exists, resolves dstAbsPath to a file inside
+     * it if it is a directory, and creates the destination file.
+     *
+     * Use this to copy the contents in pieces, eg: from a process
+     * which needs to yield part way through a large file.
+     */
+    result_type prepare_copy(path_type const & srcAbsPath, path_type & dstAbsPath)
     {
         if(!exists(srcAbsPath))
         {
@@ -649,26 +860,6 @@ struct FileSystem
             if(v != result_type::True)
                 return result_type::False; // cannot create dst file
         }
-
-        auto Fout = this->openWrite(dstAbsPath, false);
-        auto Fin  = this->openRead(srcAbsPath);
-
-        if(!Fout.good() )
-            return result_type::UnknownError;
-        if(!Fin.good() )
-            return result_type::UnknownError;
-
-        std::vector<char> _buff(1024 * 1024);
-
-        while(!Fin.eof())
-        {
-            Fin.read(&_buff[0], 1024*1024 - 1);
-            auto s = Fin.gcount();
-            if(s==0)
-                break;
-            Fout.write(&_buff[0], s);
-        }
-
         return result_type::True;
     }
 
@@ -788,6 +979,8 @@ struct FileSystem
     std::shared_ptr<FSNodeDir> m_rootNode = std::make_shared<FSNodeDir>("/");
 
 protected:
+    DentryCache                m_dentries;
+
     template<typename T>
     T open_t(path_type abs_path,  std::ios::openmode openmode)
     {
@@ -3,6 +3,8 @@
 
 #include <cassert>
 #include <filesystem>
+#include <span>
+#include <streambuf>
 #include "generator.h"
 
 namespace PseudoNix
@@ -33,6 +35,62 @@ enum class NodeType {
     NoExist
 };
 
+/**
+ * @brief The SpanStreamBuf class
+ *
+ * A read-only stream buffer over a block of memory which holds the
+ * whole file, eg: a memory mapped host file. The memory is owned by
+ * the derived class, which calls setSpan() once it is available.
+ *
+ * Mounts can return one of these from open(). Readers which know
+ * about it can then take the unread contents with remaining()
+ * instead of copying them out through read(). See iFileStream::data()
+ */
+class SpanStreamBuf : public std::streambuf
+{
+public:
+    std::span<const char> remaining() const
+    {
+        return {gptr(), static_cast<size_t>(egptr() - gptr())};
+    }
+
+protected:
+    void setSpan(std::span<const char> s)
+    {
+        auto b = const_cast<char*>(s.data());
+        setg(b, b, b + s.size());
+    }
+
+    int_type underflow() override
+    {
+        return gptr() < egptr() ? traits_type::to_int_type(*gptr()) : traits_type::eof();
+    }
+
+    std::streamsize showmanyc() override
+    {
+        return gptr() < egptr() ? egptr() - gptr() : -1;
+    }
+
+    pos_type seekoff(off_type off, std::ios::seekdir dir, std::ios::openmode which) override
+    {
+        if(!(which & std::ios::in))
+            return pos_type(off_type(-1));
+        off_type base = dir == std::ios::beg ? 0
+                      : dir == std::ios::cur ? gptr() - eback()
+                                             : egptr() - eback();
+        return seekpos(pos_type(base + off), which);
+    }
+
+    pos_type seekpos(pos_type pos, std::ios::openmode which) override
+    {
+        off_type p = pos;
+        if(!(which & std::ios::in) || p < 0 || p > egptr() - eback())
+            return pos_type(off_type(-1));
+        setg(eback(), eback() + p, egptr());
+        return pos;
+    }
+};
+
 struct FSMountBase
 {
     using path_type = std::filesystem::path;
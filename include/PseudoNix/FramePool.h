@@ -0,0 +1,209 @@
+#ifndef PSEUDONIX_FRAME_POOL_H
+#define PSEUDONIX_FRAME_POOL_H
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "task.h"
+
+namespace PseudoNix
+{
+
+/**
+ * @brief The FramePool class
+ *
+ * A thread safe size-class allocator used for coroutine frames and
+ * the records that are created every time a process is spawned.
+ *
+ * Requests are rounded up to a power of two between 64 bytes and
+ * 32KB. Each size class has its own free list. When a free list is
+ * empty, a slab holding several blocks is taken from the heap and
+ * carved up. Freed blocks go back on their free list and are reused,
+ * so spawning and reaping processes does not touch the global heap
+ * once the pool has grown to the peak number of processes.
+ *
+ * Larger requests go straight to the heap. Slabs are only released
+ * when the pool is destroyed.
+ */
+class FramePool : public FrameAllocator
+{
+public:
+    static constexpr size_t min_block_size = 64;
+    static constexpr size_t class_count    = 10; // 64B to 32KB
+    static constexpr size_t max_block_size = min_block_size << (class_count-1);
+    static constexpr size_t slab_size      = 64*1024;
+
+    struct Stats
+    {
+        size_t allocations   = 0; // total number of allocations
+        size_t deallocations = 0; // total number of deallocations
+        size_t heap_allocations = 0; // allocations which went to the global heap
+        size_t slabs         = 0; // number of slabs allocated
+        size_t slab_bytes    = 0; // total size of all the slabs
+
+        size_t in_use() const
+        {
+            return allocations - deallocations;
+        }
+    };
+
+    FramePool() = default;
+    FramePool(FramePool const &) = delete;
+    FramePool & operator=(FramePool const &) = delete;
+
+    ~FramePool()
+    {
+        for(auto s : m_slabs)
+            ::operator delete(s);
+    }
+
+    void* allocate(size_t n) override
+    {
+        m_allocations.fetch_add(1, std::memory_order_relaxed);
+        if(n > max_block_size)
+        {
+            m_heapAllocations.fetch_add(1, std::memory_order_relaxed);
+            return ::operator new(n);
+        }
+
+        auto & C = m_classes[_class(n)];
+        std::lock_guard L(C.m);
+        if(!C.free)
+            _grow(C, _class(n));
+        auto b = C.free;
+        C.free = b->next;
+        return b;
+    }
+
+    void deallocate(void * p, size_t n) override
+    {
+        m_deallocations.fetch_add(1, std::memory_order_relaxed);
+        if(n > max_block_size)
+        {
+            ::operator delete(p);
+            return;
+        }
+
+        auto & C = m_classes[_class(n)];
+        auto b = static_cast<Block*>(p);
+        std::lock_guard L(C.m);
+        b->next = C.free;
+        C.free = b;
+    }
+
+    Stats stats() const
+    {
+        Stats s;
+        s.allocations      = m_allocations.load(std::memory_order_relaxed);
+        s.deallocations    = m_deallocations.load(std::memory_order_relaxed);
+        s.heap_allocations = m_heapAllocations.load(std::memory_order_relaxed);
+        std::lock_guard L(m_slabMutex);
+        s.slabs      = m_slabs.size();
+        s.slab_bytes = m_slabBytes;
+        return s;
+    }
+
+protected:
+    struct Block
+    {
+        Block * next;
+    };
+
+    struct alignas(64) SizeClass
+    {
+        std::mutex m;
+        Block     *free = nullptr;
+    };
+
+    static size_t _class(size_t n)
+    {
+        return n <= min_block_size ? 0u : static_cast<size_t>(std::bit_width((n-1) / min_block_size));
+    }
+
+    // called with the size class locked
+    void _grow(SizeClass & C, size_t cls)
+    {
+        auto blockSize = min_block_size << cls;
+        auto bytes     = std::max(slab_size, blockSize * 4);
+        auto slab      = static_cast<std::byte*>(::operator new(bytes));
+        {
+            std::lock_guard L(m_slabMutex);
+            m_slabs.push_back(slab);
+            m_slabBytes += bytes;
+        }
+        m_heapAllocations.fetch_add(1, std::memory_order_relaxed);
+
+        for(size_t i = bytes / blockSize; i-- > 0; )
+        {
+            auto b = reinterpret_cast<Block*>(slab + i*blockSize);
+            b->next = C.free;
+            C.free = b;
+        }
+    }
+
+    std::array<SizeClass, class_count> m_classes;
+
+    mutable std::mutex  m_slabMutex;
+    std::vector<void*>  m_slabs;
+    size_t              m_slabBytes = 0;
+
+    std::atomic<size_t> m_allocations     = 0;
+    std::atomic<size_t> m_deallocations   = 0;
+    std::atomic<size_t> m_heapAllocations = 0;
+};
+
+/**
+ * @brief The PoolAllocator class
+ *
+ * A standard allocator which takes its memory from a FramePool. It
+ * holds a reference to the pool, so objects created with
+ * std::allocate_shared keep the pool alive until they are destroyed.
+ */
+template<typename T>
+class PoolAllocator
+{
+public:
+    using value_type = T;
+
+    explicit PoolAllocator(std::shared_ptr<FramePool> pool) : m_pool(std::move(pool))
+    {
+    }
+
+    template<typename U>
+    PoolAllocator(PoolAllocator<U> const & other) : m_pool(other.pool())
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+        return static_cast<T*>(m_pool->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T * p, size_t n)
+    {
+        m_pool->deallocate(p, n * sizeof(T));
+    }
+
+    std::shared_ptr<FramePool> const & pool() const
+    {
+        return m_pool;
+    }
+
+    template<typename U>
+    bool operator==(PoolAllocator<U> const & other) const
+    {
+        return m_pool == other.pool();
+    }
+
+protected:
+    std::shared_ptr<FramePool> m_pool;
+};
+
+}
+
+#endif
@@ -9,9 +9,89 @@
 #include "FileSystemMount.h"
 #include "System.h"
 
+#if (defined __unix__ || defined __APPLE__) && !defined __EMSCRIPTEN__
+#define PSEUDONIX_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace PseudoNix
 {
 
+/**
+ * @brief The MappedFileStreamBuf class
+ *
+ * Reads a host file by mapping it into memory. Reading from the
+ * stream is a copy out of the page cache, and readers which use
+ * iFileStream::data() can read the file without copying it at all.
+ *
+ * open() returns false if the file is not a regular file or cannot
+ * be mapped, eg: pipes, devices, empty files or platforms without
+ * mmap. Use DelegatingFileStreamBuf for those.
+ *
+ * If the file is truncated by another program while it is mapped,
+ * reading past the new end of the file will raise SIGBUS.
+ */
+class MappedFileStreamBuf : public SpanStreamBuf {
+public:
+    MappedFileStreamBuf() = default;
+    MappedFileStreamBuf(MappedFileStreamBuf const &) = delete;
+    MappedFileStreamBuf & operator=(MappedFileStreamBuf const &) = delete;
+
+    ~MappedFileStreamBuf() {
+        close();
+    }
+
+    bool open(const std::filesystem::path& path) {
+        close();
+#if defined PSEUDONIX_HAS_MMAP
+        auto pstr = path.generic_string();
+        int fd = ::open(pstr.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        // check the file that was opened, not the path,
+        // it may have been replaced in between
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+            ::close(fd);
+            return false;
+        }
+
+        auto size = static_cast<size_t>(st.st_size);
+        void* p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // the mapping keeps its own reference to the file
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+
+        ::madvise(p, size, MADV_SEQUENTIAL);
+        m_data = p;
+        m_size = size;
+        setSpan({static_cast<char const*>(p), size});
+        return true;
+#else
+        (void)path;
+        return false;
+#endif
+    }
+
+    void close() {
+#if defined PSEUDONIX_HAS_MMAP
+        if (m_data) {
+            ::munmap(m_data, m_size);
+        }
+#endif
+        m_data = nullptr;
+        m_size = 0;
+        setg(nullptr, nullptr, nullptr);
+    }
+
+private:
+    void*       m_data = nullptr;
+    std::size_t m_size = 0;
+};
+
 class DelegatingFileStreamBuf : public std::streambuf {
     static constexpr std::size_t buffer_size = 4096;
 
@@ -121,6 +201,10 @@ protected:
  */
 struct FSNodeHostMount : public FSMountBase
 {
+    // files at least this large are memory mapped when
+    // they are opened for reading
+    static constexpr std::uintmax_t mmap_threshold = 64 * 1024;
+
     std::filesystem::path m_path_on_host;
     FSNodeHostMount(std::filesystem::path path_on_host) : m_path_on_host(path_on_host)
     {
@@ -171,7 +255,21 @@ struct FSNodeHostMount : public FSMountBase
 
     virtual std::unique_ptr<std::streambuf> open(path_type relPath, std::ios::openmode mode) override
     {
-        (void)mode;
+        // Large files which are only being read are memory mapped.
+        // Small files are cheaper to read with a buffer than
+        // to map and unmap.
+        if( !(mode & (std::ios::out | std::ios::app)) )
+        {
+            std::error_code ec;
+            auto size = std::filesystem::file_size(m_path_on_host / relPath, ec);
+            if(!ec && size >= mmap_threshold)
+            {
+                auto m = std::make_unique<MappedFileStreamBuf>();
+                if(m->open(m_path_on_host / relPath))
+                    return m;
+            }
+        }
+
         auto p = std::make_unique<DelegatingFileStreamBuf>();
         p->open(m_path_on_host / relPath, mode);
         return p;
@@ -115,6 +115,7 @@ inline System::task_type launcher_coro(System::e_type ctrl)
 
     while(true)
     {
+        bool idle = true;
         char ch=0;
         while(true)
         {
@@ -127,6 +128,7 @@ inline System::task_type launcher_coro(System::e_type ctrl)
             else if(result == 1)
             {
                 E.in->put(ch);
+                idle = false;
             }
             else if(result == 0)
             {
@@ -137,10 +139,11 @@ inline System::task_type launcher_coro(System::e_type ctrl)
 
         // If there are any bytes in the output stream of
         // sh, read them and write them to std::cout
-        char c;
-        while(c_out->get(&c) == ReaderWriterStream::Result::SUCCESS)
+        std::array<char, 1024> buffer;
+        while(auto n = c_out->read(buffer))
         {
-            std::cout.put(c);
+            std::cout.write(buffer.data(), static_cast<std::streamsize>(n));
+            idle = false;
         }
         std::cout << std::flush;
 
@@ -151,7 +154,17 @@ inline System::task_type launcher_coro(System::e_type ctrl)
             break;
         }
 
-        HANDLE_AWAIT_TERM(co_await ctrl->await_yield(), ctrl)
+        // stdin cannot notify us, so it has to be polled. If
+        // nothing happened, poll it on a timer so that the
+        // host loop is able to sleep
+        if(idle)
+        {
+            HANDLE_AWAIT_TERM(co_await ctrl->await_yield_for(std::chrono::milliseconds(5)), ctrl)
+        }
+        else
+        {
+            HANDLE_AWAIT_TERM(co_await ctrl->await_yield(), ctrl)
+        }
     }
 
     co_return 0;
@@ -0,0 +1,298 @@
+#ifndef PSEUDONIX_PROC_MOUNT_H
+#define PSEUDONIX_PROC_MOUNT_H
+
+#include <array>
+#include <charconv>
+#include <format>
+#include <sstream>
+#include <string>
+#include "FileSystemMount.h"
+#include "System.h"
+
+namespace PseudoNix
+{
+
+/**
+ * @brief The ProcMount class
+ *
+ * A read-only mount which shows the state of the System's processes,
+ * similar to /proc on linux:
+ *
+ *   /proc/stat              - process count and scheduler totals
+ *   /proc/queues            - the task queues and their sizes
+ *   /proc/<pid>/cmdline     - the process's arguments, one per line
+ *   /proc/<pid>/environ     - the process's environment, VAR=VALUE per line
+ *   /proc/<pid>/status      - state and scheduler statistics
+ *   /proc/<pid>/exit_code   - the exit code, -1 while it is running
+ *
+ * Nothing is stored in the mount. The contents of a file are generated
+ * from the System when the file is opened, so the mount costs nothing
+ * unless it is read.
+ *
+ * The System must outlive the mount. Use mount_proc() to mount it.
+ */
+struct ProcMount : public FSMountBase
+{
+    static constexpr std::array<char const*, 2> system_files  = {"stat", "queues"};
+    static constexpr std::array<char const*, 4> process_files = {"cmdline", "environ", "status", "exit_code"};
+
+    explicit ProcMount(System & sys) : m_system(&sys)
+    {
+    }
+
+    bool is_read_only() const override
+    {
+        return true;
+    }
+
+    std::string get_info() override
+    {
+        return "proc";
+    }
+
+    result_type exists(path_type relPath) const override
+    {
+        return getType(relPath) != NodeType::NoExist ? result_type::True : result_type::False;
+    }
+
+    result_type mkdir(path_type relPath) override
+    {
+        (void)relPath;
+        return result_type::ErrorReadOnly;
+    }
+
+    result_type mkfile(path_type relPath) override
+    {
+        (void)relPath;
+        return result_type::ErrorReadOnly;
+    }
+
+    result_type remove(path_type relPath) override
+    {
+        (void)relPath;
+        return result_type::ErrorReadOnly;
+    }
+
+    NodeType getType(path_type relPath) const override
+    {
+        auto [pid, file] = _parse(relPath);
+        if(pid == invalid_pid)
+        {
+            if(file.empty())
+                return NodeType::MountDir;
+            return _contains(system_files, file) ? NodeType::MountFile : NodeType::NoExist;
+        }
+
+        if(!m_system->processExists(pid))
+            return NodeType::NoExist;
+        if(file.empty())
+            return NodeType::MountDir;
+        return _contains(process_files, file) ? NodeType::MountFile : NodeType::NoExist;
+    }
+
+    Generator<path_type> list_dir(path_type relPath) override
+    {
+        auto [pid, file] = _parse(relPath);
+        if(!file.empty())
+            co_return;
+
+        if(pid == invalid_pid)
+        {
+            for(auto f : system_files)
+                co_yield f;
+            for(auto p : m_system->processIDs())
+                co_yield std::to_string(p);
+        }
+        else if(m_system->processExists(pid))
+        {
+            for(auto f : process_files)
+                co_yield f;
+        }
+    }
+
+    std::unique_ptr<std::streambuf> open(path_type relPath, std::ios::openmode mode) override
+    {
+        if(mode & (std::ios::out | std::ios::app))
+            return nullptr;
+
+        if(getType(relPath) != NodeType::MountFile)
+            return nullptr;
+
+        auto [pid, file] = _parse(relPath);
+        std::string content;
+        try
+        {
+            content = pid == invalid_pid ? _systemFile(file) : _processFile(pid, file);
+        }
+        catch(std::exception &)
+        {
+            // the process was removed after getType() was called
+            return nullptr;
+        }
+        return std::make_unique<std::stringbuf>(std::move(content), std::ios::in);
+    }
+
+protected:
+    template<size_t N>
+    static bool _contains(std::array<char const*, N> const & names, std::string const & name)
+    {
+        for(auto n : names)
+            if(name == n)
+                return true;
+        return false;
+    }
+
+    // Split the path into a pid and a file name. The pid is
+    // invalid_pid for files in the root of the mount.
+    static std::pair<System::pid_type, std::string> _parse(path_type const & relPath)
+    {
+        std::vector<std::string> parts;
+        for(auto & p : relPath)
+        {
+            auto s = p.generic_string();
+            if(!s.empty() && s != ".")
+                parts.push_back(std::move(s));
+        }
+
+        if(parts.empty())
+            return {invalid_pid, {}};
+
+        System::pid_type pid = invalid_pid;
+        auto & first = parts[0];
+        auto [ptr, ec] = std::from_chars(first.data(), first.data() + first.size(), pid);
+        bool is_pid = ec == std::errc() && ptr == first.data() + first.size();
+
+        if(!is_pid)
+        {
+            // files in the root: there are no sub directories
+            // other than the pids
+            return {invalid_pid, parts.size() == 1 ? first : std::string("/")};
+        }
+        if(parts.size() == 1)
+            return {pid, {}};
+        if(parts.size() == 2)
+            return {pid, parts[1]};
+        return {pid, "/"};
+    }
+
+    std::string _systemFile(std::string const & file) const
+    {
+        if(file == "stat")
+        {
+            auto S = m_system->stats();
+            auto A = m_system->allocatorStats();
+            return std::format("processes {}\n"
+                               "resumes {}\n"
+                               "cpu_time_ns {}\n"
+                               "frame_allocations {}\n"
+                               "frame_bytes {}\n",
+                               S.processes.size(),
+                               S.resumes,
+                               S.cpu_time.count(),
+                               A.in_use(),
+                               A.slab_bytes);
+        }
+        if(file == "queues")
+        {
+            std::string out;
+            for(auto & name : m_system->taskQueueNames())
+            {
+                out += std::format("{} {} {}\n",
+                                   name,
+                                   m_system->taskQueueSize(name),
+                                   m_system->taskQueueExecutorStats(name).size());
+            }
+            return out;
+        }
+        return {};
+    }
+
+    std::string _processFile(System::pid_type pid, std::string const & file) const
+    {
+        auto P = m_system->PROC_AT(pid);
+
+        if(file == "cmdline")
+        {
+            std::string out;
+            for(auto & a : P->control->args)
+                out += a + '\n';
+            return out;
+        }
+        if(file == "environ")
+        {
+            // the process may be changing its environment on another
+            // thread, so read the copy it last published
+            std::string out;
+            if(auto E = P->getEnviron())
+            {
+                for(auto & [var, value] : *E)
+                    out += std::format("{}={}\n", var, value);
+            }
+            return out;
+        }
+        if(file == "exit_code")
+        {
+            return std::format("{}\n", *P->exit_code);
+        }
+        if(file == "status")
+        {
+            auto S = m_system->processStats(pid);
+            std::string state = S.waiting_on == AwaiterKind::NONE ? "running"
+                              : S.parked                           ? "parked"
+                                                                   : "queued";
+            std::string children;
+            for(auto c : P->children())
+                children += std::format("{}{}", children.empty() ? "" : " ", c);
+
+            return std::format("Name: {}\n"
+                               "Pid: {}\n"
+                               "PPid: {}\n"
+                               "Queue: {}\n"
+                               "Nice: {}\n"
+                               "Level: {}\n"
+                               "State: {}\n"
+                               "WaitingOn: {}\n"
+                               "Children: {}\n"
+                               "Resumes: {}\n"
+                               "CpuTimeNs: {}\n"
+                               "MaxResumeNs: {}\n"
+                               "WaitTimeNs: {}\n",
+                               S.args.empty() ? std::string() : S.args[0],
+                               S.pid,
+                               S.parent == invalid_pid ? -1 : static_cast<int64_t>(S.parent),
+                               S.queue,
+                               S.nice,
+                               S.level,
+                               state,
+                               to_string(S.waiting_on),
+                               children,
+                               S.resumes,
+                               S.cpu_time.count(),
+                               S.max_resume.count(),
+                               S.wait_time.count());
+        }
+        return {};
+    }
+
+    System * m_system = nullptr;
+};
+
+/**
+ * @brief mount_proc
+ * @param sys
+ * @param path
+ * @return
+ *
+ * Create the directory and mount a ProcMount on it
+ */
+inline FSResult mount_proc(System & sys, System::path_type path = "/proc")
+{
+    auto r = sys.mkdir(path);
+    if(r != FSResult::True && r != FSResult::ErrorExists)
+        return r;
+    return sys.mount<ProcMount>(path, sys);
+}
+
+}
+
+#endif
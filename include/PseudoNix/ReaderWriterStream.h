@@ -2,117 +2,100 @@
 #define PSEUDONIX_READER_WRITER_STREAM_H
 
 #include <readerwriterqueue/readerwriterqueue.h>
+#include <atomic>
 #include <mutex>
+#include "Stream.h"
 
 namespace PseudoNix
 {
 
+/**
+ * @brief The ReaderWriterStream_t class
+ *
+ * A single-producer/single-consumer stream. Data is placed into the
+ * queue in chunks, so writing a whole string only costs a single
+ * enqueue. The consumer keeps track of how far it has read into the
+ * chunk at the front of the queue.
+ *
+ * Single items written with put() are not queued one chunk at a time.
+ * They are appended to a pending buffer which the consumer takes as a
+ * whole once it has read everything in the queue. Waiters are only
+ * notified by the put() which starts a new pending buffer.
+ */
 template<typename T>
-struct ReaderWriterStream_t
+struct ReaderWriterStream_t : public Stream_t<T>
 {
 protected:
-    moodycamel::ReaderWriterQueue<T> data;
-    std::mutex _m;
-public:
-    std::lock_guard<std::mutex> lock()
-    {
-        return std::lock_guard(_m);
-    }
-    bool has_data() const
-    {
-        return data.peek() != nullptr;
-    }
+    using chunk_type = std::basic_string<T>;
 
-    size_t size_approx() const
-    {
-        return data.size_approx();
-    }
+    moodycamel::ReaderWriterQueue<chunk_type> data;
 
-    bool eof() const
-    {
-        return !has_data() && _eof;
-    }
+    // consumer side: offset into the chunk at the front of the queue
+    size_t _readPos = 0;
+
+    // consumer side: the pending buffer taken from the producer
+    // and the offset into it. Read before the queue.
+    chunk_type _taken;
+    size_t     _takenPos = 0;
+
+    // producer side: the chunk handed out by reserve()
+    chunk_type _writeChunk;
+
+    // items written by put() which have not been taken by the
+    // consumer or queued in front of a committed chunk yet
+    std::mutex          _pendingMutex;
+    chunk_type          _pending;
+    std::atomic<size_t> _pendingSize = 0;
 
-    void flush()
+    // number of T's in the queue and in _taken which have not been read yet
+    std::atomic<size_t> _size = 0;
+
+public:
+    bool has_data() const override
     {
-        while(has_data())
-            get();
+        return _takenPos < _taken.size() ||
+               data.peek() != nullptr ||
+               _pendingSize.load(std::memory_order_acquire) != 0;
     }
 
-    enum class Result
+    size_t size_approx() const override
     {
-        SUCCESS,
-        EMPTY,
-        END_OF_STREAM
-    };
+        return _size.load(std::memory_order_relaxed) + _pendingSize.load(std::memory_order_relaxed);
+    }
 
-    Result check() const
+    std::span<const T> peek() override
     {
-        if(auto front = data.peek())
-        {
-            return Result::SUCCESS;
-        }
-        else
+        if(_takenPos < _taken.size())
         {
-            if(_eof)
-            {
-                return Result::END_OF_STREAM;
-            }
+            return std::span<const T>(_taken.data() + _takenPos, _taken.size() - _takenPos);
         }
-        return Result::EMPTY;
-    }
-    Result get(char *c)
-    {
         if(auto front = data.peek())
         {
-            *c = *front;
-            data.pop();
-            return Result::SUCCESS;
+            return std::span<const T>(front->data() + _readPos, front->size() - _readPos);
         }
-        else
-        {
-            if(_eof)
-            {
-                _eof = false;
-                return Result::END_OF_STREAM;
-            }
-        }
-        return Result::EMPTY;
-    }
+        if(_pendingSize.load(std::memory_order_acquire) == 0)
+            return {};
 
-    Result read_line(std::string & line)
-    {
-        char c = 0;
-        auto r = get(&c);
-        line.clear();
-        while(true)
+        std::lock_guard<std::mutex> L(_pendingMutex);
+
+        // the producer may have queued the pending
+        // buffer in front of a chunk it committed
+        if(auto front = data.peek())
         {
-            switch(r)
-            {
-                case Result::SUCCESS:
-                    line.push_back(c);
-                    if(line.back()=='\n')
-                    {
-                        line.pop_back();
-                        return Result::SUCCESS;
-                    }
-                    break;
-                case Result::END_OF_STREAM: return r;
-                case Result::EMPTY: return Result::SUCCESS;
-            }
-            r = get(&c);
+            return std::span<const T>(front->data() + _readPos, front->size() - _readPos);
         }
+        _taken.clear();
+        _taken.swap(_pending);
+        _takenPos = 0;
+        _size.fetch_add(_taken.size(), std::memory_order_relaxed);
+        _pendingSize.store(0, std::memory_order_relaxed);
+        return _taken;
     }
 
-    void put(T c)
-    {
-        data.enqueue(c);
-    }
-
-    bool _eof = false;
-    void set_eof()
+    std::span<T> reserve(size_t n) override
     {
-        _eof = true;
+        _writeChunk.resize(n);
+        return _writeChunk;
     }
 
     ReaderWriterStream_t(){}
@@ -121,70 +104,67 @@ public:
     requires std::ranges::range<iter_container>
     ReaderWriterStream_t(iter_container const & d)
     {
-        for(auto i : d)
-        {
-            data.enqueue(i);
-        }
+        *this << d;
     }
 
-    ReaderWriterStream_t& operator << (ReaderWriterStream_t &ss)
-    {
-        char c = 0;
-        while(ss.get(&c) == Result::SUCCESS)
-        {
-            put(c);
-        }
-        return *this;
-    }
-
-    ReaderWriterStream_t& operator << (char const *s)
+protected:
+    void _release(size_t n) override
     {
-        while(*s)
+        if(n == 0)
+            return;
+        if(_takenPos < _taken.size())
         {
-            put(*s);
-            ++s;
+            _takenPos += n;
+            _size.fetch_sub(n, std::memory_order_relaxed);
+            if(_takenPos >= _taken.size())
+            {
+                _taken.clear();
+                _takenPos = 0;
+            }
+            return;
         }
-        return *this;
-    }
-
-    template<typename iter_container>
-    requires std::ranges::range<iter_container>
-    ReaderWriterStream_t& operator << (iter_container const &ss)
-    {
-        for(auto i : ss)
+        auto front = data.peek();
+        if(!front)
+            return;
+        _readPos += n;
+        _size.fetch_sub(n, std::memory_order_relaxed);
+        if(_readPos >= front->size())
         {
-            put(i);
+            data.pop();
+            _readPos = 0;
         }
-        return *this;
     }
 
-    template<typename iter_container>
-        requires std::ranges::range<iter_container>
-    ReaderWriterStream_t& operator >> (iter_container &ss)
+    void _commit(size_t n) override
     {
-        char c = 0;
-        while(get(&c) == Result::SUCCESS)
+        if(n == 0)
+            return;
+        // anything written by put() has to be read first
+        if(_pendingSize.load(std::memory_order_relaxed) != 0)
         {
-            ss.push_back(c);
+            std::lock_guard<std::mutex> L(_pendingMutex);
+            if(!_pending.empty())
+            {
+                _size.fetch_add(_pending.size(), std::memory_order_relaxed);
+                data.enqueue(std::move(_pending));
+                _pending = {};
+                _pendingSize.store(0, std::memory_order_relaxed);
+            }
         }
-        return *this;
+        _writeChunk.resize(n);
+        _size.fetch_add(n, std::memory_order_relaxed);
+        data.enqueue(std::move(_writeChunk));
+        _writeChunk = {};
     }
 
-    ReaderWriterStream_t& operator << (T const& d)
+    bool _put(T c) override
     {
-        data.enqueue(d);
-        return *this;
-    }
-
-    std::string str()
-    {
-        std::string s;
-        char c=0;
-        while(get(&c) == Result::SUCCESS)
-        {
-            s.push_back(c);
-        }
-        return s;
+        std::lock_guard<std::mutex> L(_pendingMutex);
+        _pending.push_back(c);
+        _pendingSize.store(_pending.size(), std::memory_order_release);
+        // the consumer was woken by the put() that started the
+        // pending buffer and it takes the whole buffer when it reads
+        return _pending.size() == 1;
     }
 };
 
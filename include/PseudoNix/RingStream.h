@@ -0,0 +1,173 @@
+#ifndef PSEUDONIX_RING_STREAM_H
+#define PSEUDONIX_RING_STREAM_H
+
+#include <array>
+#include <atomic>
+#include "Stream.h"
+
+namespace PseudoNix
+{
+
+/**
+ * @brief The RingStream_t class
+ *
+ * A lock-free single-producer/single-consumer stream made from a ring of
+ * fixed sized segments. The producer fills the segment at the tail of
+ * the ring and the consumer drains the segment at the head.
+ *
+ * When the producer fills a segment it moves on to the next one in the
+ * ring. Segments which have been fully drained by the consumer are
+ * reused, a new segment is only allocated when the producer would
+ * otherwise run into the segment the consumer is reading from.
+ *
+ * Both peek() and reserve() hand out spans which point directly into
+ * the segments, so data can be scanned and written without copying it
+ * into an intermediate buffer.
+ */
+template<typename T, size_t SegmentSize = 4096>
+struct RingStream_t : public Stream_t<T>
+{
+protected:
+    struct Segment
+    {
+        std::array<T, SegmentSize> data;
+        std::atomic<size_t>        readIndex  = 0; // written by the consumer
+        std::atomic<size_t>        writeIndex = 0; // written by the producer
+        Segment                   *next = nullptr;
+    };
+
+    std::atomic<Segment*> _head; // segment being read by the consumer
+    std::atomic<Segment*> _tail; // segment being written by the producer
+    std::atomic<size_t>   _size = 0;
+
+    // Called by the consumer. Moves the head to the next segment if
+    // the current one has been drained and the producer has moved on.
+    Segment* _readable_segment()
+    {
+        auto h = _head.load(std::memory_order_relaxed);
+        while(true)
+        {
+            auto r = h->readIndex.load(std::memory_order_relaxed);
+            if(r < h->writeIndex.load(std::memory_order_acquire))
+                return h;
+
+            if(h == _tail.load(std::memory_order_acquire))
+                return nullptr;
+
+            // The producer has left this segment, so the write index
+            // is final. It may have written more before leaving.
+            if(r < h->writeIndex.load(std::memory_order_acquire))
+                return h;
+
+            h = h->next;
+            _head.store(h, std::memory_order_release);
+        }
+    }
+
+public:
+    RingStream_t()
+    {
+        auto s = new Segment();
+        s->next = s;
+        _head.store(s);
+        _tail.store(s);
+    }
+
+    ~RingStream_t()
+    {
+        auto first = _head.load();
+        auto s = first->next;
+        while(s != first)
+        {
+            auto n = s->next;
+            delete s;
+            s = n;
+        }
+        delete first;
+    }
+
+    RingStream_t(RingStream_t const &) = delete;
+    RingStream_t& operator=(RingStream_t const &) = delete;
+
+    template<typename iter_container>
+    requires std::ranges::range<iter_container>
+    RingStream_t(iter_container const & d) : RingStream_t()
+    {
+        *this << d;
+    }
+
+    bool has_data() const override
+    {
+        return _size.load(std::memory_order_acquire) != 0;
+    }
+
+    size_t size_approx() const override
+    {
+        return _size.load(std::memory_order_relaxed);
+    }
+
+    std::span<const T> peek() override
+    {
+        if(auto h = _readable_segment())
+        {
+            auto r = h->readIndex.load(std::memory_order_relaxed);
+            auto w = h->writeIndex.load(std::memory_order_acquire);
+            return std::span<const T>(h->data.data() + r, w - r);
+        }
+        return {};
+    }
+
+    std::span<T> reserve(size_t n) override
+    {
+        auto t = _tail.load(std::memory_order_relaxed);
+        auto w = t->writeIndex.load(std::memory_order_relaxed);
+        if(w == SegmentSize)
+        {
+            auto next = t->next;
+            if(next == _head.load(std::memory_order_acquire))
+            {
+                // The consumer is still reading the next segment
+                // in the ring, so grow the ring
+                auto s = new Segment();
+                s->next = next;
+                t->next = s;
+                next = s;
+            }
+            else
+            {
+                // The consumer has finished with this segment
+                next->readIndex.store(0, std::memory_order_relaxed);
+                next->writeIndex.store(0, std::memory_order_relaxed);
+            }
+            _tail.store(next, std::memory_order_release);
+            t = next;
+            w = 0;
+        }
+        return std::span<T>(t->data.data() + w, std::min(n, SegmentSize - w));
+    }
+
+protected:
+    void _release(size_t n) override
+    {
+        if(n == 0)
+            return;
+        auto h = _head.load(std::memory_order_relaxed);
+        h->readIndex.store(h->readIndex.load(std::memory_order_relaxed) + n, std::memory_order_release);
+        _size.fetch_sub(n, std::memory_order_release);
+    }
+
+    void _commit(size_t n) override
+    {
+        if(n == 0)
+            return;
+        auto t = _tail.load(std::memory_order_relaxed);
+        t->writeIndex.store(t->writeIndex.load(std::memory_order_relaxed) + n, std::memory_order_release);
+        _size.fetch_add(n, std::memory_order_release);
+    }
+};
+
+using RingStream = RingStream_t<char>;
+
+}
+
+#endif
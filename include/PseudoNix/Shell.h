@@ -342,12 +342,11 @@ inline std::vector< std::vector<std::string> > parse_operands(std::vector<std::s
  * @param env
  * @return
  *
- * Given a string that contains ${VARNAME} or $VARNAME, and the env map, substitue
+ * Given a string that contains ${VARNAME} or $VARNAME, and the process, substitue
  * the appropriate variables and return a new string.
  */
-inline std::string var_sub1(std::string_view str, std::map<std::string,std::string> const & env)
+inline std::string var_sub1(std::string_view str, System::ProcessControl const & proc)
 {
-    (void)env;
     std::string outstr;
 
     for(size_t i=0;i<str.size();i++)
@@ -365,9 +364,7 @@ inline std::string var_sub1(std::string_view str, std::map<std::string,std::stri
                 }
                 var_name += str[i];
             }
-            auto it = env.find((var_name.size() && var_name.front() == '{') ? var_name.substr(1) : var_name);
-            if(it != env.end())
-                outstr += it->second;
+            outstr += proc.getenv((var_name.size() && var_name.front() == '{') ? std::string_view(var_name).substr(1) : std::string_view(var_name));
         }
         else
         {
@@ -387,14 +384,14 @@ Generator<WhatToDo3> process_command(std::vector<std::string> args,
     {
         for(auto & v : args)
         {
-            v = var_sub1(v, proc->env);
+            v = var_sub1(v, *proc);
         }
 
         {
             // Check the PATH variable for
             // scripts that may exist there
             //
-            auto & PATH = proc->env["PATH"];
+            auto PATH = proc->getenv("PATH");
             auto & SYSTEM = *proc->system;
             auto parts = PATH
                          | std::views::split(':')
@@ -898,7 +895,7 @@ System::task_type shell_coro(System::e_type ctrl)
     // and is exported otherwize
     // some of the shell commands wont work
     ENV["SHELL_PID"] = std::to_string(PID);
-    EXPORTED["SHELL_PID"] = true;
+    ENV.set_exported("SHELL_PID");
 
     // the initial exit code
     ENV["?"] = "0";
@@ -906,8 +903,10 @@ System::task_type shell_coro(System::e_type ctrl)
     // Flag for when to exit the shell
     // this is used by the "exit" process
     // we might not need to use this
-    auto & EXIT_SHELL = ENV["EXIT_SHELL"];
-    EXIT_SHELL = {};
+    // This is checked by value after every command rather
+    // than through a reference, since adding other variables
+    // may move it
+    ENV["EXIT_SHELL"] = {};
 
     std::string profile_script;
     bool load_etc_profile = true;
@@ -994,7 +993,7 @@ System::task_type shell_coro(System::e_type ctrl)
                     if(exit_code_p)
                     {
                         HANDLE_AWAIT_TERM( co_await ctrl->await_finished(pids_to_wait_on), ctrl);
-                        ctrl->out->_eof = false;
+                        ctrl->out->_eof.store(false, std::memory_order_relaxed);
                         ctrl->env["?"] = std::to_string(*exit_code_p);
                     }
                     else
@@ -1005,7 +1004,7 @@ System::task_type shell_coro(System::e_type ctrl)
             }
             script.clear();
         }
-        if(!EXIT_SHELL.empty())
+        if(!ENV.at("EXIT_SHELL").empty())
         {
             break;
         }
@@ -0,0 +1,410 @@
+#ifndef PSEUDONIX_STREAM_H
+#define PSEUDONIX_STREAM_H
+
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <span>
+#include <string>
+#include <cstring>
+#include <ranges>
+#include <algorithm>
+#include <memory>
+#include "WaitList.h"
+
+namespace PseudoNix
+{
+
+/**
+ * @brief The StreamBackend enum
+ *
+ * Selects which stream implementation is created by
+ * System::make_stream()
+ */
+enum class StreamBackend
+{
+    CHUNKED, // ReaderWriterStream_t, a queue of variable sized chunks
+    RING     // RingStream_t, a ring of fixed sized segments
+};
+
+/**
+ * @brief The Stream_t class
+ *
+ * Base class for all single-producer/single-consumer streams that are
+ * used to pass data between processes.
+ *
+ * Implementations only need to provide the zero-copy primitives:
+ *
+ *   consumer: peek() / _release()
+ *   producer: reserve() / _commit()
+ *
+ * All the other read/write functions are built on top of those.
+ *
+ * Processes which are waiting on the stream are placed on its
+ * wait_list() and are woken up when data is committed, released
+ * or the stream is closed.
+ */
+template<typename T>
+struct Stream_t
+{
+    enum class Result
+    {
+        SUCCESS,
+        EMPTY,
+        END_OF_STREAM
+    };
+
+    virtual ~Stream_t()
+    {
+    }
+
+    virtual bool   has_data() const = 0;
+    virtual size_t size_approx() const = 0;
+
+    /**
+     * @brief peek
+     * @return
+     *
+     * Returns a view of the next contiguous block of readable data.
+     * An empty span is returned if there is no data available. The
+     * data is not removed from the stream until release() is called.
+     */
+    virtual std::span<const T> peek() = 0;
+
+    /**
+     * @brief release
+     * @param n
+     *
+     * Removes n items from the front of the stream. n must not
+     * be larger than the span returned by the last call to peek()
+     */
+    void release(size_t n)
+    {
+        _release(n);
+        // only writers of bounded streams wait for space
+        if(capacity() != 0)
+            _waitList->notify_all();
+    }
+
+    /**
+     * @brief reserve
+     * @param n
+     * @return
+     *
+     * Returns a writable span of at least 1 and at most n items.
+     * Nothing is visible to the consumer until commit() is called.
+     */
+    virtual std::span<T> reserve(size_t n) = 0;
+
+    /**
+     * @brief commit
+     * @param n
+     *
+     * Publishes the first n items of the span returned by the last
+     * call to reserve()
+     */
+    void commit(size_t n)
+    {
+        _commit(n);
+        _waitList->notify_all();
+    }
+
+    /**
+     * @brief wait_list
+     * @return
+     *
+     * Returns the list of waiters that are woken up
+     * whenever the stream changes.
+     */
+    std::shared_ptr<WaitList> const & wait_list() const
+    {
+        return _waitList;
+    }
+
+    std::lock_guard<std::mutex> lock()
+    {
+        return std::lock_guard(_m);
+    }
+
+    /**
+     * @brief set_capacity
+     * @param n
+     *
+     * Sets the number of items the stream should hold before the
+     * producer waits for the consumer to catch up. A capacity of 0
+     * means the stream is unbounded.
+     *
+     * The capacity is not enforced by write(), producers should check
+     * writable() or suspend with ProcessControl::await_writable()
+     */
+    void set_capacity(size_t n)
+    {
+        _capacity.store(n, std::memory_order_relaxed);
+    }
+
+    size_t capacity() const
+    {
+        return _capacity.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief writable
+     * @return
+     *
+     * Returns the number of items that can be written before the
+     * stream reaches its capacity.
+     */
+    size_t writable() const
+    {
+        auto c = capacity();
+        if(c == 0)
+            return std::numeric_limits<size_t>::max();
+        auto s = size_approx();
+        return s >= c ? 0 : c - s;
+    }
+
+    bool eof() const
+    {
+        auto e = _eof.load(std::memory_order_acquire);
+        return !has_data() && e;
+    }
+
+    void flush()
+    {
+        for(auto s = peek(); !s.empty(); s = peek())
+        {
+            release(s.size());
+        }
+    }
+
+    Result check() const
+    {
+        // eof is read first so that everything committed
+        // before set_eof() is visible to has_data()
+        auto e = _eof.load(std::memory_order_acquire);
+        if(has_data())
+        {
+            return Result::SUCCESS;
+        }
+        if(e)
+        {
+            return Result::END_OF_STREAM;
+        }
+        return Result::EMPTY;
+    }
+
+    Result get(T *c)
+    {
+        auto e = _eof.load(std::memory_order_acquire);
+        if(auto s = peek(); !s.empty())
+        {
+            *c = s.front();
+            release(1);
+            return Result::SUCCESS;
+        }
+        if(e)
+        {
+            _eof.store(false, std::memory_order_relaxed);
+            return Result::END_OF_STREAM;
+        }
+        return Result::EMPTY;
+    }
+
+    /**
+     * @brief read
+     * @param dst
+     * @return
+     *
+     * Read as many items as are currently available, up to
+     * dst.size(). Returns the number of items copied. This does
+     * not report the end of the stream, use check() or eof() for that.
+     */
+    size_t read(std::span<T> dst)
+    {
+        size_t total = 0;
+        while(total < dst.size())
+        {
+            auto s = peek();
+            if(s.empty())
+                break;
+            auto count = std::min(s.size(), dst.size() - total);
+            std::memcpy(dst.data() + total, s.data(), count * sizeof(T));
+            total += count;
+            release(count);
+        }
+        return total;
+    }
+
+    /**
+     * @brief append_line
+     * @param line
+     * @return
+     *
+     * Appends to line until a newline character is found. The newline
+     * is consumed but not added to the line.
+     *
+     * Returns SUCCESS if a full line was found, EMPTY if the stream ran
+     * out of data before a newline was found or END_OF_STREAM if the
+     * stream was closed.
+     */
+    Result append_line(std::basic_string<T> & line)
+    {
+        auto e = _eof.load(std::memory_order_acquire);
+        for(auto s = peek(); !s.empty(); s = peek())
+        {
+            if(auto nl = std::char_traits<T>::find(s.data(), s.size(), T('\n')))
+            {
+                auto len = static_cast<size_t>(nl - s.data());
+                line.append(s.data(), len);
+                release(len + 1);
+                return Result::SUCCESS;
+            }
+            line.append(s.data(), s.size());
+            release(s.size());
+        }
+        if(e)
+        {
+            _eof.store(false, std::memory_order_relaxed);
+            return Result::END_OF_STREAM;
+        }
+        return Result::EMPTY;
+    }
+
+    Result read_line(std::basic_string<T> & line)
+    {
+        line.clear();
+        auto r = append_line(line);
+        return r == Result::EMPTY ? Result::SUCCESS : r;
+    }
+
+    /**
+     * @brief put
+     * @param c
+     *
+     * Write a single item into the stream. Streams can override
+     * _put() to give char-by-char writers a cheaper path than
+     * reserve()/commit().
+     */
+    void put(T c)
+    {
+        if(_put(c))
+            _waitList->notify_all();
+    }
+
+    /**
+     * @brief write
+     * @param src
+     *
+     * Write a block of data into the stream.
+     */
+    void write(std::span<const T> src)
+    {
+        while(!src.empty())
+        {
+            auto s = reserve(src.size());
+            std::memcpy(s.data(), src.data(), s.size() * sizeof(T));
+            commit(s.size());
+            src = src.subspan(s.size());
+        }
+    }
+
+    // Written by the producer, read by the consumer. Stored with
+    // release so that a consumer which sees it also sees every
+    // item committed before it.
+    std::atomic<bool> _eof = false;
+    void set_eof()
+    {
+        _eof.store(true, std::memory_order_release);
+        _waitList->notify_all();
+    }
+
+    Stream_t& operator << (Stream_t &ss)
+    {
+        auto e = ss._eof.load(std::memory_order_acquire);
+        for(auto s = ss.peek(); !s.empty(); s = ss.peek())
+        {
+            write(s);
+            ss.release(s.size());
+        }
+        if(e)
+            ss._eof.store(false, std::memory_order_relaxed);
+        return *this;
+    }
+
+    Stream_t& operator << (T const *s)
+    {
+        write(std::span<const T>(s, std::char_traits<T>::length(s)));
+        return *this;
+    }
+
+    template<typename iter_container>
+    requires std::ranges::range<iter_container>
+    Stream_t& operator << (iter_container const &ss)
+    {
+        if constexpr (std::ranges::contiguous_range<iter_container> &&
+                      std::is_same_v<std::ranges::range_value_t<iter_container>, T>)
+        {
+            write(std::span<const T>(std::ranges::data(ss), std::ranges::size(ss)));
+        }
+        else
+        {
+            std::basic_string<T> chunk;
+            for(auto i : ss)
+            {
+                chunk.push_back(static_cast<T>(i));
+            }
+            write(chunk);
+        }
+        return *this;
+    }
+
+    template<typename iter_container>
+        requires std::ranges::range<iter_container>
+    Stream_t& operator >> (iter_container &ss)
+    {
+        auto e = _eof.load(std::memory_order_acquire);
+        for(auto s = peek(); !s.empty(); s = peek())
+        {
+            ss.insert(ss.end(), s.begin(), s.end());
+            release(s.size());
+        }
+        if(e)
+            _eof.store(false, std::memory_order_relaxed);
+        return *this;
+    }
+
+    Stream_t& operator << (T const& d)
+    {
+        put(d);
+        return *this;
+    }
+
+    std::basic_string<T> str()
+    {
+        std::basic_string<T> s;
+        s.reserve(size_approx());
+        *this >> s;
+        return s;
+    }
+
+protected:
+    virtual void _release(size_t n) = 0;
+    virtual void _commit(size_t n) = 0;
+
+    // Writes a single item. Returns true if the
+    // waiters need to be notified.
+    virtual bool _put(T c)
+    {
+        reserve(1)[0] = c;
+        _commit(1);
+        return true;
+    }
+
+    std::mutex _m;
+    std::atomic<size_t> _capacity = 0;
+    std::shared_ptr<WaitList> _waitList = std::make_shared<WaitList>();
+};
+
+}
+
+#endif
@@ -6,14 +6,24 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <optional>
 #include <functional>
 #include "ReaderWriterStream.h"
+#include "RingStream.h"
+#include "Executor.h"
+#include "ConcurrentMap.h"
+#include "FramePool.h"
+#include "Environment.h"
+#include "Trace.h"
 #include <concurrentqueue.h>
 #include "task.h"
 #include "defer.h"
 #include <span>
+#include <array>
 #include <thread>
 #include <semaphore>
+#include <chrono>
+#include <cmath>
 #include "FileSystem.h"
 #include "helpers.h"
 
@@ -95,24 +105,76 @@ enum class AwaiterResult
     UNKNOWN_ERROR
 };
 
+/**
+ * @brief The AwaiterKind enum
+ *
+ * Describes what a suspended process is waiting for.
+ * This is only used for reporting, eg: ps and top.
+ */
+enum class AwaiterKind : uint8_t
+{
+    NONE,      // not suspended, the process is running
+    START,     // waiting to be run for the first time
+    YIELD,
+    SLEEP,
+    SIGNAL,
+    FINISHED,  // waiting for other processes to complete
+    READ_LINE,
+    HAS_DATA,
+    WRITABLE,
+    CUSTOM     // an awaiter created by the user
+};
+
+inline char const * to_string(AwaiterKind k)
+{
+    switch(k)
+    {
+        case AwaiterKind::NONE:      return "running";
+        case AwaiterKind::START:     return "start";
+        case AwaiterKind::YIELD:     return "yield";
+        case AwaiterKind::SLEEP:     return "sleep";
+        case AwaiterKind::SIGNAL:    return "signal";
+        case AwaiterKind::FINISHED:  return "finished";
+        case AwaiterKind::READ_LINE: return "read_line";
+        case AwaiterKind::HAS_DATA:  return "has_data";
+        case AwaiterKind::WRITABLE:  return "writable";
+        case AwaiterKind::CUSTOM:    return "custom";
+    }
+    return "unknown";
+}
+
 
 struct System : public PseudoNix::FileSystem
 {
-    using stream_type      = ReaderWriterStream_t<char>;
+    using stream_type      = Stream_t<char>;
     using pid_type         = uint32_t;
     using exit_code_type   = int32_t;
     using task_type        = Task_t<exit_code_type, std::suspend_always, std::suspend_always>;
 
     constexpr static const char * const DEFAULT_QUEUE = "MAIN";
 
-    auto& PROC_AT(auto && key)
+    // Task queues are referred to by a small integer handle, see
+    // taskQueueCreate(). The DEFAULT_QUEUE is always the first queue
+    using queue_id_type = uint32_t;
+    constexpr static const queue_id_type DEFAULT_QUEUE_ID = 0;
+    constexpr static const queue_id_type invalid_queue_id = 0xFFFFFFFF;
+
+    // maximum number of task queues that can be created
+    constexpr static const size_t max_task_queues = 64;
+
+    // number of priority levels in each task queue, 0 is the highest
+    constexpr static const size_t priority_levels = 3;
+
+    struct Process;
+
+    std::shared_ptr<Process> PROC_AT(pid_type key) const
     {
-        auto it = m_procs2.find(key);
-        if(it == m_procs2.end())
+        auto P = m_procs2.find(key);
+        if(!P)
         {
             throw std::runtime_error(std::format("Cannot find PID: {}", key));
         }
-        return it->second;
+        return P;
     }
 
     struct Exec
@@ -122,6 +184,9 @@ struct System : public PseudoNix::FileSystem
         std::shared_ptr<stream_type>       in;
         std::shared_ptr<stream_type>       out;
         std::string                        queue = DEFAULT_QUEUE;
+        StreamBackend                      backend = StreamBackend::CHUNKED; // used to create in/out if they are not set
+        size_t                             capacity = 0;                     // capacity of the created streams, 0 is unbounded
+        std::optional<int>                 nice;                             // the nice value, inherited from the parent if not set
 
         Exec(std::vector<std::string> const &_args = {}, std::map<std::string, std::string> const & _env = {}) : args(_args), env(_env)
         {
@@ -131,15 +196,30 @@ struct System : public PseudoNix::FileSystem
     /**
      * @brief The Awaiter class
      *
-     * A global awaiter class. Specific behaviours are defined by the
-     * function object, f, that is passed into the object.
+     * The base class of all the awaiters. This is what the task queues
+     * hold while a process is suspended.
+     *
+     * Whether the awaiter is ready to resume is decided by a plain
+     * function pointer. The awaiters returned by ProcessControl, eg:
+     * await_yield(), are typed awaiters (see TypedAwaiter_T) which set
+     * the function pointer themselves, so suspending and resuming them
+     * does not allocate or go through a std::function.
      *
-     * f is called whenever await_ready is called to check whether
-     * the awaiter should continue to suspend. If f returns true
-     * then the coroutine will not-suspend.
+     * Custom awaiters can still be created by passing a function object,
+     * f, to the constructor. f is called whenever await_ready is called
+     * to check whether the awaiter should continue to suspend. If f
+     * returns true then the coroutine will not-suspend.
+     *
+     * If the awaiter has been given any wait lists (see wait_on), the
+     * process is parked off the task queue while f returns false and
+     * is only placed back on the queue when one of the wait lists is
+     * notified or the process is signaled. Awaiters without wait lists
+     * are polled every time the task queue is executed.
      */
     class Awaiter {
     public:
+        using ready_function = bool(*)(Awaiter*);
+
         /**
          * @brief Awaiter
          * @param p the pid of the coroutine process. Must be valid
@@ -153,9 +233,40 @@ struct System : public PseudoNix::FileSystem
                          System* S,
                          std::function<bool(Awaiter*)> f,
                          std::string queuName = "")
-            : m_pid(p), m_system(S), m_pred(f), m_queueName(queuName)
+            : m_pid(p), m_system(S), m_ready_fn(&Awaiter::_callPred), m_pred(std::move(f))
+        {
+            auto P    = m_system->PROC_AT(p);
+            m_process = P.get();
+            m_signal  = &P->lastSignal;
+            m_queue   = m_system->taskQueueId(queuName);
+        }
+
+        /**
+         * @brief Awaiter
+         * @param waitList - the process is parked on this list while f returns false
+         */
+        explicit Awaiter(pid_type p,
+                         System* S,
+                         std::function<bool(Awaiter*)> f,
+                         std::string queuName,
+                         std::shared_ptr<WaitList> waitList)
+            : Awaiter(p, S, std::move(f), std::move(queuName))
+        {
+            wait_on(std::move(waitList));
+        }
+
+        /**
+         * @brief Awaiter
+         * @param P - the process which is awaiting
+         * @param f - returns true when the process can be resumed
+         * @param queue - the queue that the coroutine should resume on
+         *
+         * Used by the typed awaiters. The process is passed in
+         * directly so that it does not need to be looked up.
+         */
+        Awaiter(Process & P, System* S, ready_function f, queue_id_type queue, AwaiterKind kind)
+            : m_kind(kind), m_pid(P.control->pid), m_process(&P), m_system(S), m_ready_fn(f), m_signal(&P.lastSignal), m_queue(queue)
         {
-            m_signal = &m_system->PROC_AT(p)->lastSignal;
         }
 
         Awaiter(){};
@@ -168,6 +279,95 @@ struct System : public PseudoNix::FileSystem
         // called to check if
         bool _firstRun = true;
         bool await_ready()  noexcept {
+            if(_signaled())
+                return true;
+            return m_ready_fn(this);
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) noexcept {
+            handle_ = handle;
+
+            // this is where we need to place
+            // the handle for executing on another
+            // scheduler
+            m_system->handleAwaiter(this);
+        }
+
+        void setResult(AwaiterResult r)
+        {
+            m_result = r;
+        }
+
+        [[ nodiscard ]] AwaiterResult await_resume() const noexcept {
+            return m_result;
+        }
+
+        void resume()
+        {
+            if(handle_)
+            {
+                handle_.resume();
+                //handle_ = {};
+            }
+        }
+
+        auto get_pid() const
+        {
+            return m_pid;
+        }
+
+        /**
+         * @brief wait_on
+         * @param w
+         *
+         * Add a wait list which will wake the process up
+         * when it is notified.
+         */
+        void wait_on(std::shared_ptr<WaitList> w)
+        {
+            if(!w)
+                return;
+            if(!m_waitList)
+                m_waitList = std::move(w);
+            else
+                m_moreWaitLists.push_back(std::move(w));
+        }
+
+        bool can_park() const
+        {
+            return m_parkable || m_waitList;
+        }
+
+        /**
+         * @brief set_kind
+         * @param k
+         *
+         * Set what the awaiter is waiting for. This is shown
+         * in the process statistics while the process is suspended.
+         */
+        void set_kind(AwaiterKind k)
+        {
+            m_kind = k;
+        }
+
+        AwaiterKind kind() const
+        {
+            return m_kind;
+        }
+
+    protected:
+        friend struct System;
+
+        // Returns true if the awaiter should resume
+        // because of a signal, or was already found
+        // to be ready while it was being parked
+        bool _signaled() noexcept
+        {
+            // the predicate has already returned true
+            // while the process was being parked
+            if(m_ready)
+                return true;
+
             // Indicate that the awaiter is ready to be
             // resumed if we have internally set the
             // result to be a non-success
@@ -186,7 +386,7 @@ struct System : public PseudoNix::FileSystem
             //
             if(m_signal && !_firstRun)
             {
-                switch(*m_signal)
+                switch(m_signal->load())
                 {
                 case sig_interrupt: m_result = AwaiterResult::SIGNAL_INTERRUPT; m_signal = {}; return true; break;
                 case sig_terminate: m_result = AwaiterResult::SIGNAL_TERMINATE; m_signal = {}; return true; break;
@@ -195,51 +395,281 @@ struct System : public PseudoNix::FileSystem
                 }
             }
             _firstRun = false;
-            auto b = m_pred(this);
-            return b;
+            return false;
         }
 
-        void await_suspend(std::coroutine_handle<> handle) noexcept {
-            handle_ = handle;
+        static bool _callPred(Awaiter * a)
+        {
+            return a->m_pred(a);
+        }
 
-            // this is where we need to place
-            // the handle for executing on another
-            // scheduler
-            m_system->handleAwaiter(this);
+        // call f on each of the wait lists
+        template<typename F>
+        void _forEachWaitList(F && f) const
+        {
+            if(m_waitList)
+                f(m_waitList);
+            for(auto & w : m_moreWaitLists)
+                f(w);
         }
 
-        void setResult(AwaiterResult r)
+        bool m_ready = false;
+        bool m_parkable = false; // can be parked even without a wait list, eg: await_signal
+        AwaiterKind m_kind = AwaiterKind::CUSTOM;
+        std::shared_ptr<WaitList> m_waitList;                   // most awaiters only wait on one list
+        std::vector<std::shared_ptr<WaitList>> m_moreWaitLists; // the rest, eg: await_finished(pids)
+        pid_type m_pid;
+        Process * m_process = nullptr; // not owned, the process owns the coroutine frame this lives in
+        System * m_system;
+        ready_function m_ready_fn = nullptr;
+        std::function<bool(Awaiter*)> m_pred;                   // only used by custom awaiters
+        std::atomic<int32_t> * m_signal = nullptr;
+        AwaiterResult m_result = {};
+    public:
+        std::coroutine_handle<> handle_;
+        queue_id_type m_queue = DEFAULT_QUEUE_ID; // invalid_queue_id resumes on the DEFAULT_QUEUE
+    };
+
+    /**
+     * @brief The TypedAwaiter_T class
+     *
+     * Base class for awaiters which know their type at compile time.
+     * Derived must provide:
+     *
+     *     bool ready();
+     *
+     * which returns true when the process can be resumed. co_await calls
+     * Derived::ready() directly, and the task queues call it through a
+     * function pointer, so neither needs a std::function.
+     */
+    template<typename Derived>
+    class TypedAwaiter_T : public Awaiter
+    {
+    public:
+        TypedAwaiter_T(Process & P, System * S, queue_id_type queue, AwaiterKind kind)
+            : Awaiter(P, S, &TypedAwaiter_T::_ready, queue, kind)
         {
-            m_result = r;
         }
 
-        [[ nodiscard ]] AwaiterResult await_resume() const noexcept {
-            return m_result;
+        bool await_ready() noexcept
+        {
+            if(_signaled())
+                return true;
+            return static_cast<Derived*>(this)->ready();
         }
 
-        void resume()
+    protected:
+        static bool _ready(Awaiter * a)
         {
-            if(handle_)
+            return static_cast<Derived*>(a)->ready();
+        }
+    };
+
+    // returns false the first time so that
+    // the process is placed at the back of
+    // the queue, then true
+    class YieldAwaiter : public TypedAwaiter_T<YieldAwaiter>
+    {
+    public:
+        YieldAwaiter(Process & P, System * S, queue_id_type queue)
+            : TypedAwaiter_T(P, S, queue, AwaiterKind::YIELD)
+        {
+        }
+
+        bool ready()
+        {
+            return std::exchange(m_yielded, true);
+        }
+
+    protected:
+        bool m_yielded = false;
+    };
+
+    class SleepAwaiter : public TypedAwaiter_T<SleepAwaiter>
+    {
+    public:
+        SleepAwaiter(Process & P, System * S, queue_id_type queue, std::chrono::steady_clock::time_point T)
+            : TypedAwaiter_T(P, S, queue, AwaiterKind::SLEEP), m_time(T)
+        {
+            // each process reuses the same wait list for its
+            // timers. If the process is woken up early, eg: by
+            // a signal, and sleeps again, the old timer may wake
+            // it early, but it will simply be parked again
+            if(!P.sleepList)
+                P.sleepList = std::make_shared<WaitList>();
+            S->_addTimer(T, P.sleepList);
+            wait_on(P.sleepList);
+        }
+
+        bool ready()
+        {
+            return std::chrono::steady_clock::now() >= m_time;
+        }
+
+    protected:
+        std::chrono::steady_clock::time_point m_time;
+    };
+
+    // only resumes when the process is signaled
+    class SignalAwaiter : public TypedAwaiter_T<SignalAwaiter>
+    {
+    public:
+        SignalAwaiter(Process & P, System * S, queue_id_type queue)
+            : TypedAwaiter_T(P, S, queue, AwaiterKind::SIGNAL)
+        {
+            m_parkable = true;
+        }
+
+        bool ready()
+        {
+            return false;
+        }
+    };
+
+    class FinishedAwaiter : public TypedAwaiter_T<FinishedAwaiter>
+    {
+    public:
+        FinishedAwaiter(Process & P, System * S, queue_id_type queue, pid_type pid)
+            : TypedAwaiter_T(P, S, queue, AwaiterKind::FINISHED), m_waitFor(pid)
+        {
+            wait_on(S->_exitWaitList(pid));
+        }
+
+        bool ready()
+        {
+            return !m_system->isRunning(m_waitFor);
+        }
+
+    protected:
+        pid_type m_waitFor;
+    };
+
+    class FinishedAllAwaiter : public TypedAwaiter_T<FinishedAllAwaiter>
+    {
+    public:
+        FinishedAllAwaiter(Process & P, System * S, queue_id_type queue, std::vector<pid_type> pids)
+            : TypedAwaiter_T(P, S, queue, AwaiterKind::FINISHED), m_waitFor(std::move(pids))
+        {
+            for(auto p : m_waitFor)
+                wait_on(S->_exitWaitList(p));
+        }
+
+        bool ready()
+        {
+            for(auto p : m_waitFor)
             {
-                handle_.resume();
-                //handle_ = {};
+                if(m_system->isRunning(p))
+                    return false;
             }
+            return true;
         }
 
-        auto get_pid() const
+    protected:
+        std::vector<pid_type> m_waitFor;
+    };
+
+    class ReadLineAwaiter : public TypedAwaiter_T<ReadLineAwaiter>
+    {
+    public:
+        ReadLineAwaiter(Process & P, System * S, queue_id_type queue, std::shared_ptr<stream_type> & d, std::string & line)
+            : TypedAwaiter_T(P, S, queue, AwaiterKind::READ_LINE), m_stream(&d), m_line(&line)
         {
-            return m_pid;
+            wait_on(d->wait_list());
+        }
+
+        bool ready()
+        {
+            auto & d = *m_stream;
+            if(d.use_count() == 1 && !d->has_data())
+            {
+                // no one is writing to this stream
+                // so by default it should be closed
+                setResult(AwaiterResult::END_OF_STREAM);
+                return true;
+            }
+            // scan the available chunks for a newline
+            // rather than reading one character at a time
+            switch(d->append_line(*m_line))
+            {
+            case  stream_type::Result::EMPTY:
+                return false;
+            case  stream_type::Result::END_OF_STREAM:
+                setResult(AwaiterResult::END_OF_STREAM);
+                return true;
+            case  stream_type::Result::SUCCESS:
+                return true;
+            }
+            return false;
         }
 
     protected:
-        pid_type m_pid;
-        System * m_system;
-        std::function<bool(Awaiter*)> m_pred;
-        int32_t * m_signal = nullptr;
-        AwaiterResult m_result = {};
+        std::shared_ptr<stream_type> * m_stream;
+        std::string                  * m_line;
+    };
+
+    class HasDataAwaiter : public TypedAwaiter_T<HasDataAwaiter>
+    {
     public:
-        std::coroutine_handle<> handle_;
-        std::string m_queueName;
+        HasDataAwaiter(Process & P, System * S, queue_id_type queue, std::shared_ptr<stream_type> & d)
+            : TypedAwaiter_T(P, S, queue, AwaiterKind::HAS_DATA), m_stream(&d)
+        {
+            wait_on(d->wait_list());
+        }
+
+        bool ready()
+        {
+            auto & d = *m_stream;
+            if(d.use_count() == 1 && !d->has_data() )
+            {
+                setResult(AwaiterResult::END_OF_STREAM);
+                return true;
+            }
+            switch(d->check())
+            {
+                case  stream_type::Result::EMPTY:
+                    return false;
+                case  stream_type::Result::END_OF_STREAM:
+                    setResult(AwaiterResult::END_OF_STREAM);
+                    return true;
+                case  stream_type::Result::SUCCESS:
+                    return true;
+            }
+            return true;
+        }
+
+    protected:
+        std::shared_ptr<stream_type> * m_stream;
+    };
+
+    class WritableAwaiter : public TypedAwaiter_T<WritableAwaiter>
+    {
+    public:
+        WritableAwaiter(Process & P, System * S, queue_id_type queue, std::shared_ptr<stream_type> & d, size_t n)
+            : TypedAwaiter_T(P, S, queue, AwaiterKind::WRITABLE), m_stream(&d), m_count(n)
+        {
+            wait_on(d->wait_list());
+        }
+
+        bool ready()
+        {
+            auto & d = *m_stream;
+            auto c = d->capacity();
+            auto required = c == 0 ? m_count : std::min(m_count, c);
+            if(d->writable() >= required)
+            {
+                return true;
+            }
+            if(d.use_count() == 1)
+            {
+                setResult(AwaiterResult::END_OF_STREAM);
+                return true;
+            }
+            return false;
+        }
+
+    protected:
+        std::shared_ptr<stream_type> * m_stream;
+        size_t                         m_count;
     };
 
 
@@ -250,14 +680,17 @@ struct System : public PseudoNix::FileSystem
         std::vector<std::string>           args;
         std::shared_ptr<stream_type>       in;
         std::shared_ptr<stream_type>       out;
-        std::map<std::string, std::string> env;        // environment variables
-        std::map<std::string, bool>        exported;   // list of variables that are exported
+        Environment                        env;        // environment variables
         std::string                        queue_name = DEFAULT_QUEUE; // which queue to run on
+        queue_id_type                      queue_id = DEFAULT_QUEUE_ID; // the same queue, set by the System
+        std::thread::id                    thread_id;  // the thread the process was last resumed on
         System * system = nullptr;
         path_type cwd = "/";
 
     protected:
         pid_type    pid = invalid_pid;
+        Process *   process = nullptr;  // set when the process is registered
+        int64_t     yield_deadline = 0; // see should_yield()
     public:
 
         bool chdir(path_type new_dir)
@@ -266,20 +699,41 @@ struct System : public PseudoNix::FileSystem
             if(!new_dir.has_root_directory())
             {
                 cwd = cwd / new_dir;
-                env["OLDPWD"] = env["PWD"];
-                env["PWD"] = cwd.generic_string();
             }
             else
             {
                 cwd = new_dir;
-                env["OLDPWD"] = env["PWD"];
-                env["PWD"] = cwd.generic_string();
             }
+            // copy first, adding OLDPWD may invalidate
+            // a reference to PWD
+            auto old_pwd = env["PWD"];
+            env["OLDPWD"] = std::move(old_pwd);
+            env["PWD"] = cwd.generic_string();
             return true;
         }
+
+        /**
+         * @brief getenv
+         * @param var
+         * @return
+         *
+         * Returns the value of an environment variable. QUEUE and
+         * THREAD_ID are generated from the process's current queue
+         * and thread rather than being stored in the environment.
+         */
+        std::string getenv(std::string_view var) const
+        {
+            if(var == "QUEUE")
+                return queue_name;
+            if(var == "THREAD_ID")
+                return std::format("{}", thread_id);
+            if(auto v = env.get(var))
+                return *v;
+            return {};
+        }
         void setSignalHandler(std::function<void(int)> f)
         {
-            system->PROC_AT(pid)->signal = f;
+            system->PROC_AT(pid)->setSignalHandler(std::move(f));
         }
 
         pid_type get_pid() const
@@ -287,6 +741,21 @@ struct System : public PseudoNix::FileSystem
             return pid;
         }
 
+        /**
+         * @brief should_yield
+         * @return
+         *
+         * Returns true once the process has used up its time slice
+         * for the current resume, or the task queue has run out of
+         * time. Processes which do a lot of work between awaits
+         * should check this and call await_yield() so that
+         * taskQueueExecute() can keep to its time budget.
+         */
+        bool should_yield() const
+        {
+            return System::_now() >= yield_deadline;
+        }
+
         /**
          * @brief await_yield
          * @return
@@ -294,22 +763,13 @@ struct System : public PseudoNix::FileSystem
          * Yield the current process until the
          * next iteration of the scheduler
          */
-        System::Awaiter await_yield(std::string_view queue=DEFAULT_QUEUE)
-        {
-            return System::Awaiter{pid,
-                                   system,
-                                   [x=false](Awaiter*) mutable {
-                                       if(!x)
-                                       {
-                                           x = true;
-                                           // retun false the first time
-                                           // so that it will immediately suspend
-                                           return false;
-                                       }
-                                       // subsequent times, return true
-                                       // so that we know it
-                                       return true;
-                                   }, std::string(queue)};
+        YieldAwaiter await_yield(queue_id_type queue=DEFAULT_QUEUE_ID)
+        {
+            return YieldAwaiter(*process, system, queue);
+        }
+        YieldAwaiter await_yield(std::string_view queue)
+        {
+            return YieldAwaiter(*process, system, system->taskQueueId(queue));
         }
 
         /**
@@ -317,16 +777,29 @@ struct System : public PseudoNix::FileSystem
          * @param time
          * @return
          *
-         * Sleep for an amount of time.
+         * Sleep for an amount of time. The process is parked on
+         * the system's timer list and placed back on the queue
+         * once the time has expired.
          */
-        System::Awaiter await_yield_for(std::chrono::nanoseconds time, std::string_view queue=DEFAULT_QUEUE)
+        SleepAwaiter await_yield_for(std::chrono::nanoseconds time, queue_id_type queue=DEFAULT_QUEUE_ID)
         {
-            auto T1 = std::chrono::system_clock::now() + time;
-            return System::Awaiter{get_pid(),
-                                   system,
-                                   [T=T1](Awaiter*){
-                                       return std::chrono::system_clock::now() > T;
-                                   }, std::string(queue)};
+            return SleepAwaiter(*process, system, queue, std::chrono::steady_clock::now() + time);
+        }
+        SleepAwaiter await_yield_for(std::chrono::nanoseconds time, std::string_view queue)
+        {
+            return await_yield_for(time, system->taskQueueId(queue));
+        }
+
+        /**
+         * @brief await_signal
+         * @return
+         *
+         * Suspend the process until it receives a signal. The
+         * process is parked and is not polled while it waits.
+         */
+        SignalAwaiter await_signal()
+        {
+            return SignalAwaiter(*process, system, queue_id);
         }
 
         /**
@@ -336,14 +809,9 @@ struct System : public PseudoNix::FileSystem
          *
          * Yield until a specific PID has completed
          */
-        System::Awaiter await_finished(pid_type _pid)
+        FinishedAwaiter await_finished(pid_type _pid)
         {
-            return System::Awaiter{get_pid(),
-                                   system,
-                                   [_pid,sys=system](Awaiter*)
-                                   {
-                                       return !sys->isRunning(_pid);
-                                   }, std::string(queue_name)};
+            return FinishedAwaiter(*process, system, queue_id, _pid);
         }
 
         /**
@@ -353,19 +821,9 @@ struct System : public PseudoNix::FileSystem
          *
          * Yield until all PIDs have completed
          */
-        System::Awaiter await_finished(std::vector<pid_type> pids)
+        FinishedAllAwaiter await_finished(std::vector<pid_type> pids)
         {
-            return System::Awaiter{get_pid(),
-                                   system,
-                                   [pids,sys=system](Awaiter*)
-                                   {
-                                       for(auto p : pids)
-                                       {
-                                           if( sys->isRunning(p) )
-                                               return false;
-                                       }
-                                       return true;
-                                   }, std::string(queue_name)};
+            return FinishedAllAwaiter(*process, system, queue_id, std::move(pids));
         }
 
         /**
@@ -384,38 +842,9 @@ struct System : public PseudoNix::FileSystem
          *   - the shared pointer only has 1 use_count.
          *      Returns AwaiterResult::END_OF_STREAM
          */
-        System::Awaiter await_read_line(std::shared_ptr<System::stream_type> & d, std::string & line)
+        ReadLineAwaiter await_read_line(std::shared_ptr<System::stream_type> & d, std::string & line)
         {
-            return System::Awaiter{get_pid(),
-                                   system,
-                                   [&d, l = &line](Awaiter* a)
-                                   {
-                                       char c;
-                                       if(d.use_count() == 1 && !d->has_data())
-                                       {
-                                           // no one is writing to this stream
-                                           // so by default it should be closed
-                                           a->setResult(AwaiterResult::END_OF_STREAM);
-                                           return true;
-                                       }
-                                       while(true)
-                                       {
-                                           auto r = d->get(&c);
-                                           switch(r)
-                                           {
-                                           case  System::stream_type::Result::EMPTY:
-                                               return false;
-                                           case  System::stream_type::Result::END_OF_STREAM:
-                                               a->setResult(AwaiterResult::END_OF_STREAM);
-                                               return true;
-                                           case  System::stream_type::Result::SUCCESS:
-                                               l->push_back(c);
-                                               if(l->back() == '\n') { l->pop_back(); return true;};
-                                               break;
-                                           }
-                                       }
-                                       return false;
-                                   }, std::string(queue_name)};
+            return ReadLineAwaiter(*process, system, queue_id, d, line);
         }
 
         /**
@@ -425,29 +854,29 @@ struct System : public PseudoNix::FileSystem
          *
          * Yield until the input stream has data
          */
-        System::Awaiter await_has_data(std::shared_ptr<System::stream_type> & d)
-        {
-            return System::Awaiter{get_pid(),
-                                   system,
-                                   [&d](Awaiter* a){
-                                       if(d.use_count() == 1 && !d->has_data() )
-                                       {
-                                           a->setResult(AwaiterResult::END_OF_STREAM);
-                                           return true;
-                                       }
-                                       auto c = d->check();
-                                       switch(c)
-                                       {
-                                           case  System::stream_type::Result::EMPTY:
-                                               return false;
-                                           case  System::stream_type::Result::END_OF_STREAM:
-                                               a->setResult(AwaiterResult::END_OF_STREAM);
-                                               return true;
-                                           case  System::stream_type::Result::SUCCESS:
-                                               return true;
-                                       }
-                                       return true;
-                                   }, std::string(queue_name)};
+        HasDataAwaiter await_has_data(std::shared_ptr<System::stream_type> & d)
+        {
+            return HasDataAwaiter(*process, system, queue_id, d);
+        }
+
+        /**
+         * @brief await_writable
+         * @param d
+         * @param n
+         * @return
+         *
+         * Yield until n items can be written to the stream without
+         * going over its capacity. If n is larger than the capacity,
+         * this waits until the stream is empty. Unbounded streams
+         * never suspend.
+         *
+         * Returns AwaiterResult::END_OF_STREAM if the stream is full
+         * and no one else holds a reference to it (ie: no one
+         * is reading from it)
+         */
+        WritableAwaiter await_writable(std::shared_ptr<System::stream_type> & d, size_t n = 1)
+        {
+            return WritableAwaiter(*process, system, queue_id, d, n);
         }
 
         pid_type executeSubProcess(System::Exec E)
@@ -462,6 +891,7 @@ struct System : public PseudoNix::FileSystem
 
     using e_type = std::shared_ptr<ProcessControl>;
     using function_type    = std::function< task_type(e_type)>;
+    using function_map_type = CopyOnWriteMap_t<std::string, function_type>;
 
     void removeFunction(std::string name)
     {
@@ -481,9 +911,56 @@ struct System : public PseudoNix::FileSystem
         m_funcs.clear();
     }
 
-    static std::shared_ptr<stream_type> make_stream(std::string const& initial_data="")
+    /**
+     * @brief allocatorStats
+     * @return
+     *
+     * Returns the allocation counts of the pool used for
+     * coroutine frames and process records
+     */
+    FramePool::Stats allocatorStats() const
+    {
+        return m_framePool->stats();
+    }
+
+    /**
+     * @brief tracer
+     * @return
+     *
+     * Returns the tracer which records scheduler events. Events are
+     * only recorded if PSEUDONIX_ENABLE_TRACE is defined and the
+     * tracer has been started.
+     */
+    Tracer & tracer()
+    {
+        return m_tracer;
+    }
+
+    /**
+     * @brief functions
+     * @return
+     *
+     * Returns a snapshot of all the registered functions. The snapshot
+     * does not change if functions are added or removed later.
+     */
+    auto functions() const
+    {
+        return m_funcs.snapshot();
+    }
+
+    static std::shared_ptr<stream_type> make_stream(std::string const& initial_data="", StreamBackend backend = StreamBackend::CHUNKED, size_t capacity = 0)
     {
-        auto r = std::make_shared<stream_type>();
+        std::shared_ptr<stream_type> r;
+        switch(backend)
+        {
+            case StreamBackend::RING:
+                r = std::make_shared<RingStream_t<char>>();
+                break;
+            case StreamBackend::CHUNKED:
+                r = std::make_shared<ReaderWriterStream_t<char>>();
+                break;
+        }
+        r->set_capacity(capacity);
         *r << initial_data;
         return r;
     }
@@ -496,6 +973,16 @@ struct System : public PseudoNix::FileSystem
         setDefaultFunctions();
     }
 
+    ~System()
+    {
+        // Stop all the worker threads before the task
+        // queues they are reading from are destroyed
+        for(queue_id_type id=0; id<m_queueCount.load(std::memory_order_acquire); id++)
+        {
+            _taskQueueStopExecutor(*m_queues[id]);
+        }
+    }
+
     /**
      * @brief spawnProcess
      * @param args
@@ -570,10 +1057,27 @@ struct System : public PseudoNix::FileSystem
      */
     bool kill(pid_type pid)
     {
-        if(isRunning(pid))
+        // the process may be reaped by another thread at any
+        // time, so look it up once rather than calling isRunning()
+        if(auto proc = m_procs2.find(pid); proc && !proc->is_complete)
         {
-            auto & proc = PROC_AT(pid);
             proc->force_terminate = true;
+
+            // If no thread owns the process, take it and hand it to
+            // the reaper. Otherwise it may be running on another
+            // thread, and its owner hands it over when it suspends.
+            auto s = proc->runState.load(std::memory_order_acquire);
+            while(!(s & Process::KILLED))
+            {
+                auto n = (s & Process::OWNED) ? s | Process::KILLED
+                                              : (s + Process::EPOCH) | Process::OWNED | Process::KILLED;
+                if(proc->runState.compare_exchange_weak(s, n, std::memory_order_acq_rel))
+                {
+                    if(!(s & Process::OWNED))
+                        m_completed.enqueue(pid);
+                    break;
+                }
+            }
             return true;
         }
         return false;
@@ -587,7 +1091,7 @@ struct System : public PseudoNix::FileSystem
      */
     void terminateAll(std::string queue_name = {})
     {       
-        for(auto & [pid, P] : m_procs2)
+        for(auto & [pid, P] : m_procs2.snapshot())
         {
             if(P->control->queue_name == queue_name || queue_name.empty())
                 signal(pid, sig_terminate);
@@ -621,14 +1125,14 @@ struct System : public PseudoNix::FileSystem
         {
             // go through each of the queues and
             // execute them
-            for(auto & [queueName, queu] : m_awaiters)
+            for(queue_id_type id=1; id<m_queueCount.load(std::memory_order_acquire); id++)
             {
-                if(queueName != DEFAULT_QUEUE)
+                if(_queue(id))
                 {
-                    taskQueueExecute(queueName, std::chrono::milliseconds(25), 1);
+                    taskQueueExecute(id, std::chrono::milliseconds(25), 1);
                 }
             }
-            taskQueueExecute(DEFAULT_QUEUE , std::chrono::milliseconds(25), 1);
+            taskQueueExecute(DEFAULT_QUEUE_ID, std::chrono::milliseconds(25), 1);
 
             if(process_count() == 0)
             {
@@ -639,7 +1143,7 @@ struct System : public PseudoNix::FileSystem
         // at this point, any processes still running
         // should be forcefully killed.
         // send the KILL signal to all of them
-        for(auto & [pid, P] : m_procs2)
+        for(auto & [pid, P] : m_procs2.snapshot())
         {
             kill(pid);
         }
@@ -671,8 +1175,8 @@ struct System : public PseudoNix::FileSystem
      *
      *   e_type e_type;
      *   e_type.args = {"echo", "hello", "world"};
-     *   e_type.in  = std::make_shared<stream_type>();
-     *   e_type.out = std::make_shared<stream_type>();
+     *   e_type.in  = System::make_stream();
+     *   e_type.out = System::make_stream();
      *   e_type.in->close();
      *
      *   // This returns  co-routine task that must
@@ -691,78 +1195,194 @@ struct System : public PseudoNix::FileSystem
     {
         assert(args.args.size() > 0);
         // Try to find the name of the function to run
-        auto it = m_funcs.find(args.args[0]);
-        if(it ==  m_funcs.end())
+        auto funcs = m_funcs.snapshot();
+        auto it = funcs->find(args.args[0]);
+        if(it ==  funcs->end())
             return invalid_pid;
 
         //auto & exec_args = args;
 
         if(!args.in)
         {
-            args.in = make_stream();
+            args.in = make_stream("", args.backend, args.capacity);
             //exec_args.in->close();
         }
 
         // Copies all the arguments into $0 $1 $2 environment
         // variables
+        for(size_t i=0;i<args.args.size();i++)
         {
-            int i=0;
-            for(auto & a : args.args)
-            {
-                args.env[std::to_string(i)] = a;
-                ++i;
-            }
+            args.env[std::to_string(i)] = args.args[i];
         }
 
         if(m_preExec)
             m_preExec(args);
 
-        if(!args.out) args.out = make_stream();
-        if(!args.in) args.in = make_stream();
+        if(!args.out) args.out = make_stream("", args.backend, args.capacity);
+        if(!args.in) args.in = make_stream("", args.backend, args.capacity);
 
-        auto proc_control = std::make_shared<ProcessControl>();
+        auto proc_control = std::allocate_shared<ProcessControl>(PoolAllocator<ProcessControl>(m_framePool));
         proc_control->args = args.args;
         proc_control->in   = args.in;
         proc_control->out  = args.out;
-        proc_control->env  = args.env;
         proc_control->queue_name= args.queue;
 
+        auto & env = proc_control->env;
+        for(auto & [var, val] : args.env)
+        {
+            env[var] = val;
+        }
 
-        // If there is a valid parent, then copy all
-        // the exported variables from the parent into the
-        // new process's environment
+        // If there is a valid parent, the new process shares
+        // a snapshot of the parent's exported variables. The
+        // variables set above take priority.
         if(parent != invalid_pid)
         {
-            auto & exported = PROC_AT(parent)->control->exported;
-            auto & parent_env= PROC_AT(parent)->control->env;
-
-            for(auto & [var, exp] : exported)
-            {
-                if(parent_env.count(var) && proc_control->env.count(var) == 0)
-                {
-                    proc_control->env[var] = parent_env[var];
-                }
-            }
+            env.inherit(PROC_AT(parent)->control->env);
         }
 
+        // Set up the working directory before the process
+        // can be resumed by another thread
+        proc_control->system = this;
+        proc_control->chdir("/");
+
         // run the function, it is a coroutine:
-        // it will return a task
-        auto T = it->second(proc_control);
+        // it will return a task. Its frame is
+        // allocated from the system's pool
+        auto T = [&]()
+        {
+            FrameAllocatorScope scope(m_framePool.get());
+            return it->second(proc_control);
+        }();
 
-        auto pid = registerProcess(std::move(T), std::move(proc_control), parent);
-        getProcessControl(pid)->chdir("/");
+        auto pid = _pid_count.fetch_add(1, std::memory_order_relaxed);
+        auto & P = *_createProcess(std::move(T), std::move(proc_control), parent, std::move(funcs), pid);
+        if(args.nice)
+            _setNice(P, *args.nice);
+        P.initialAwaiter.await_suspend(P.initialAwaiter.handle_);
 
         return pid;
     }
 
+    /**
+     * @brief spawnBatch
+     * @param templ
+     * @param count
+     * @param parent
+     * @return
+     *
+     * Spawn count instances of the same command and return their
+     * PIDs. This is the same as calling runRawCommand(templ, parent)
+     * count times, but the work which is the same for every instance
+     * is only done once:
+     *
+     *   - the function is looked up once
+     *   - the pre-exec hook is called once, on the template
+     *   - the environment ($0, $1..., the variables in templ.env, the
+     *     parent's exported variables and PWD) is built once and
+     *     shared by all the instances as an immutable snapshot
+     *   - the PIDs are allocated as one block
+     *   - the processes are added to their task queue in bulk
+     *
+     * If templ.in or templ.out are set, they are shared by all the
+     * instances, otherwise each instance gets its own streams.
+     *
+     * Returns an empty vector if the function does not exist.
+     *
+     *   System::Exec E({"echo", "hello"});
+     *   E.out = out;
+     *   auto pids = system.spawnBatch(E, 1000);
+     */
+    std::vector<pid_type> spawnBatch(Exec templ, size_t count, pid_type parent = invalid_pid)
+    {
+        assert(templ.args.size() > 0);
+        std::vector<pid_type> out;
+
+        auto funcs = m_funcs.snapshot();
+        auto it = funcs->find(templ.args[0]);
+        if(it == funcs->end() || count == 0)
+            return out;
+
+        for(size_t i=0;i<templ.args.size();i++)
+            templ.env[std::to_string(i)] = templ.args[i];
+
+        if(m_preExec)
+            m_preExec(templ);
+
+        // Build the environment the same way runRawCommand and
+        // chdir("/") would, then freeze it
+        Environment env;
+        for(auto & [var, val] : templ.env)
+            env[var] = val;
+        if(parent != invalid_pid)
+            env.inherit(PROC_AT(parent)->control->env);
+        auto old_pwd = env["PWD"];
+        env["OLDPWD"] = std::move(old_pwd);
+        env["PWD"] = "/";
+        auto base = env.snapshot();
+
+        auto queue = taskQueueId(templ.queue);
+        auto first = _pid_count.fetch_add(static_cast<pid_type>(count), std::memory_order_relaxed);
+
+        std::array<std::vector<std::pair<Awaiter*, std::shared_ptr<Process>>>, priority_levels> items;
+        out.reserve(count);
+
+        for(size_t i=0;i<count;i++)
+        {
+            auto proc_control = std::allocate_shared<ProcessControl>(PoolAllocator<ProcessControl>(m_framePool));
+            proc_control->args       = templ.args;
+            proc_control->in         = templ.in  ? templ.in  : make_stream("", templ.backend, templ.capacity);
+            proc_control->out        = templ.out ? templ.out : make_stream("", templ.backend, templ.capacity);
+            proc_control->queue_name = templ.queue;
+            proc_control->env.share(base);
+
+            auto T = [&]()
+            {
+                FrameAllocatorScope scope(m_framePool.get());
+                return it->second(proc_control);
+            }();
+
+            auto pid = first + static_cast<pid_type>(i);
+            auto P = _createProcess(std::move(T), std::move(proc_control), parent, funcs, pid);
+            if(templ.nice)
+                _setNice(*P, *templ.nice);
+            P->blockedOn.store(AwaiterKind::START, std::memory_order_relaxed);
+            P->queuedAt.store(_now(), std::memory_order_relaxed);
+
+            // nothing below touches the coroutine frame, so it can
+            // be released before it is queued
+            _releaseProcess(*P);
+
+            auto level = _schedLevel(*P);
+            items[level].emplace_back(&P->initialAwaiter, std::move(P));
+            out.push_back(pid);
+        }
+
+        auto TQ = _queue(queue);
+        if(!TQ)
+        {
+            DEBUG_ERROR("Task queue {} not found. Adding to MAIN", templ.queue);
+            TQ = m_queues[DEFAULT_QUEUE_ID].get();
+        }
+        for(size_t l=0;l<items.size();l++)
+        {
+            if(items[l].size())
+                TQ->enqueue_bulk(std::make_move_iterator(items[l].begin()), items[l].size(), l);
+        }
+        if(auto ex = TQ->m_executor.load(std::memory_order_acquire))
+            ex->notify_all();
+
+        return out;
+    }
+
     std::vector<pid_type> runPipeline(std::vector<Exec> E, pid_type parent = invalid_pid)
     {
         if(E.size())
         {
             if(!E.front().in)
-                E.front().in = make_stream();
+                E.front().in = make_stream("", E.front().backend, E.front().capacity);
             if(!E.back().out)
-                E.back().out = make_stream();
+                E.back().out = make_stream("", E.back().backend, E.back().capacity);
         }
 
         for(size_t i=0;i<E.size()-1;i++)
@@ -795,51 +1415,81 @@ struct System : public PseudoNix::FileSystem
      */
     pid_type registerProcess(task_type && t, e_type arg, pid_type parent = invalid_pid)
     {
-        auto _pid = _pid_count++;
+        return _registerProcess(std::move(t), std::move(arg), parent, nullptr);
+    }
+
+protected:
+    pid_type _registerProcess(task_type && t, e_type arg, pid_type parent, function_map_type::snapshot_type funcs)
+    {
+        auto _pid = _pid_count.fetch_add(1, std::memory_order_relaxed);
+        auto & _t = *_createProcess(std::move(t), std::move(arg), parent, std::move(funcs), _pid);
+        _t.initialAwaiter.await_suspend(_t.initialAwaiter.handle_);
+        return _pid;
+    }
+
+    // Create the Process for the task and add it to the process
+    // table, but do not place it on a task queue. The initial
+    // awaiter is set up, the caller must enqueue it.
+    std::shared_ptr<Process> _createProcess(task_type && t, e_type arg, pid_type parent, function_map_type::snapshot_type funcs, pid_type _pid)
+    {
         if(arg == nullptr)
-            arg = std::make_shared<ProcessControl>();
+            arg = std::allocate_shared<ProcessControl>(PoolAllocator<ProcessControl>(m_framePool));
 
         auto handle = t.get_handle();
 
-        auto _t_p = std::make_shared<Process>(arg, std::move(t));
+        auto _t_p = std::allocate_shared<Process>(PoolAllocator<Process>(m_framePool), arg, std::move(t), m_framePool);
         auto & _t = *_t_p;
         _t.parent = parent;
+        _t.functions = std::move(funcs);
         arg->pid = _pid;
         arg->system = this;
+        arg->process = &_t;
+
+        // let the coroutine tell the reaper when it has finished
+        handle.promise().on_final_suspend     = &System::_onFinalSuspend;
+        handle.promise().on_final_suspend_arg = &_t;
 
         if(parent != invalid_pid)
         {
-            PROC_AT(parent)->child_processes.push_back(_pid);
+            auto P = PROC_AT(parent);
+            P->addChild(_pid);
+            _t.nice.store(P->nice.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            _t.weight.store(P->weight.load(std::memory_order_relaxed), std::memory_order_relaxed);
         }
 
-        std::weak_ptr<ProcessControl> p = arg;
-
         // default signal handler
-        // is to pass all signals to child processes
-        _t.signal = [p, this](int s)
+        // is to pass all signals to child processes.
+        // Only capture the pid, so the handler fits in
+        // std::function's small buffer
+        _t.setSignalHandler([_pid, this](int s)
         {
-            if(auto aa = p.lock(); aa)
+            if(auto P = m_procs2.find(_pid))
             {
                 // Default signal handler will pass through the
                 // signal to its children
-                for(auto c : this->PROC_AT(aa->pid)->child_processes)
+                for(auto c : P->children())
                 {
                     this->signal(c, s);
                 }
             }
-        };
-        auto Proc = m_procs2.emplace(_pid, _t_p);
+        });
+        _t.publishEnviron();
+        m_procs2.emplace(_pid, _t_p);
 
         // Create custom awaiter that will
         // be placed in the main thread pool
         DEBUG_SYSTEM("  Process Registered. PID {}  PARENT: {} : {}", _pid, parent, join(arg->args) );
-        Proc.first->second->initialAwaiter = Awaiter(_pid, this, [](Awaiter*){return true;}, arg->queue_name);
-        Proc.first->second->initialAwaiter.handle_ = handle;
-        Proc.first->second->initialAwaiter.await_suspend(handle);
+        PSEUDONIX_TRACE(m_tracer, TraceEvent::SPAWN, _pid, parent == invalid_pid ? -1 : static_cast<int64_t>(parent),
+                        m_tracer.is_enabled() && !arg->args.empty() ? m_tracer.label(arg->args[0]) : nullptr);
+        arg->queue_id = taskQueueId(arg->queue_name);
+        _t.initialAwaiter = Awaiter(_t, this, [](Awaiter*){return true;}, arg->queue_id, AwaiterKind::START);
+        _t.initialAwaiter.handle_ = handle;
 
-        return _pid;
+        return _t_p;
     }
 
+public:
+
 
 
     /**
@@ -852,9 +1502,39 @@ struct System : public PseudoNix::FileSystem
      */
     bool isRunning(pid_type pid) const
     {
-        auto it = m_procs2.find(pid);
-        if(it == m_procs2.end()) return false;
-        return !it->second->is_complete;
+        auto P = m_procs2.find(pid);
+        if(!P) return false;
+        return !P->is_complete;
+    }
+
+    /**
+     * @brief processExists
+     * @param pid
+     * @return
+     *
+     * Returns true if the pid is in the process table. Unlike
+     * isRunning(), this is also true for processes which have
+     * completed but have not been removed yet.
+     */
+    bool processExists(pid_type pid) const
+    {
+        return m_procs2.contains(pid);
+    }
+
+    /**
+     * @brief processIDs
+     * @return
+     *
+     * Returns the PIDs of all the processes in the
+     * process table, in ascending order
+     */
+    std::vector<pid_type> processIDs() const
+    {
+        std::vector<pid_type> out;
+        out.reserve(m_procs2.size());
+        m_procs2.for_each([&](pid_type pid, auto const &){ out.push_back(pid); });
+        std::sort(out.begin(), out.end());
+        return out;
     }
 
     bool isAllComplete(std::vector<pid_type> const &pid) const
@@ -887,17 +1567,22 @@ struct System : public PseudoNix::FileSystem
      */
     bool signal(pid_type pid, int sigtype)
     {
-        if(isRunning(pid))
+        if(auto P = m_procs2.find(pid); P && !P->is_complete)
         {
-            auto & proc = *PROC_AT(pid);
-            if(proc.signal && !proc.has_been_signaled)
+            auto & proc = *P;
+            PSEUDONIX_TRACE(m_tracer, TraceEvent::SIGNAL, pid, sigtype);
+            auto handler = proc.getSignalHandler();
+            if(handler && !proc.has_been_signaled.exchange(true))
             {
-                proc.has_been_signaled = true;
                 proc.lastSignal = sigtype;
-                proc.signal(sigtype);
+                handler(sigtype);
                 proc.has_been_signaled = false;
             }
 
+            // if the process is parked, put it back on
+            // its queue so that it can see the signal
+            _wakeProcess(proc);
+
             return true;
         }
         return false;
@@ -912,9 +1597,9 @@ struct System : public PseudoNix::FileSystem
      */
     void clearSignal(pid_type pid)
     {
-        if(isRunning(pid))
+        if(auto P = m_procs2.find(pid); P && !P->is_complete)
         {
-            auto & proc = *PROC_AT(pid);
+            auto & proc = *P;
             proc.lastSignal = 0;
         }
     }
@@ -928,9 +1613,10 @@ struct System : public PseudoNix::FileSystem
      */
     std::pair<std::shared_ptr<stream_type>, std::shared_ptr<stream_type>> getIO(pid_type pid)
     {
-        if(isRunning(pid))
+        if(auto P = m_procs2.find(pid); P && !P->is_complete)
         {
-            return {PROC_AT(pid)->control->in, PROC_AT(pid)->control->out};
+            auto ctrl = P->control;
+            return {ctrl->in, ctrl->out};
         }
         return {};
     }
@@ -949,93 +1635,448 @@ struct System : public PseudoNix::FileSystem
      * Execute all the tasks on a particular queue.
      *
      * Keep processing the queue until the maxComputeTime has elapsed or maxIterations
-     * has been reached.
+     * has been reached. The time is checked before each process is resumed, so
+     * the call only goes over maxComputeTime by the length of a single resume.
+     * Processes which were not run are placed at the front of the queue for the
+     * next call.
+     *
+     * Throws std::out_of_range if the queue does not exist.
      */
-    size_t taskQueueExecute(std::string const & queue_name = DEFAULT_QUEUE, std::chrono::milliseconds maxComputeTime=std::chrono::milliseconds(15), size_t maxIter = 1)
+    size_t taskQueueExecute(std::string_view queue_name = DEFAULT_QUEUE, std::chrono::milliseconds maxComputeTime=std::chrono::milliseconds(15), size_t maxIter = 1)
+    {
+        auto id = taskQueueId(queue_name);
+        if(id == invalid_queue_id)
+            throw std::out_of_range(std::format("Task queue {} does not exist", queue_name));
+        return taskQueueExecute(id, maxComputeTime, maxIter);
+    }
+
+    size_t taskQueueExecute(queue_id_type queue_id, std::chrono::milliseconds maxComputeTime=std::chrono::milliseconds(15), size_t maxIter = 1)
     {
-        auto T0 = std::chrono::system_clock::now();
+        auto T0       = _now();
+        auto deadline = T0 + std::chrono::nanoseconds(maxComputeTime).count();
+
+        auto * TQ_p = _queue(queue_id);
+        if(!TQ_p)
+            throw std::out_of_range(std::format("Task queue {} does not exist", queue_id));
+        auto & TQ = *TQ_p;
+
+        // wake up any sleeping processes whose
+        // time has expired
+        _processTimers();
+        _priorityBoost();
+
+        std::lock_guard<std::mutex> lock(TQ.m_carryMutex);
+
+        // The budget is checked before every resume. At least one
+        // task is run on each call so the queue always makes progress
+        bool first = true;
+        auto has_time = [&]()
+        {
+            return std::exchange(first, false) || _now() < deadline;
+        };
 
         while(maxIter > 0 )
         {
             maxIter--;
-            // Execute all the processes in order of their PID
+            // Execute the processes one priority level at a time
             //
             // Nothing is removed from the container until all
             // of the objects have been processed
-            auto & POP_Q  = m_awaiters.at(queue_name).get();
-            auto & PUSH_Q = m_awaiters.at(queue_name).get2();
+            auto & POP_Q  = TQ.get();
+            auto & PUSH_Q = TQ.get2();
             {
-                m_awaiters.at(queue_name).swap();
+                TQ.swap();
             }
 
-            std::pair<Awaiter*, std::shared_ptr<Process> > a;
-
             // Process everything on the queue
             // New tasks will not be added to this queue
-            // because of the double buffering
+            // because of the double buffering.
+            //
+            // Tasks which were not run on the previous call because it
+            // ran out of time go first, ahead of the rest of their level.
             //DEBUG_SYSTEM("\n\nExecuting {}.  Total Size: {}", queue_name, POP_Q.size_approx());
-            while(_processQueue(POP_Q, PUSH_Q,  queue_name))
-                ;
-            //DEBUG_TRACE("{} Finished Total size: {}", queue_name, POP_Q.size_approx());
-            if(queue_name != DEFAULT_QUEUE)
-                return PUSH_Q.size_approx() + POP_Q.size_approx();
+            bool out_of_time = false;
 
-            // Remove any processes that:
-            //   1. whose task has completed
-            //   2. who is force terminated
-            //
-            auto _end = m_procs2.end();
-            for(auto it = m_procs2.begin(); it!=_end;)
+            // Tasks are taken off the queue in batches. The items
+            // are moved, not copied, so the process's reference
+            // count is not touched
+            std::array<std::pair<Awaiter*, std::shared_ptr<Process> >, dequeue_batch_size> batch;
+            for(size_t L=0; L<priority_levels && !out_of_time; L++)
             {
-                auto & coro = *it->second;
-
-                if(coro.task.done() && !coro.is_complete)
+                auto & carry = TQ.m_carry[L];
+                while(!carry.empty())
                 {
-                    auto exit_code = coro.task();
-                    coro.is_complete = true;
-                    *coro.exit_code = !coro.force_terminate ? exit_code : -1;
-                    coro.should_remove = true;
-                    coro.force_terminate = true;
+                    if(!has_time())
+                    {
+                        out_of_time = true;
+                        break;
+                    }
+                    auto a = std::move(carry.front());
+                    carry.pop_front();
+                    TQ.m_carrySize.fetch_sub(1, std::memory_order_relaxed);
+                    _runItem(a, PUSH_Q, queue_id, deadline);
                 }
 
-                // did someone call kill on the PID?
-                if(coro.force_terminate)
+                while(!out_of_time)
                 {
-                    it->second->control->queue_name = queue_name;
-                    _finalizePID(it->first);
+                    auto n = POP_Q.levels[L].try_dequeue_bulk(POP_Q.consumers[L], batch.begin(), batch.size());
+                    if(n == 0)
+                        break;
+                    for(size_t i=0; i<n; i++)
+                    {
+                        if(out_of_time || !has_time())
+                        {
+                            out_of_time = true;
+                            TQ.m_carry[L].push_back(std::move(batch[i]));
+                            TQ.m_carrySize.fetch_add(1, std::memory_order_relaxed);
+                            continue;
+                        }
+                        _runItem(batch[i], PUSH_Q, queue_id, deadline);
+                        batch[i].second.reset();
+                    }
                 }
+            }
 
-                if(coro.should_remove)
+            if(out_of_time)
+            {
+                // keep everything that was not run at the
+                // front of the queue for the next call
+                for(size_t L=0; L<priority_levels; L++)
                 {
-                    DEBUG_SYSTEM("  Removing PID: {}: {}", coro.control->pid, join(coro.control->args));
-                    it = m_procs2.erase(it);
+                    while(auto n = POP_Q.levels[L].try_dequeue_bulk(POP_Q.consumers[L], batch.begin(), batch.size()))
+                    {
+                        for(size_t i=0; i<n; i++)
+                            TQ.m_carry[L].push_back(std::move(batch[i]));
+                        TQ.m_carrySize.fetch_add(n, std::memory_order_relaxed);
+                    }
                 }
-                else
+            }
+
+            //DEBUG_TRACE("{} Finished Total size: {}", queue_name, POP_Q.size_approx());
+            if(queue_id != DEFAULT_QUEUE_ID)
+                return TQ.size_approx();
+
+            // Remove any processes that:
+            //   1. whose task has completed
+            //   2. who is force terminated
+            //
+            // Only the processes on the completed list are
+            // checked, the rest of the table is not touched.
+            // A process is only placed on the list by the thread
+            // which owns it, and the reaper keeps ownership, so
+            // no other thread is resuming it here
+            std::array<pid_type, dequeue_batch_size> completed;
+            while(auto n = m_completed.try_dequeue_bulk(completed.begin(), completed.size()))
+            {
+                for(auto pid : std::span(completed.data(), n))
                 {
-                    ++it;
+                    auto P = m_procs2.find(pid);
+                    if(!P)
+                        continue; // already removed
+                    auto & coro = *P;
+
+                    if(coro.finished && !coro.is_complete)
+                    {
+                        auto exit_code = coro.task();
+                        coro.is_complete = true;
+                        *coro.exit_code = !coro.force_terminate ? exit_code : -1;
+                        coro.should_remove = true;
+                        coro.force_terminate = true;
+                    }
+
+                    // did someone call kill on the PID?
+                    if(coro.force_terminate)
+                    {
+                        _setQueue(*coro.control, queue_id);
+                        _finalizePID(pid);
+                    }
+
+                    if(coro.should_remove)
+                    {
+                        DEBUG_SYSTEM("  Removing PID: {}: {}", coro.control->pid, join(coro.control->args));
+                        PSEUDONIX_TRACE(m_tracer, TraceEvent::REAP, pid, *coro.exit_code);
+                        m_procs2.erase(pid);
+                    }
                 }
             }
 
-            if(std::chrono::system_clock::now()-T0 > maxComputeTime)
+            if(out_of_time || _now() >= deadline)
                 break;
         }
 
         return m_procs2.size();
     }
 
-    void taskQueueCreate(std::string name)
+    /**
+     * @brief taskQueueCreate
+     * @param name
+     * @return
+     *
+     * Create a task queue and return its id. If the queue already
+     * exists, its id is returned. The id can be used in place of the
+     * name to avoid looking up the queue, eg:
+     *
+     *     auto id = M.taskQueueCreate("PRE_MAIN");
+     *     M.taskQueueExecute(id);
+     *     co_await ctrl->await_yield(id);
+     *
+     * Ids are never reused, a queue that is removed and created again
+     * gets its old id back. Throws std::runtime_error if max_task_queues
+     * queues have already been created.
+     */
+    queue_id_type taskQueueCreate(std::string name)
+    {
+        std::lock_guard<std::mutex> L(m_queueMutex);
+        auto n = m_queueCount.load(std::memory_order_relaxed);
+        for(queue_id_type id=0; id<n; id++)
+        {
+            if(m_queues[id]->m_name == name)
+            {
+                m_queues[id]->m_removed.store(false, std::memory_order_release);
+                return id;
+            }
+        }
+        if(n == max_task_queues)
+            throw std::runtime_error(std::format("Cannot create task queue {}: too many task queues", name));
+
+        m_queues[n] = std::make_unique<task_queue_type>();
+        m_queues[n]->m_name = std::move(name);
+        m_queueCount.store(n+1, std::memory_order_release);
+        return static_cast<queue_id_type>(n);
+    }
+
+    /**
+     * @brief taskQueueRemove
+     * @param name
+     * @return
+     *
+     * Remove a task queue. Any tasks still on the queue are moved
+     * to the DEFAULT_QUEUE, as are any tasks which try to resume on
+     * it later. Returns false if the queue does not exist, is the
+     * DEFAULT_QUEUE or is being run by an executor.
+     */
+    bool taskQueueRemove(std::string_view name)
+    {
+        std::lock_guard<std::mutex> L(m_queueMutex);
+        auto id = taskQueueId(name);
+        if(id == invalid_queue_id || id == DEFAULT_QUEUE_ID)
+            return false;
+        auto & TQ = *m_queues[id];
+        if(TQ.m_executorOwner)
+            return false;
+        TQ.m_removed.store(true, std::memory_order_release);
+
+        auto & MAIN = *m_queues[DEFAULT_QUEUE_ID];
+        std::lock_guard<std::mutex> lock(TQ.m_carryMutex);
+        task_queue_type::value_type item;
+        for(size_t l=0;l<priority_levels;l++)
+        {
+            while(TQ.m_Q1.levels[l].try_dequeue(item) || TQ.m_Q2.levels[l].try_dequeue(item))
+                MAIN.enqueue(std::move(item), l);
+            for(auto & c : TQ.m_carry[l])
+                MAIN.enqueue(std::move(c), l);
+            TQ.m_carry[l].clear();
+        }
+        TQ.m_carrySize.store(0, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * @brief taskQueueId
+     * @param name
+     * @return
+     *
+     * Returns the id of the queue, or invalid_queue_id if it
+     * does not exist.
+     */
+    queue_id_type taskQueueId(std::string_view name) const
+    {
+        auto n = m_queueCount.load(std::memory_order_acquire);
+        for(queue_id_type id=0; id<n; id++)
+        {
+            auto & TQ = *m_queues[id];
+            if(TQ.m_name == name && !TQ.m_removed.load(std::memory_order_acquire))
+                return id;
+        }
+        return invalid_queue_id;
+    }
+
+    /**
+     * @brief taskQueueName
+     * @param id
+     * @return
+     *
+     * Returns the name of the queue, or an empty string if the
+     * id is not valid.
+     */
+    std::string const & taskQueueName(queue_id_type id) const
+    {
+        static const std::string empty;
+        if(id >= m_queueCount.load(std::memory_order_acquire))
+            return empty;
+        return m_queues[id]->m_name;
+    }
+
+    bool taskQueueExists(std::string_view name) const
+    {
+        return taskQueueId(name) != invalid_queue_id;
+    }
+    std::vector<std::string> taskQueueNames() const
+    {
+        std::vector<std::string> out;
+        for(queue_id_type id=0; id<m_queueCount.load(std::memory_order_acquire); id++)
+        {
+            if(_queue(id))
+                out.push_back(m_queues[id]->m_name);
+        }
+        return out;
+    }
+    size_t taskQueueSize(std::string_view name) const
+    {
+        return taskQueueSize(taskQueueId(name));
+    }
+    size_t taskQueueSize(queue_id_type id) const
+    {
+        auto TQ = _queue(id);
+        if(!TQ)
+            throw std::out_of_range(std::format("Task queue {} does not exist", id));
+        return TQ->size_approx();
+    }
+
+    using executor_type = Executor_t<std::pair<Awaiter*, std::shared_ptr<Process> > >;
+
+    /**
+     * @brief taskQueueStartExecutor
+     * @param name
+     * @param threads
+     * @return
+     *
+     * Run the task queue on a pool of worker threads. Each worker
+     * keeps its own deque of tasks and steals from the other workers
+     * when it runs out. Idle workers sleep until a task is added to
+     * the queue.
+     *
+     * Returns false if the queue does not exist, is the DEFAULT_QUEUE
+     * or already has an executor running.
+     */
+    bool taskQueueStartExecutor(std::string_view name, size_t threads)
+    {
+        auto id = taskQueueId(name);
+        if(id == invalid_queue_id || id == DEFAULT_QUEUE_ID)
+            return false;
+        auto & TQ = *m_queues[id];
+        if(TQ.m_executorOwner)
+            return false;
+
+        auto pull = [&TQ](executor_type::value_type & item)
+        {
+            // The double buffering is only used by taskQueueExecute()
+            // so take tasks from either of the buffers, highest
+            // priority first
+            for(size_t L=0;L<priority_levels;L++)
+            {
+                if(TQ.m_Q1.levels[L].try_dequeue(item) || TQ.m_Q2.levels[L].try_dequeue(item))
+                    return true;
+            }
+            return false;
+        };
+        auto process = [this, id](executor_type::value_type & item)
+        {
+            auto again = _processItem(item, id);
+            // the awaiter is not ready and cannot be parked, give
+            // the other threads a chance before polling it again
+            if(again)
+                std::this_thread::yield();
+            return again;
+        };
+
+        // hand any tasks left over by taskQueueExecute() to the workers
+        {
+            std::lock_guard<std::mutex> lock(TQ.m_carryMutex);
+            for(size_t L=0;L<priority_levels;L++)
+            {
+                for(auto & item : TQ.m_carry[L])
+                    TQ.enqueue(std::move(item), L);
+                TQ.m_carry[L].clear();
+            }
+            TQ.m_carrySize.store(0, std::memory_order_relaxed);
+        }
+
+        TQ.m_executorOwner = std::make_unique<executor_type>(threads, pull, process);
+        TQ.m_executor.store(TQ.m_executorOwner.get(), std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief taskQueueStopExecutor
+     * @param name
+     *
+     * Stop the worker threads running the task queue. Any tasks
+     * the workers were holding are placed back on the queue so they
+     * can be run by taskQueueExecute() or another executor.
+     */
+    void taskQueueStopExecutor(std::string_view name)
+    {
+        if(auto TQ = _queue(taskQueueId(name)))
+            _taskQueueStopExecutor(*TQ);
+    }
+
+    bool taskQueueHasExecutor(std::string_view name) const
+    {
+        auto TQ = _queue(taskQueueId(name));
+        return TQ && TQ->m_executorOwner != nullptr;
+    }
+
+    /**
+     * @brief taskQueueExecutorStats
+     * @param name
+     * @return
+     *
+     * Returns the number of resumes, steals and the utilization
+     * of each of the worker threads running the task queue.
+     */
+    std::vector<executor_type::WorkerStats> taskQueueExecutorStats(std::string_view name) const
     {
-        m_awaiters[name];
+        auto TQ = _queue(taskQueueId(name));
+        if(!TQ || !TQ->m_executorOwner)
+            return {};
+        return TQ->m_executorOwner->stats();
     }
 
-    bool taskQueueExists(std::string const & name) const
+protected:
+    template<typename TQ_type>
+    void _taskQueueStopExecutor(TQ_type & TQ)
     {
-        return m_awaiters.count(name) == 1;
+        if(!TQ.m_executorOwner)
+            return;
+
+        TQ.m_executor.store(nullptr, std::memory_order_release);
+        for(auto & item : TQ.m_executorOwner->stop())
+        {
+            auto level = _schedLevel(*item.second);
+            TQ.enqueue(std::move(item), level);
+        }
+        TQ.m_executorOwner.reset();
     }
-    size_t taskQueueSize(std::string const & name) const
+
+public:
+
+    /**
+     * @brief nextTimerDeadline
+     * @return
+     *
+     * Returns the time at which the next sleeping process should be
+     * woken up, or time_point::max() if no processes are sleeping.
+     *
+     * If none of the task queues have any work to do, the host loop
+     * can sleep until this time instead of polling the system.
+     */
+    std::chrono::steady_clock::time_point nextTimerDeadline()
     {
-        return m_awaiters.at(name).m_Q1.size_approx()
-               + m_awaiters.at(name).m_Q2.size_approx();
+        std::lock_guard<std::mutex> L(m_timersMutex);
+        if(m_timers.empty())
+            return std::chrono::steady_clock::time_point::max();
+        return m_timers.front().deadline;
     }
 
     /**
@@ -1079,9 +2120,9 @@ struct System : public PseudoNix::FileSystem
      */
     std::shared_ptr<exit_code_type> getProcessExitCode(pid_type p) const
     {
-        if(auto it = m_procs2.find(p); it!=m_procs2.end())
+        if(auto P = m_procs2.find(p))
         {
-            return it->second->exit_code;
+            return P->exit_code;
         }
         return nullptr;
     }
@@ -1151,17 +2192,21 @@ struct System : public PseudoNix::FileSystem
      * @return
      *
      * Given a vector of argument lists, generte a vector of exec objects
-     * where one cmd is piped into the next
+     * where one cmd is piped into the next. The backend selects which
+     * stream implementation is used for the pipes and capacity limits
+     * how much data each pipe should hold (0 is unbounded)
      *
      */
-    static std::vector<Exec> genPipeline( std::vector<std::vector<std::string> > array_of_args)
+    static std::vector<Exec> genPipeline( std::vector<std::vector<std::string> > array_of_args, StreamBackend backend = StreamBackend::CHUNKED, size_t capacity = 0)
     {
         std::vector<Exec> out;
 
         for(size_t i=0;i<array_of_args.size();i++)
         {
             out.push_back(parseArguments(array_of_args[i]));
-            out.back().out = make_stream();
+            out.back().backend = backend;
+            out.back().capacity = capacity;
+            out.back().out = make_stream("", backend, capacity);
         }
         for(size_t i=1;i<out.size();i++)
         {
@@ -1173,85 +2218,503 @@ struct System : public PseudoNix::FileSystem
 
     std::function< void(Exec&) >                 m_preExec;
 
-    struct Process
+    struct Process : public Waiter, public std::enable_shared_from_this<Process>
     {
-        Process(std::shared_ptr<ProcessControl> ctrl, task_type && t) : control(ctrl), task(std::move(t))
+        Process(std::shared_ptr<ProcessControl> ctrl, task_type && t, std::shared_ptr<FramePool> const & pool) : control(ctrl), task(std::move(t))
         {
+            exit_code   = std::allocate_shared<exit_code_type>(PoolAllocator<exit_code_type>(pool), -1);
+            exitWaiters = std::allocate_shared<WaitList>(PoolAllocator<WaitList>(pool));
+        }
+
+        // The function registry the process was created from. A
+        // coroutine lambda's captures live in the function object,
+        // so it must outlive the coroutine even if the function
+        // is replaced or removed.
+        function_map_type::snapshot_type functions;
+
+        // called by a WaitList that this process
+        // is parked on
+        void wake() override
+        {
+            control->system->_wakeProcess(*this);
         }
         std::shared_ptr<ProcessControl> control;
         task_type                       task;
 
-        bool is_complete = false;
-        std::shared_ptr<exit_code_type  > exit_code = std::make_shared<exit_code_type>(-1);
-        std::function<void(int)>          signal = {};
+        // set when the coroutine reaches its final suspend point
+        std::atomic<bool> finished = false;
+
+        // Only the thread which owns the process may touch its
+        // coroutine frame. Task queues take ownership with a CAS
+        // before they look at the awaiter and give it up once the
+        // process has suspended and been queued or parked again.
+        // kill() only sets KILLED. Whoever owns the process at that
+        // point hands it to the reaper, which keeps ownership while
+        // it destroys the frame. The thread creating the process
+        // owns it until it is first queued.
+        //
+        // The epoch is bumped every time the process changes owner,
+        // so that a thread can tell whether it still owns it.
+        enum RunState : uint64_t
+        {
+            OWNED  = 1,
+            KILLED = 2,
+            EPOCH  = 4
+        };
+        std::atomic<uint64_t> runState = OWNED;
+
+        // when the current resume() started, 0 if the process
+        // is not being resumed. Only used by the resuming thread
+        int64_t resumeStart = 0;
+
+        // The flags below are written by whichever thread kills,
+        // signals or reaps the process and read by the task queues,
+        // which may be running on other threads.
+        std::atomic<bool> is_complete = false;
+        std::shared_ptr<exit_code_type  > exit_code;
 
         // This is where the current signal is
-        int32_t lastSignal = 0;
+        std::atomic<int32_t> lastSignal = 0;
 
         // flag indicating whether the process has been signaled
-        bool has_been_signaled = false;
+        std::atomic<bool> has_been_signaled = false;
 
         // flag used to indicate that the process should terminate
         // without cleanup.
-        bool force_terminate = false;
+        std::atomic<bool> force_terminate = false;
 
         // Process has been finalized and is ready to be
         // removed from the scheduler
-        bool should_remove = false;
+        std::atomic<bool> should_remove = false;
 
-        pid_type                        parent = invalid_pid;
-        std::vector<pid_type>           child_processes = {};
+        std::atomic<pid_type>           parent = invalid_pid;
         Awaiter initialAwaiter = {};
+
+        // Children are added by whichever thread spawns them and
+        // removed by the DEFAULT_QUEUE when they are reaped, so
+        // they are only accessed through these functions.
+        void addChild(pid_type c)
+        {
+            std::lock_guard<std::mutex> L(childMutex);
+            child_processes.push_back(c);
+        }
+
+        void removeChild(pid_type c)
+        {
+            std::lock_guard<std::mutex> L(childMutex);
+            child_processes.erase(std::remove(child_processes.begin(), child_processes.end(), c), child_processes.end());
+        }
+
+        // returns a copy of the child pids
+        std::vector<pid_type> children() const
+        {
+            std::lock_guard<std::mutex> L(childMutex);
+            return child_processes;
+        }
+
+        // The signal handler can be replaced by the process
+        // while another thread is signalling it. The handler
+        // is copied out and called without holding the lock.
+        void setSignalHandler(std::function<void(int)> f)
+        {
+            std::lock_guard<std::mutex> L(signalMutex);
+            signalHandler = std::move(f);
+        }
+
+        std::function<void(int)> getSignalHandler() const
+        {
+            std::lock_guard<std::mutex> L(signalMutex);
+            return signalHandler;
+        }
+
+        // The environment is only touched by the thread which
+        // owns the process. Other threads, eg: /proc, read the
+        // immutable copy it publishes when it is created and
+        // each time it suspends with a modified environment.
+        void publishEnviron()
+        {
+            auto & env = control->env;
+            if(environVersion == env.version() && environSnapshot)
+                return;
+            environVersion = env.version();
+            auto S = env.snapshot();
+            std::lock_guard<std::mutex> L(environMutex);
+            environSnapshot = std::move(S);
+        }
+
+        Environment::snapshot_type getEnviron() const
+        {
+            std::lock_guard<std::mutex> L(environMutex);
+            return environSnapshot;
+        }
+
+        enum WaitState : int
+        {
+            RUNNING,  // on a task queue or currently executing
+            PARKING,  // being placed on its wait lists
+            PARKED,   // off the task queues, waiting to be woken up
+            NOTIFIED  // woken up while it was being parked
+        };
+
+        std::atomic<int>                        waitState = RUNNING;
+        Awaiter                                *parkedAwaiter = nullptr;
+        std::vector<std::shared_ptr<WaitList>>  waitingOn;
+        std::shared_ptr<WaitList>               sleepList; // used by await_yield_for
+
+        // notified when the process has completed
+        std::shared_ptr<WaitList>               exitWaiters;
+
+        // Scheduler accounting. Written by the thread which resumes
+        // the process and read by anyone calling stats(). Times are
+        // in nanoseconds.
+        std::atomic<uint64_t>    resumeCount = 0;
+        std::atomic<int64_t>     cpuTime     = 0; // total time spent inside resume()
+        std::atomic<int64_t>     maxResume   = 0; // longest single resume()
+        std::atomic<int64_t>     waitTime    = 0; // total time spent on a task queue
+        std::atomic<int64_t>     queuedAt    = 0; // when it was last placed on a task queue
+        std::atomic<AwaiterKind> blockedOn   = AwaiterKind::START;
+
+        // Multi-level feedback queue state. See SchedulerConfig
+        std::atomic<int>         nice       = 0;
+        std::atomic<double>      weight     = 1.0; // scales the allotment, set from nice
+        std::atomic<uint32_t>    level      = 0;   // current priority level, 0 is the highest
+        std::atomic<int64_t>     levelTime  = 0;   // time spent in resume() at the current level
+        std::atomic<uint64_t>    boostEpoch = 0;
+
+    protected:
+        mutable std::mutex       childMutex;
+        std::vector<pid_type>    child_processes = {};
+
+        mutable std::mutex       signalMutex;
+        std::function<void(int)> signalHandler = {};
+
+        mutable std::mutex          environMutex;
+        Environment::snapshot_type  environSnapshot;
+        uint64_t                    environVersion = 0; // owner only
+    };
+
+    /**
+     * @brief The ProcessStats struct
+     *
+     * A copy of the scheduler accounting for a single process.
+     * See System::stats()
+     */
+    struct ProcessStats
+    {
+        pid_type                 pid    = invalid_pid;
+        pid_type                 parent = invalid_pid;
+        std::vector<std::string> args;
+        std::string              queue;
+        int                      nice  = 0;
+        uint32_t                 level = 0; // priority level on the task queue
+        AwaiterKind              waiting_on = AwaiterKind::NONE;
+        bool                     parked  = false; // off the task queues, waiting on a wait list
+        uint64_t                 resumes = 0;
+        std::chrono::nanoseconds cpu_time{0};
+        std::chrono::nanoseconds max_resume{0};
+        std::chrono::nanoseconds wait_time{0};
+    };
+
+    struct SystemStats
+    {
+        std::vector<ProcessStats> processes; // sorted by pid
+        uint64_t                  resumes = 0;
+        std::chrono::nanoseconds  cpu_time{0};
     };
 
+    /**
+     * @brief The SchedulerConfig struct
+     *
+     * Each task queue is a multi-level feedback queue. Processes start
+     * on the top level and are moved down a level each time they use
+     * up their allotment of CPU time on their current level. Processes
+     * that spend most of their time waiting, such as an interactive
+     * shell, stay on the top level while busy processes sink to the
+     * bottom. Each call to taskQueueExecute() always runs the top
+     * level and runs the lower levels with whatever time is left.
+     *
+     * Every boost_interval all processes are moved back to the top
+     * level so that busy processes are not starved.
+     *
+     * The allotment is scaled by the process's nice value, from
+     * -20 (about 86x longer) to 19 (about 70x shorter).
+     *
+     * time_slice is how long a process may run in a single resume
+     * before ProcessControl::should_yield() returns true.
+     */
+    struct SchedulerConfig
+    {
+        std::chrono::nanoseconds allotment      = std::chrono::milliseconds(5);
+        std::chrono::nanoseconds boost_interval = std::chrono::seconds(1);
+        std::chrono::nanoseconds time_slice     = std::chrono::milliseconds(1);
+    };
+
+    void setSchedulerConfig(SchedulerConfig const & c)
+    {
+        m_allotment.store(c.allotment.count(), std::memory_order_relaxed);
+        m_boostInterval.store(c.boost_interval.count(), std::memory_order_relaxed);
+        m_timeSlice.store(c.time_slice.count(), std::memory_order_relaxed);
+    }
+
+    SchedulerConfig schedulerConfig() const
+    {
+        SchedulerConfig c;
+        c.allotment      = std::chrono::nanoseconds(m_allotment.load(std::memory_order_relaxed));
+        c.boost_interval = std::chrono::nanoseconds(m_boostInterval.load(std::memory_order_relaxed));
+        c.time_slice     = std::chrono::nanoseconds(m_timeSlice.load(std::memory_order_relaxed));
+        return c;
+    }
+
+    /**
+     * @brief setNice
+     * @param pid
+     * @param nice
+     * @return
+     *
+     * Set the nice value of the process, between -20 and 19. Processes
+     * with a higher nice value are moved to the lower priority levels
+     * sooner. Child processes inherit the nice value of their parent.
+     *
+     * Returns false if the process does not exist.
+     */
+    bool setNice(pid_type pid, int nice)
+    {
+        auto P = m_procs2.find(pid);
+        if(!P)
+            return false;
+        _setNice(*P, nice);
+        return true;
+    }
+
+    int getNice(pid_type pid) const
+    {
+        return PROC_AT(pid)->nice.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief processStats
+     * @param pid
+     * @return
+     *
+     * Returns the scheduler accounting for a single process.
+     * Throws if the process does not exist.
+     */
+    ProcessStats processStats(pid_type pid) const
+    {
+        return _processStats(pid, *PROC_AT(pid));
+    }
+
+    /**
+     * @brief stats
+     * @return
+     *
+     * Returns the scheduler accounting for all the processes: how many
+     * times each one was resumed, how long it spent running and waiting
+     * on its task queue and what it is currently waiting for.
+     */
+    SystemStats stats() const
+    {
+        SystemStats S;
+        for(auto & [pid, P] : m_procs2.snapshot())
+        {
+            auto & p = S.processes.emplace_back(_processStats(pid, *P));
+            S.resumes  += p.resumes;
+            S.cpu_time += p.cpu_time;
+        }
+        return S;
+    }
+
 
 protected:
-    std::map<std::string, std::function< task_type(e_type) >> m_funcs;
-    std::map<pid_type, std::shared_ptr<Process> >             m_procs2;
+    // Functions are looked up far more often than they are changed, so
+    // lookups use a snapshot of the registry. The process table is
+    // sharded so processes on different threads rarely share a lock.
+    function_map_type                                         m_funcs;
+    ShardedMap_t<pid_type, Process>                           m_procs2;
+
+    // PIDs of processes which have completed or been killed. The
+    // DEFAULT_QUEUE only reaps the processes on this list, so its
+    // cost does not depend on how many processes are alive. A PID
+    // may be on the list more than once.
+    moodycamel::ConcurrentQueue<pid_type>                     m_completed;
+
+    // coroutine frames and process records are
+    // allocated from this pool
+    std::shared_ptr<FramePool>                                m_framePool = std::make_shared<FramePool>();
+    Tracer                                                    m_tracer;
 
     using awaiter_queue_type = moodycamel::ConcurrentQueue<std::pair<Awaiter*, std::shared_ptr<Process> > >;
 
-    template<typename T>
+    /**
+     * @brief The AwaiterQueue_T struct
+     *
+     * A double buffered task queue. Each buffer holds one queue per
+     * priority level. Tasks are added to the front buffer while the
+     * back buffer is being executed, so a task that is placed back on
+     * the queue is not run twice in the same pass.
+     */
+    template<typename T, size_t Levels>
     struct AwaiterQueue_T
     {
         using value_type = T;
         using queue_type = moodycamel::ConcurrentQueue<value_type>;
 
-        queue_type & get()
+        struct Buffer
+        {
+            std::array<queue_type, Levels> levels;
+
+            // Tokens for each level, only used by taskQueueExecute(),
+            // which runs on one thread at a time (see m_carryMutex).
+            // Tokens let the queue skip looking up the thread's
+            // producer and remember where the last dequeue left off.
+            std::vector<moodycamel::ConsumerToken> consumers;
+            std::vector<moodycamel::ProducerToken> producers;
+
+            Buffer()
+            {
+                for(auto & q : levels)
+                {
+                    consumers.emplace_back(q);
+                    producers.emplace_back(q);
+                }
+            }
+
+            size_t size_approx() const
+            {
+                size_t n = 0;
+                for(auto & q : levels)
+                    n += q.size_approx();
+                return n;
+            }
+
+            // take a task from the highest priority level
+            bool try_dequeue(value_type & item)
+            {
+                for(auto & q : levels)
+                    if(q.try_dequeue(item))
+                        return true;
+                return false;
+            }
+        };
+
+        Buffer & get()
         {
-            return m_swap ? m_Q2 : m_Q1;
+            return m_swap.load(std::memory_order_acquire) ? m_Q2 : m_Q1;
         }
-        queue_type & get2()
+        Buffer & get2()
         {
-            return !m_swap ? m_Q2 : m_Q1;
+            return !m_swap.load(std::memory_order_acquire) ? m_Q2 : m_Q1;
         }
 
         void swap()
         {
-            m_swap = !m_swap;
+            // tasks may be enqueued from other threads
+            // while the buffers are being swapped
+            m_swap.store(!m_swap.load(std::memory_order_relaxed), std::memory_order_release);
         }
 
-        inline bool enqueue(value_type const & item)
+        inline bool enqueue(value_type const & item, size_t level)
         {
-            return get().enqueue(item);
+            return get().levels[level].enqueue(item);
         }
-        inline bool enqueue(value_type && item)
+        inline bool enqueue(value_type && item, size_t level)
         {
-            return get().enqueue(std::move(item));
+            return get().levels[level].enqueue(std::move(item));
+        }
+        template<typename It>
+        inline bool enqueue_bulk(It first, size_t count, size_t level)
+        {
+            return get().levels[level].enqueue_bulk(first, count);
         }
         inline bool try_dequeue(value_type & item)
         {
             return get().try_dequeue(item);
         }
 
-        bool m_swap = false;
-        queue_type m_Q1;
-        queue_type m_Q2;
+        size_t size_approx() const
+        {
+            return m_Q1.size_approx() + m_Q2.size_approx() + m_carrySize.load(std::memory_order_relaxed);
+        }
+
+        std::atomic<bool> m_swap = false;
+        Buffer m_Q1;
+        Buffer m_Q2;
+
+        std::string       m_name;
+        std::atomic<bool> m_removed = false; // see taskQueueRemove()
+
+        // tasks that taskQueueExecute() did not have time to run,
+        // they are run first on the next call
+        std::mutex                                m_carryMutex;
+        std::array<std::deque<value_type>, Levels> m_carry;
+        std::atomic<size_t>                       m_carrySize = 0;
+
+        // worker threads which are running this queue, if any.
+        // The raw pointer is read by any thread that adds a task
+        std::unique_ptr<Executor_t<value_type>> m_executorOwner;
+        std::atomic<Executor_t<value_type>*>    m_executor = nullptr;
+    };
+
+    using task_queue_type = AwaiterQueue_T<std::pair<Awaiter*, std::shared_ptr<Process> >, priority_levels>;
+
+    // The task queues, indexed by their queue_id_type. A slot is never
+    // freed or reused once it has been created, so a queue can be looked
+    // up by any thread without a lock. m_queueMutex is only needed to
+    // create or remove a queue.
+    std::array<std::unique_ptr<task_queue_type>, max_task_queues> m_queues;
+    std::atomic<size_t>                                            m_queueCount = 0;
+    std::mutex                                                     m_queueMutex;
+
+    // returns nullptr if the queue does not exist
+    task_queue_type * _queue(queue_id_type id) const
+    {
+        if(id >= m_queueCount.load(std::memory_order_acquire))
+            return nullptr;
+        auto TQ = m_queues[id].get();
+        return TQ->m_removed.load(std::memory_order_acquire) ? nullptr : TQ;
+    }
+
+    void _setNice(Process & P, int nice)
+    {
+        nice = std::clamp(nice, -20, 19);
+        P.nice.store(nice, std::memory_order_relaxed);
+        P.weight.store(std::pow(1.25, -nice), std::memory_order_relaxed);
+    }
+
+    // only the thread which is resuming the process
+    // changes its queue
+    void _setQueue(ProcessControl & ctrl, queue_id_type id)
+    {
+        if(ctrl.queue_id == id)
+            return;
+        PSEUDONIX_TRACE(m_tracer, TraceEvent::QUEUE_HOP, ctrl.pid, 0, m_tracer.is_enabled() ? m_tracer.label(taskQueueName(id)) : nullptr);
+        ctrl.queue_id   = id;
+        ctrl.queue_name = taskQueueName(id);
+    }
+
+    struct Timer
+    {
+        std::chrono::steady_clock::time_point deadline;
+        std::weak_ptr<WaitList>               waitList;
+
+        bool operator > (Timer const & other) const
+        {
+            return deadline > other.deadline;
+        }
     };
 
-    std::map<std::string,  AwaiterQueue_T<std::pair<Awaiter*, std::shared_ptr<Process> >> > m_awaiters;
+    // min-heap of timers ordered by deadline
+    std::vector<Timer> m_timers;
+    std::mutex         m_timersMutex;
+
+    std::atomic<pid_type> _pid_count=1;
 
-    pid_type _pid_count=1;
+    // multi-level feedback queue parameters, see SchedulerConfig
+    std::atomic<int64_t>  m_allotment     = std::chrono::nanoseconds(std::chrono::milliseconds(5)).count();
+    std::atomic<int64_t>  m_boostInterval = std::chrono::nanoseconds(std::chrono::seconds(1)).count();
+    std::atomic<int64_t>  m_timeSlice     = std::chrono::nanoseconds(std::chrono::milliseconds(1)).count();
+    std::atomic<int64_t>  m_lastBoost     = 0;
+    std::atomic<uint64_t> m_boostEpoch    = 0;
 
     void setDefaultFunctions()
     {
@@ -1283,10 +2746,9 @@ protected:
             auto & SYSTEM = *control->system; (void)SYSTEM;\
             auto const & ARGS = control->args; (void)ARGS;\
             auto & ENV = control->env; (void)ENV; \
-            auto & EXPORTED = control->exported; (void)EXPORTED; \
             auto const & QUEUE = control->queue_name; (void)QUEUE; \
             auto const & CWD = control->cwd; (void)CWD;\
-            auto const PARENT_SHELL_PID = ENV.count("SHELL_PID") ? static_cast<PseudoNix::System::pid_type>(std::stoul(ENV["SHELL_PID"])) : PseudoNix::invalid_pid; (void)PARENT_SHELL_PID;\
+            auto const PARENT_SHELL_PID = ENV.count("SHELL_PID") ? static_cast<PseudoNix::System::pid_type>(std::stoul(ENV.at("SHELL_PID"))) : PseudoNix::invalid_pid; (void)PARENT_SHELL_PID;\
             auto const & LAST_SIGNAL = SYSTEM.PROC_AT(PID)->lastSignal; (void)LAST_SIGNAL;\
             auto SHELL_PROC = PARENT_SHELL_PID != PseudoNix::invalid_pid ? SYSTEM.getProcessControl(PARENT_SHELL_PID) : nullptr; (void)SHELL_PROC
 
@@ -1299,10 +2761,15 @@ protected:
             path = path.lexically_normal();\
         }
 
+        // The defaults are collected in a local map and published
+        // with a single update, rather than copying the whole
+        // registry for each function
+        function_map_type::map_type funcs;
+
         std::shared_ptr< std::map<std::string, std::string>> funcDescs = std::make_shared< std::map<std::string, std::string> >();
         #define DEF_FUNC_HELP(A, help) \
         (*funcDescs)[A] = help;\
-            m_funcs[A] = [](e_type ctrl) -> task_type
+            funcs[A] = [](e_type ctrl) -> task_type
 
         #define DEF_FUNC(A) DEF_FUNC_HELP(A, "")
 
@@ -1319,7 +2786,7 @@ protected:
         };
 
         (*funcDescs)["help"] = "Shows the list of commands";
-        m_funcs["help"] = [funcDescs](e_type ctrl) -> task_type
+        funcs["help"] = [funcDescs](e_type ctrl) -> task_type
         {
             PSEUDONIX_PROC_START(ctrl);
 
@@ -1332,7 +2799,7 @@ protected:
                 co_return 0;
             }
             COUT << "List of commands:\n\n";
-            for(auto & f : ctrl->system->m_funcs)
+            for(auto & f : *ctrl->system->functions())
             {
                 COUT << std::format("{:15}: {:15}\n", f.first, (*funcDescs)[f.first]);
             }
@@ -1342,7 +2809,7 @@ protected:
         {
             PSEUDONIX_PROC_START(ctrl);
 
-            for(auto & [var, val] : ENV)
+            for(auto & [var, val] : ENV.entries())
             {
                 COUT << std::format("{}={}\n", var,val);
             }
@@ -1360,9 +2827,12 @@ protected:
                 start=2;
             }
 
-            COUT << std::format("{}", join(std::span(ARGS.begin()+start, ARGS.end()), " "));
+            auto text = join(std::span(ARGS.begin()+start, ARGS.end()), " ");
             if(newline)
-                COUT.put('\n');
+                text += '\n';
+
+            HANDLE_AWAIT_INT_TERM(co_await ctrl->await_writable(ctrl->out, text.size()), ctrl);
+            COUT.write(text);
 
             co_return 0;
         };
@@ -1374,6 +2844,13 @@ protected:
 
             while(true)
             {
+                // wait until there is room in the output
+                // if the stream has a capacity
+                auto r = co_await ctrl->await_writable(ctrl->out, 2);
+                HANDLE_AWAIT_INT_TERM(r, ctrl);
+                if(r == AwaiterResult::END_OF_STREAM)
+                    break; // no one is reading the output
+
                 COUT << "y\n";
 
                 HANDLE_AWAIT_INT_TERM(co_await ctrl->await_yield(), ctrl);
@@ -1400,7 +2877,7 @@ protected:
         };
 
         (*funcDescs)["uptime"] = "Number of milliseconds since started";
-        m_funcs["uptime"] = [T0=std::chrono::system_clock::now()](e_type ctrl) -> task_type
+        funcs["uptime"] = [T0=std::chrono::system_clock::now()](e_type ctrl) -> task_type
         {
             PSEUDONIX_PROC_START(ctrl);
             COUT << std::format("{}\n", std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now()-T0).count());
@@ -1411,87 +2888,295 @@ protected:
         {
             PSEUDONIX_PROC_START(ctrl);
 
-            std::string output;
+            // holds the start of a line which was split
+            // across two readable blocks
+            std::string partial;
+            std::string buffer;
             bool quit = false;
             while(!quit)
             {
-                if(AwaiterResult::SUCCESS == co_await ctrl->await_read_line(ctrl->in, output))
+                auto r = co_await ctrl->await_has_data(ctrl->in);
+                HANDLE_AWAIT_INT_TERM(r, ctrl);
+                quit = r == AwaiterResult::END_OF_STREAM;
+
+                // Scan the readable blocks in place, only the
+                // partial lines need to be copied
+                for(auto s = CIN.peek(); !s.empty(); s = CIN.peek())
                 {
-                    std::reverse(output.begin(), output.end());
-                    *ctrl->out << std::format("{}\n", output);
-                    output.clear();
+                    auto nl = std::find(s.begin(), s.end(), '\n');
+                    if(nl == s.end())
+                    {
+                        partial.append(s.data(), s.size());
+                        CIN.release(s.size());
+                        continue;
+                    }
+                    auto line = s.first(static_cast<size_t>(nl - s.begin()));
+                    buffer.append(line.rbegin(), line.rend());
+                    buffer.append(partial.rbegin(), partial.rend());
+                    buffer += '\n';
+                    partial.clear();
+                    CIN.release(line.size() + 1);
                 }
-                else
+                COUT.write(buffer);
+                buffer.clear();
+            }
+            if(!partial.empty())
+            {
+                std::reverse(partial.begin(), partial.end());
+                partial += '\n';
+                COUT.write(partial);
+            }
+            co_return 0;
+        };
+
+        DEF_FUNC_HELP("wc", "Counts the number of characters")
+        {
+            PSEUDONIX_PROC_START(ctrl);
+
+            size_t i=0;
+            std::array<char, 4096> buffer;
+
+            bool quit = false;
+            while(!quit)
+            {
+                HANDLE_AWAIT_INT_TERM(co_await ctrl->await_has_data(ctrl->in), ctrl);
+
+                while(auto n = CIN.read(buffer))
                 {
-                    break;
+                    i += n;
+                }
+                quit = CIN.check() == stream_type::Result::END_OF_STREAM;
+            }
+
+            COUT << std::to_string(i) << '\n';
+
+            co_return 0;
+        };
+
+        DEF_FUNC_HELP("args", "Prints out information about the arguments")
+        {
+            PSEUDONIX_PROC_START(ctrl);
+
+            uint32_t i=0;
+            for(auto & arg : ARGS)
+            {
+                COUT << std::format("[{:2}] {}\n",i, arg);
+                ++i;
+            }
+
+            co_return 0;
+        };
+
+        DEF_FUNC_HELP("ps", "Shows the current process list. Use -l to show scheduler statistics")
+        {
+            PSEUDONIX_PROC_START(ctrl);
+
+            if(ARGS.size() > 1 && ARGS[1] == "-l")
+            {
+                COUT << std::format("{:<8} {:<8} {:<10} {:>3} {:>3} {:<10} {:>8} {:>10} {:>10} {:>10} {}\n",
+                                    "PID", "PPID", "QUEUE", "NI", "PRI", "WAIT", "RESUMES", "CPU(ms)", "MAX(us)", "QWAIT(ms)", "CMD");
+                for(auto & p : SYSTEM.stats().processes)
+                {
+                    auto ppid = p.parent == invalid_pid ? std::string("-") : std::to_string(p.parent);
+                    COUT << std::format("{:<8} {:<8} {:<10} {:>3} {:>3} {:<10} {:>8} {:>10.3f} {:>10.1f} {:>10.3f} {}\n",
+                                        p.pid, ppid, p.queue, p.nice, p.level, to_string(p.waiting_on), p.resumes,
+                                        std::chrono::duration<double, std::milli>(p.cpu_time).count(),
+                                        std::chrono::duration<double, std::micro>(p.max_resume).count(),
+                                        std::chrono::duration<double, std::milli>(p.wait_time).count(),
+                                        join(p.args));
                 }
+                co_return 0;
             }
-            if(!output.empty())
+
+            COUT << std::format("{:<8} {:<10} {}\n", "PID", "QUEUE", "CMD");
+            for(auto & [pid, P] : SYSTEM.m_procs2.snapshot())
             {
-                std::reverse(output.begin(), output.end());
-                *ctrl->out << std::format("{}\n", output);
+                COUT<< std::format("{:<8} {:<10} {}\n", pid, P->control->queue_name, join(P->control->args));
             }
+
             co_return 0;
         };
 
-        DEF_FUNC_HELP("wc", "Counts the number of characters")
+        DEF_FUNC_HELP("top", "Shows the processes using the most time. Usage: top [COUNT] [SECONDS]")
+        {
+            // Prints the process list sorted by the amount of time
+            // each process spent running since the previous update.
+            // Updates every SECONDS (default 1) until COUNT updates
+            // have been shown or the process is interrupted.
+            PSEUDONIX_PROC_START(ctrl);
+
+            size_t count = 0;
+            float  delay = 1.0f;
+            if(ARGS.size() > 1)
+                to_number(ARGS[1], count);
+            if(ARGS.size() > 2)
+                to_number(ARGS[2], delay);
+            delay = std::max(0.0f, delay);
+
+            std::map<pid_type, std::chrono::nanoseconds> last;
+            auto T0 = std::chrono::steady_clock::now();
+            for(size_t i=0; count == 0 || i < count; i++)
+            {
+                if(i != 0)
+                {
+                    HANDLE_AWAIT_INT_TERM(co_await ctrl->await_yield_for(std::chrono::milliseconds( static_cast<uint64_t>(delay*1000))), ctrl);
+                }
+                auto T1 = std::chrono::steady_clock::now();
+                auto elapsed = std::chrono::duration<double>(T1 - T0).count();
+                T0 = T1;
+
+                auto S = SYSTEM.stats();
+                std::vector<std::pair<std::chrono::nanoseconds, ProcessStats const*>> rows;
+                std::map<pid_type, std::chrono::nanoseconds> current;
+                for(auto & p : S.processes)
+                {
+                    auto it = last.find(p.pid);
+                    rows.push_back({p.cpu_time - (it == last.end() ? std::chrono::nanoseconds(0) : it->second), &p});
+                    current[p.pid] = p.cpu_time;
+                }
+                last = std::move(current);
+                std::stable_sort(rows.begin(), rows.end(), [](auto & a, auto & b){ return a.first > b.first; });
+
+                COUT << std::format("processes: {}  resumes: {}  cpu: {:.3f} ms\n", S.processes.size(), S.resumes,
+                                    std::chrono::duration<double, std::milli>(S.cpu_time).count());
+                COUT << std::format("{:<8} {:<10} {:<10} {:>7} {:>10} {:>10} {}\n", "PID", "QUEUE", "WAIT", "%CPU", "CPU(ms)", "MAX(us)", "CMD");
+                for(auto & [dt, p] : rows)
+                {
+                    auto pct = elapsed > 0 && i != 0 ? 100.0 * std::chrono::duration<double>(dt).count() / elapsed : 0.0;
+                    COUT << std::format("{:<8} {:<10} {:<10} {:>7.1f} {:>10.3f} {:>10.1f} {}\n",
+                                        p->pid, p->queue, to_string(p->waiting_on), pct,
+                                        std::chrono::duration<double, std::milli>(p->cpu_time).count(),
+                                        std::chrono::duration<double, std::micro>(p->max_resume).count(),
+                                        join(p->args));
+                }
+                COUT << "\n";
+            }
+            co_return 0;
+        };
+
+        DEF_FUNC_HELP("trace", "Records scheduler events. Usage: trace start|stop|dump <file>")
+        {
+            // trace start       - clear any old events and start recording
+            // trace stop        - stop recording
+            // trace dump <file> - stop recording and write the events as
+            //                     Chrome trace JSON, which can be opened
+            //                     in ui.perfetto.dev
+            PSEUDONIX_PROC_START(ctrl);
+
+#if defined PSEUDONIX_ENABLE_TRACE
+            auto & T = SYSTEM.tracer();
+            if(ARGS.size() == 2 && ARGS[1] == "start")
+            {
+                T.clear();
+                T.start();
+                co_return 0;
+            }
+            if(ARGS.size() == 2 && ARGS[1] == "stop")
+            {
+                T.stop();
+                co_return 0;
+            }
+            if(ARGS.size() == 3 && ARGS[1] == "dump")
+            {
+                T.stop();
+                path_type path = ARGS[2];
+                HANDLE_PATH(CWD, path);
+                if(SYSTEM.exists(path) != FSResult::True)
+                    SYSTEM.mkfile(path);
+                auto file = SYSTEM.openWrite(path, false);
+                if(!file.good())
+                {
+                    COUT << std::format("trace: cannot write to {}\n", path.generic_string());
+                    co_return 1;
+                }
+                T.write_chrome_json(file, [&](uint32_t pid)
+                {
+                    try
+                    {
+                        auto S = SYSTEM.processStats(pid);
+                        return S.args.empty() ? std::string() : S.args[0];
+                    }
+                    catch(std::exception &)
+                    {
+                        return std::string();
+                    }
+                });
+                co_return 0;
+            }
+            COUT << std::format("trace: {}\nUsage: trace start|stop|dump <file>\n", T.is_enabled() ? "recording" : "stopped");
+            co_return 1;
+#else
+            COUT << "trace: not available, build with PSEUDONIX_ENABLE_TRACE defined\n";
+            co_return 1;
+#endif
+        };
+
+        DEF_FUNC_HELP("nice", "Run a command with a different priority. Usage: nice [-n N] COMMAND [ARGS...]")
         {
+            // Runs the command with its nice value increased by N
+            // (default 10). Without a command, prints the nice value
+            // of this process.
             PSEUDONIX_PROC_START(ctrl);
 
-            uint32_t i=0;
-
-            bool quit = false;
-            while(!quit)
+            int adjust = 10;
+            size_t first = 1;
+            if(ARGS.size() > 2 && ARGS[1] == "-n")
             {
-                char c;
-                HANDLE_AWAIT_INT_TERM(co_await ctrl->await_has_data(ctrl->in), ctrl);
-
-                while(true)
+                if(!to_number(ARGS[2], adjust))
                 {
-                    auto r = CIN.get(&c);
-                    if(r == stream_type::Result::EMPTY)
-                    {
-                        break;
-                    }
-                    if(r == stream_type::Result::END_OF_STREAM)
-                    {
-                        quit = true;
-                        break;
-                    }
-                    ++i;
+                    COUT << std::format("nice: invalid adjustment: {}\n", ARGS[2]);
+                    co_return 1;
                 }
+                first = 3;
             }
 
-            COUT << std::to_string(i) << '\n';
-
-            co_return 0;
-        };
+            auto nice = SYSTEM.getNice(PID);
+            if(first >= ARGS.size())
+            {
+                COUT << std::format("{}\n", nice);
+                co_return 0;
+            }
 
-        DEF_FUNC_HELP("args", "Prints out information about the arguments")
-        {
-            PSEUDONIX_PROC_START(ctrl);
+            auto E = System::parseArguments( std::vector(ARGS.begin() + static_cast<std::ptrdiff_t>(first), ARGS.end()) );
+            E.in   = ctrl->in;
+            E.out  = ctrl->out;
+            E.nice = nice + adjust;
 
-            uint32_t i=0;
-            for(auto & arg : ARGS)
+            auto c_pid = ctrl->executeSubProcess(E);
+            if(c_pid == invalid_pid)
             {
-                COUT << std::format("[{:2}] {}\n",i, arg);
-                ++i;
+                COUT << std::format("nice: {}: command not found\n", E.args[0]);
+                co_return 127;
             }
+            auto exit_code = SYSTEM.PROC_AT(c_pid)->exit_code;
 
-            co_return 0;
+            HANDLE_AWAIT_INT_TERM(co_await ctrl->await_finished(c_pid), ctrl);
+
+            co_return exit_code_type(*exit_code);
         };
 
-        DEF_FUNC_HELP("ps", "Shows the current process list")
+        DEF_FUNC_HELP("renice", "Change the priority of running processes. Usage: renice N PID...")
         {
             PSEUDONIX_PROC_START(ctrl);
 
-            COUT << std::format("{:<8} {:<10} {}\n", "PID", "QUEUE", "CMD");
-            for(auto & [pid, P] : SYSTEM.m_procs2)
+            int nice = 0;
+            if(ARGS.size() < 3 || !to_number(ARGS[1], nice))
             {
-                COUT<< std::format("{:<8} {:<10} {}\n", pid, P->control->queue_name, join(P->control->args));
+                COUT << std::format("Usage: renice N PID...\n");
+                co_return 1;
             }
 
-            co_return 0;
+            int ret = 0;
+            for(size_t i=2;i<ARGS.size();i++)
+            {
+                pid_type pid = invalid_pid;
+                if(!to_number(ARGS[i], pid) || !SYSTEM.setNice(pid, nice))
+                {
+                    COUT << std::format("renice: no such process: {}\n", ARGS[i]);
+                    ret = 1;
+                }
+            }
+            co_return ret;
         };
 
         DEF_FUNC_HELP("kill", "Terminate a process")
@@ -1552,7 +3237,7 @@ protected:
         {
             PSEUDONIX_PROC_START(ctrl);
 
-            for(auto & [pid, proc] : SYSTEM.m_procs2)
+            for(auto & [pid, proc] : SYSTEM.m_procs2.snapshot())
             {
                 COUT << std::format("{}[{}]->{}->{}[{}]\n", static_cast<void*>(proc->control->in.get()), proc->control->in.use_count(), proc->control->args[0], static_cast<void*>(proc->control->out.get()), proc->control->out.use_count() );
             }
@@ -1612,7 +3297,7 @@ protected:
             // This function will be called, if we set environment variables
             // but didn't call an actual function, eg:
             //     VAR=value VAR2=value2
-            for(auto & [var,val] : ENV)
+            for(auto & [var,val] : ENV.entries())
             {
                SHELL_PROC->env[var] = val;
             }
@@ -1634,13 +3319,13 @@ protected:
                    // if the arg looked like: VAR=VAL
                    // then set the variable as well as
                    // export it
-                   SHELL_PROC->exported[std::string(var)] = true;
-                   SHELL_PROC->env[std::string(var)] = val;
+                   SHELL_PROC->env[var] = val;
+                   SHELL_PROC->env.set_exported(var);
                }
                else
                {
                    // just export the variable
-                   SHELL_PROC->exported[std::string(ARGS[i])] = true;
+                   SHELL_PROC->env.set_exported(ARGS[i]);
                }
            }
            co_return 0;
@@ -1652,9 +3337,9 @@ protected:
            // Not running in a shell
            if(!SHELL_PROC)
                co_return 0;
-           for(auto & x : SHELL_PROC->exported)
+           for(auto & x : SHELL_PROC->env.exported())
            {
-               COUT << x.first << '\n';
+               COUT << x << '\n';
            }
            co_return 0;
         };
@@ -1719,34 +3404,37 @@ protected:
             }
             count = std::clamp<size_t>(count, 0u, 1000u);
 
-            while(count--)
-            {
-                auto E = System::parseArguments( std::vector(ARGS.begin()+2, ARGS.end()) );
-                E.out = ctrl->out;
-                SYSTEM.runRawCommand(E);
-            }
+            auto E = System::parseArguments( std::vector(ARGS.begin()+2, ARGS.end()) );
+            E.out = ctrl->out;
+            SYSTEM.spawnBatch(std::move(E), count);
 
             co_return 0;
         };
 
-        DEF_FUNC_HELP("bgrunner", "Spawn a background thread to process a Task Queue")
+        DEF_FUNC_HELP("bgrunner", "Run a Task Queue on a pool of background threads")
         {
-            // Executes a Task Queue in a background thread
-            // You can call this function on the same Task Queue
-            // multiple times to spawn multiple threads on the queue
-            // effectively creating a threadpool
+            // Executes a Task Queue on a pool of worker threads
+            //
+            //   bgrunner [QUEUE] [THREADS]
+            //
+            // The workers keep running the queue until this
+            // process is signaled or killed.
             //
             PSEUDONIX_PROC_START(ctrl);
             #if defined __EMSCRIPTEN__
             COUT << "This command does not work on Emscripten at the moment.\n";
             co_return 1;
             #endif
-            std::string s;
 
             std::string TASK_QUEUE = ARGS.size() < 2 ? std::string("THREADPOOL") : ARGS[1];
-            std::atomic<bool> stop_token = false;
+            size_t threads = 1;
 
-            std::binary_semaphore _semaphore(0);
+            if(ARGS.size() > 2 && !to_number(ARGS[2], threads))
+            {
+                COUT << std::format("{}: Number of threads must be a positive number\n", ARGS[0]);
+                co_return 1;
+            }
+            threads = std::clamp<size_t>(threads, 1u, 64u);
 
             if(!SYSTEM.taskQueueExists(TASK_QUEUE))
             {
@@ -1759,51 +3447,24 @@ protected:
                 COUT << std::format("{}: Cannot run background thread on {} queue.\n", ARGS[0], TASK_QUEUE);
                 co_return 1;
             }
-            std::thread worker([sys=ctrl->system, TASK_QUEUE, &stop_token, &_semaphore]()
-            {
-                while (true)
-                {
-                    if(sys->m_awaiters.count(TASK_QUEUE) == 0)
-                    {
-                        DEBUG_ERROR("Cannot find {}. Exiting", TASK_QUEUE);
-                        break;
-                    }
-                    auto & TQ = sys->m_awaiters.at(TASK_QUEUE);
-                    auto & Q = TQ.get();
 
-                    auto is_empty = !sys->_processQueue(Q, Q, TASK_QUEUE);
-                    if(is_empty)
-                    {
-                        DEBUG_TRACE("No Tasks. Sleeping: {}", std::this_thread::get_id());
-                        _semaphore.acquire();
-                        DEBUG_TRACE("Woke up: {}", std::this_thread::get_id());
-                    }
-                    if(stop_token)
-                        break;
-                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-                }
-                DEBUG_INFO("Thread exit");
-            });
+            if(!SYSTEM.taskQueueStartExecutor(TASK_QUEUE, threads))
+            {
+                COUT << std::format("{}: Task queue, {}, is already running on background threads\n", ARGS[0], TASK_QUEUE);
+                co_return 1;
+            }
 
             PSEUDONIX_TRAP {
-                DEBUG_TRACE("TRAPPED: {}", QUEUE);
-                // set the stop token so the thread will exit
-                // its main loop
-                stop_token = true;
-                // trigger the semaphore so that the thread
-                // will wake up and quit
-                _semaphore.release();
-                worker.join();
+                DEBUG_TRACE("TRAPPED: {}", TASK_QUEUE);
+                // stop the workers, any tasks they were holding
+                // are placed back on the queue
+                SYSTEM.taskQueueStopExecutor(TASK_QUEUE);
             };
 
+            // nothing to do until we are told to stop
             while(true)
             {
-                auto & TQ = SYSTEM.m_awaiters.at(TASK_QUEUE);
-                // Wake the thread up if there are items
-                // in the queue
-                if(TQ.get().size_approx() > 0)
-                    _semaphore.release();
-                HANDLE_AWAIT_INT_TERM(co_await ctrl->await_yield(), ctrl);
+                HANDLE_AWAIT_INT_TERM(co_await ctrl->await_signal(), ctrl);
             }
 
             co_return 0;
@@ -1822,9 +3483,14 @@ protected:
             }
             if( ARGS[1] == "list")
             {
-                for(auto & a : SYSTEM.m_awaiters)
+                for(auto & name : SYSTEM.taskQueueNames())
                 {
-                    COUT << std::format("{} {}\n", a.first, a.second.get().size_approx());
+                    COUT << std::format("{} {}\n", name, SYSTEM.taskQueueSize(name));
+                    size_t i = 0;
+                    for(auto & w : SYSTEM.taskQueueExecutorStats(name))
+                    {
+                        COUT << std::format("    worker {}: resumes {} steals {} utilization {:.1f}%\n", i++, w.resumes, w.steals, 100.0 * w.utilization());
+                    }
                 }
                 co_return 0;
             }
@@ -1835,7 +3501,15 @@ protected:
                     COUT << std::format("Requires a name for the queue\n");
                     co_return 1;
                 }
-                SYSTEM.m_awaiters[ARGS[2]];
+                try
+                {
+                    SYSTEM.taskQueueCreate(ARGS[2]);
+                }
+                catch(std::exception & e)
+                {
+                    COUT << std::format("Error: {}\n", e.what());
+                    co_return 1;
+                }
                 co_return 0;
             }
             if( ARGS[1] == "destroy" )
@@ -1850,7 +3524,16 @@ protected:
                     COUT << std::format("Error: Cannot destroy the HOME queue\n");
                     co_return 1;
                 }
-                SYSTEM.m_awaiters.erase(ARGS[2]);
+                if(SYSTEM.taskQueueHasExecutor(ARGS[2]))
+                {
+                    COUT << std::format("Error: {} is being run by a bgrunner\n", ARGS[2]);
+                    co_return 1;
+                }
+                if(!SYSTEM.taskQueueRemove(ARGS[2]))
+                {
+                    COUT << std::format("Error: Cannot destroy {}\n", ARGS[2]);
+                    co_return 1;
+                }
                 co_return 0;
             }
 
@@ -1885,7 +3568,7 @@ protected:
 
             {
                 auto _lock = COUT.lock();
-                COUT << std::format("On {} queue. Thread ID: {}\n", QUEUE, ENV["THREAD_ID"]);
+                COUT << std::format("On {} queue. Thread ID: {}\n", QUEUE, ctrl->getenv("THREAD_ID"));
             }
 
             // the QUEUE variable defined by PSEUDONIX_PROC_START(ctrl)
@@ -1894,7 +3577,7 @@ protected:
 
             {
                 auto _lock = COUT.lock();
-                COUT << std::format("On {} queue. Thread ID: {}\n", QUEUE, ENV["THREAD_ID"]);
+                COUT << std::format("On {} queue. Thread ID: {}\n", QUEUE, ctrl->getenv("THREAD_ID"));
             }
 
             for(int i=0;i<10;i++)
@@ -1909,14 +3592,14 @@ protected:
                     // processes. So we ensure that we lock access
                     // to it so that it doesn't cause any race conditions
                     auto _lock = COUT.lock();
-                    COUT << std::format("On {} queue. Thread ID: {}\n", QUEUE, ENV["THREAD_ID"]);
+                    COUT << std::format("On {} queue. Thread ID: {}\n", QUEUE, ctrl->getenv("THREAD_ID"));
                 }
 
                 HANDLE_AWAIT_INT_TERM(co_await ctrl->await_yield_for(500ms, DEFAULT_QUEUE), ctrl);
 
                 {
                     auto _lock = COUT.lock();
-                    COUT << std::format("On {} queue. Thread ID: {}\n", QUEUE, ENV["THREAD_ID"]);
+                    COUT << std::format("On {} queue. Thread ID: {}\n", QUEUE, ctrl->getenv("THREAD_ID"));
                 }
             }
 
@@ -1926,7 +3609,7 @@ protected:
             HANDLE_AWAIT_INT_TERM(co_await ctrl->await_yield_for(500ms, DEFAULT_QUEUE), ctrl);
             {
                 auto _lock = COUT.lock();
-                COUT << std::format("Last On {} queue. Thread ID: {}\n", QUEUE, ENV["THREAD_ID"]);
+                COUT << std::format("Last On {} queue. Thread ID: {}\n", QUEUE, ctrl->getenv("THREAD_ID"));
             }
 
             co_return 0;
@@ -1958,23 +3641,60 @@ protected:
         }
 
 
-        DEF_FUNC_HELP("ls", "Lists files and directories")
+        DEF_FUNC_HELP("ls", "Lists files and directories. Use -R to list sub-directories")
         {
             PSEUDONIX_PROC_START(ctrl);
             path_type path = CWD;
+            bool recursive = false;
 
-            if(ARGS.size() >= 2)
+            for(size_t i=1;i<ARGS.size();i++)
             {
-                path_type p = ARGS[1];
+                if(ARGS[i] == "-R")
+                {
+                    recursive = true;
+                    continue;
+                }
+                path_type p = ARGS[i];
                 HANDLE_PATH(CWD, p)
                 path = p;
             }
 
             assert(path.has_root_directory());
 
-            for(auto u : SYSTEM.list_dir(path))
+            if(!recursive)
+            {
+                for(auto u : SYSTEM.list_dir(path))
+                {
+                    COUT << std::format("{}\n", u.generic_string());
+                }
+                co_return 0;
+            }
+
+            // list the directories depth first, each one
+            // is preceeded by its path
+            std::vector<path_type> dirs = {path};
+            bool first = true;
+            while(!dirs.empty())
             {
-                COUT << std::format("{}\n", u.generic_string());
+                auto dir = std::move(dirs.back());
+                dirs.pop_back();
+
+                std::vector<path_type> sub;
+                COUT << std::format("{}{}:\n", first ? "" : "\n", dir.generic_string());
+                first = false;
+                for(auto u : SYSTEM.list_dir(dir))
+                {
+                    COUT << std::format("{}\n", u.generic_string());
+                    auto t = SYSTEM.getType(dir / u);
+                    if(t == NodeType::MemDir || t == NodeType::MountDir)
+                        sub.push_back(dir / u);
+                }
+                dirs.insert(dirs.end(), sub.rbegin(), sub.rend());
+
+                if(ctrl->should_yield())
+                {
+                    HANDLE_AWAIT_INT_TERM(co_await ctrl->await_yield(), ctrl);
+                }
             }
 
             co_return 0;
@@ -2060,12 +3780,49 @@ protected:
                 path_type cpy_to = ARGS.back();
                 HANDLE_PATH(CWD, cpy_to);
 
+                std::vector<char> buffer(64*1024);
                 for(size_t i=1; i<ARGS.size()-1;i++)
                 {
                     path_type path = ARGS[i];
                     _clean(path);
                     HANDLE_PATH(CWD, path);
-                    SYSTEM.copy(path, cpy_to);
+
+                    auto dst = cpy_to;
+                    if(SYSTEM.prepare_copy(path, dst) != FSResult::True)
+                        continue;
+
+                    auto Fout = SYSTEM.openWrite(dst, false);
+                    auto Fin  = SYSTEM.openRead(path);
+                    if(!Fout.good() || !Fin.good())
+                        continue;
+
+                    // copy in blocks so that a large file does
+                    // not hold up the rest of the task queue. If
+                    // the file is already in memory, copy straight
+                    // from it.
+                    auto data      = Fin.data();
+                    bool in_memory = !data.empty();
+                    while(true)
+                    {
+                        std::span<const char> src;
+                        if(in_memory)
+                        {
+                            src  = data.first(std::min(buffer.size(), data.size()));
+                            data = data.subspan(src.size());
+                        }
+                        else
+                        {
+                            Fin.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                            src = {buffer.data(), static_cast<size_t>(Fin.gcount())};
+                        }
+                        if(src.empty())
+                            break;
+                        Fout.write(src.data(), static_cast<std::streamsize>(src.size()));
+                        if(ctrl->should_yield())
+                        {
+                            HANDLE_AWAIT_INT_TERM(co_await ctrl->await_yield(), ctrl);
+                        }
+                    }
                 }
             }
             else
@@ -2079,7 +3836,7 @@ protected:
 
 #if 1
         (*funcDescs)["mount"] = "Mounts host filesystems inside the VFS";
-        m_funcs["mount"] = [](e_type ctrl) -> task_type
+        funcs["mount"] = [](e_type ctrl) -> task_type
         {
             //
             // mount [host/archive] <src> <mnt point>
@@ -2258,20 +4015,51 @@ protected:
                         if (!file) {
                             co_return 1;
                         }
-                        auto T0 = std::chrono::system_clock::now();
-                        std::string line;
+                        // if the file is already in memory, eg: a memory
+                        // mapped host file, write straight from it
+                        auto data = file.data();
+                        std::vector<char> buffer(data.empty() ? 64*1024 : 0);
                         while(true)
                         {
-                            while(!file.eof() && (std::chrono::system_clock::now()-T0 < std::chrono::microseconds(1000)) )
+                            // copy the file in large blocks, each block
+                            // is a single write into the output stream
+                            while(!file.eof() && COUT.writable() > 0)
                             {
-                                std::getline(file, line);
-                                COUT << line;
-                                COUT << "\n";
+                                auto count = std::min<size_t>(64*1024, COUT.writable());
+                                std::span<const char> block;
+                                if(!data.empty())
+                                {
+                                    block = data.first(std::min(count, data.size()));
+                                    data  = data.subspan(block.size());
+                                    if(data.empty())
+                                        file.setstate(std::ios::eofbit);
+                                }
+                                else
+                                {
+                                    file.read(buffer.data(), static_cast<std::streamsize>(count));
+                                    block = {buffer.data(), static_cast<size_t>(file.gcount())};
+                                }
+                                if(block.empty())
+                                    break;
+                                COUT.write(block);
+                                if(ctrl->should_yield())
+                                    break;
                             }
-                            if(file.eof())
+                            if(file.eof() || !file.good())
                                 break;
-                            HANDLE_AWAIT_INT_TERM(co_await ctrl->await_yield(), ctrl);
-                            T0 = std::chrono::system_clock::now();
+                            if(COUT.writable() == 0)
+                            {
+                                // the output is full, wait for the
+                                // reader to catch up
+                                auto r = co_await ctrl->await_writable(ctrl->out);
+                                HANDLE_AWAIT_INT_TERM(r, ctrl);
+                                if(r == AwaiterResult::END_OF_STREAM)
+                                    break;
+                            }
+                            else
+                            {
+                                HANDLE_AWAIT_INT_TERM(co_await ctrl->await_yield(), ctrl);
+                            }
                         }
                         co_return 0;
                     }
@@ -2288,7 +4076,7 @@ protected:
             co_return 1;
         };
 
-        DEF_FUNC_HELP("blocking_sleep", "Like [sleep], but will block. For demo purposes only.")
+        DEF_FUNC_HELP("blocking_sleep", "Like [sleep], but keeps the CPU busy. For demo purposes only.")
         {
             PSEUDONIX_PROC_START(ctrl);
 
@@ -2300,42 +4088,234 @@ protected:
             to_number(ARGS[1], t);
 
             t = std::max(0.0f, t);
-            // NOTE: do not acutally use this_thread::sleep
-            // this is a coroutine, so you should suspend
-            // the routine
-            std::this_thread::sleep_for(std::chrono::milliseconds( static_cast<uint64_t>(t*1000)));
+            // NOTE: this spins rather than suspending so that it
+            // behaves like a CPU bound process. It still yields
+            // at the end of each time slice so that the rest of
+            // the task queue keeps running.
+            auto T1 = std::chrono::steady_clock::now() + std::chrono::milliseconds( static_cast<uint64_t>(t*1000));
+            while(std::chrono::steady_clock::now() < T1)
+            {
+                if(ctrl->should_yield())
+                {
+                    HANDLE_AWAIT_INT_TERM(co_await ctrl->await_yield(), ctrl);
+                }
+            }
 
             co_return 0;
         };
         #undef DEF_FUNC
+
+        m_funcs.update([&](auto & m)
+        {
+            for(auto & [name, f] : funcs)
+                m[name] = std::move(f);
+        });
     }
 
     void handleAwaiter(Awaiter *a)
     {
-        auto pid = a->get_pid();
-        auto proc = PROC_AT(pid);
+        // the awaiter lives in the process's coroutine frame, so the
+        // process is alive and does not need to be looked up
+        auto proc = a->m_process ? a->m_process->shared_from_this() : PROC_AT(a->get_pid());
+        _endResume(*proc);
+        proc->publishEnviron();
+        proc->blockedOn.store(a->kind(), std::memory_order_relaxed);
+
+        if(!_park(a, proc))
+            _enqueueAwaiter(a, proc);
+
+        // this has to be the last thing done with the awaiter,
+        // the frame may be resumed or destroyed after it
+        _releaseProcess(*proc);
+    }
 
+    void _enqueueAwaiter(Awaiter *a, std::shared_ptr<Process> proc)
+    {
         // the queue must have been created prior to
         // adding tasks
-        auto it = m_awaiters.find(a->m_queueName);
-        if(it != m_awaiters.end())
+        auto TQ = _queue(a->m_queue);
+        proc->queuedAt.store(_now(), std::memory_order_relaxed);
+        if(TQ)
         {
-            it->second.enqueue({a,proc});
+            std::pair<Awaiter*, std::shared_ptr<Process> > item{a, std::move(proc)};
+            auto ex = TQ->m_executor.load(std::memory_order_acquire);
+
+            // if we are already on one of the queue's worker
+            // threads, keep the task on that worker
+            if(ex && ex->push_local(item))
+                return;
+
+            auto level = _schedLevel(*item.second);
+            TQ->enqueue(std::move(item), level);
+            if(ex)
+                ex->notify();
         }
         else
         {
-            DEBUG_ERROR("{} not found. Adding to MAIN", a->m_queueName);
-            m_awaiters.at(DEFAULT_QUEUE).enqueue({a,proc});
+            DEBUG_ERROR("Task queue {} not found. Adding to MAIN", a->m_queue);
+            auto level = _schedLevel(*proc);
+            m_queues[DEFAULT_QUEUE_ID]->enqueue({a,proc}, level);
+        }
+    }
+
+    /**
+     * @brief _park
+     * @param a
+     * @param proc
+     * @return
+     *
+     * Take the process off the task queues and place it on the
+     * awaiter's wait lists. Returns true if the process was parked.
+     *
+     * Returns false if the awaiter cannot be parked, if it became
+     * ready while it was being parked or if it was woken up during
+     * parking. In the last case the awaiter is simply polled again.
+     */
+    bool _park(Awaiter * a, std::shared_ptr<Process> const & proc)
+    {
+        if(!a->can_park())
+            return false;
+
+        auto & P = *proc;
+        P.parkedAwaiter = a;
+        P.waitState.store(Process::PARKING);
+
+        a->_forEachWaitList([&](auto & w)
+        {
+            w->add(&P);
+            P.waitingOn.push_back(w);
+        });
+
+        // pairs with the fence in WaitList::notify_all
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        // check again, the event may have happened before
+        // the process was added to the wait lists
+        if(a->await_ready())
+        {
+            a->m_ready = true;
+            _unpark(P);
+            return false;
+        }
+
+        int expected = Process::PARKING;
+        if(P.waitState.compare_exchange_strong(expected, Process::PARKED))
+        {
+            // the awaiter may already have been resumed on another
+            // thread, so do not touch it here
+            PSEUDONIX_TRACE(m_tracer, TraceEvent::PARK, P.control->pid, 0, to_string(P.blockedOn.load(std::memory_order_relaxed)));
+            return true;
+        }
+
+        // a notification came in while we were parking
+        _unpark(P);
+        return false;
+    }
+
+    /**
+     * @brief _unpark
+     * @param P
+     *
+     * Remove the process from all the wait lists it is on
+     */
+    void _unpark(Process & P)
+    {
+        P.waitState.store(Process::RUNNING);
+        for(auto & w : P.waitingOn)
+        {
+            w->remove(&P);
+        }
+        P.waitingOn.clear();
+    }
+
+    /**
+     * @brief _wakeProcess
+     * @param P
+     *
+     * Place a parked process back on its task queue. This
+     * can be called from any thread.
+     */
+    void _wakeProcess(Process & P)
+    {
+        auto state = P.waitState.load();
+        while(true)
+        {
+            if(state == Process::PARKED)
+            {
+                if(P.waitState.compare_exchange_weak(state, Process::RUNNING))
+                {
+                    _enqueueAwaiter(P.parkedAwaiter, P.shared_from_this());
+                    return;
+                }
+            }
+            else if(state == Process::PARKING)
+            {
+                if(P.waitState.compare_exchange_weak(state, Process::NOTIFIED))
+                    return;
+            }
+            else
+            {
+                return;
+            }
+        }
+    }
+
+    void _addTimer(std::chrono::steady_clock::time_point deadline, std::shared_ptr<WaitList> const & w)
+    {
+        std::lock_guard<std::mutex> L(m_timersMutex);
+        m_timers.push_back({deadline, w});
+        std::push_heap(m_timers.begin(), m_timers.end(), std::greater<Timer>());
+    }
+
+    /**
+     * @brief _processTimers
+     *
+     * Notify all the timers which have expired. The wait list is
+     * held weakly, so if the sleeping process was woken up by
+     * something else, the timer is simply dropped.
+     */
+    void _processTimers()
+    {
+        auto now = std::chrono::steady_clock::now();
+        std::vector<std::shared_ptr<WaitList>> expired;
+        {
+            std::lock_guard<std::mutex> L(m_timersMutex);
+            while(!m_timers.empty() && m_timers.front().deadline <= now)
+            {
+                std::pop_heap(m_timers.begin(), m_timers.end(), std::greater<Timer>());
+                if(auto w = m_timers.back().waitList.lock())
+                    expired.push_back(std::move(w));
+                m_timers.pop_back();
+            }
+        }
+        for(auto & w : expired)
+        {
+            w->notify_all();
         }
     }
 
+    std::shared_ptr<WaitList> _exitWaitList(pid_type pid) const
+    {
+        auto P = m_procs2.find(pid);
+        if(!P || P->is_complete)
+            return {};
+        return P->exitWaiters;
+    }
+
     // End the process and clean up anything
     // regardless of whether it was complete
     // Does not remove the pid from the process list
     void _finalizePID(pid_type p)
     {
-        auto & coro = *PROC_AT(p);
+        auto P = PROC_AT(p);
+        auto & coro = *P;
+        coro.control->queue_id   = DEFAULT_QUEUE_ID;
         coro.control->queue_name = DEFAULT_QUEUE;
+
+        // make sure nothing can wake the process
+        // once its coroutine has been destroyed
+        _unpark(coro);
+
         if( coro.task.valid() )
         {
             if(coro.task.destroy())
@@ -2349,6 +4329,7 @@ protected:
         coro.control->out->set_eof();
 
         coro.is_complete = true;
+        coro.exitWaiters->notify_all();
 
         _detachFromParent(p);
 
@@ -2356,8 +4337,16 @@ protected:
         DEBUG_TRACE("       IN: {}", coro.control->in.use_count());
         DEBUG_TRACE("      OUT: {}", coro.control->out.use_count());
 
+        // Release the streams before notifying so that
+        // anyone waiting on them sees that this process is
+        // no longer holding a reference
+        auto outWaiters = coro.control->out->wait_list();
+        auto inWaiters  = coro.control->in ? coro.control->in->wait_list() : nullptr;
         coro.control->out = {};
         coro.control->in  = {};
+        outWaiters->notify_all();
+        if(inWaiters)
+            inWaiters->notify_all();
 
         // set the flag so that
         // it will be removed
@@ -2366,61 +4355,269 @@ protected:
 
     void _detachFromParent(pid_type p)
     {
-        auto & coro = *PROC_AT(p);
-        if(coro.parent != invalid_pid && m_procs2.count(coro.parent))
+        auto P = PROC_AT(p);
+        auto & coro = *P;
+        auto ppid = coro.parent.load();
+        if(auto parent = m_procs2.find(ppid); ppid != invalid_pid && parent)
         {
-            auto & cp = PROC_AT(coro.parent)->child_processes;
-            cp.erase(std::remove_if(cp.begin(), cp.end(), [p](auto && ch)
-                                    {
-                                        return ch==p;
-                                    }), cp.end());
+            parent->removeChild(p);
             coro.parent = invalid_pid;
         }
     }
 
 
+    // number of tasks taken off a task queue at a time
+    // by taskQueueExecute()
+    constexpr static const size_t dequeue_batch_size = 64;
+
+    // process the item and place it back on the
+    // queue if its awaiter was not ready
+    void _runItem(std::pair<Awaiter*, std::shared_ptr<Process> > & a, auto & PUSH_Q, queue_id_type queue_id, int64_t deadline)
+    {
+        if(_processItem(a, queue_id, deadline))
+        {
+            auto level = _schedLevel(*a.second);
+            PUSH_Q.levels[level].enqueue(PUSH_Q.producers[level], std::move(a));
+        }
+    }
+
     /**
-     * @brief _processQueue
-     * @param POP_Q
-     * @param PUSH_Q
-     * @param queue_name
+     * @brief _processItem
+     * @param a
+     * @param queue_id
      * @return
      *
-     * Process a single item on the queue and returns true if it was able to
-     * other wise, return false if no items are on the queue
-     *
+     * Resume the process if its awaiter is ready. Returns true if the
+     * awaiter was not ready and the item needs to be placed back on
+     * the queue. Returns false if the process was resumed, parked or
+     * is no longer running.
      */
-    bool _processQueue(auto & POP_Q, auto & PUSH_Q, std::string queue_name)
+    bool _processItem(std::pair<Awaiter*, std::shared_ptr<Process> > & a, queue_id_type queue_id, int64_t deadline = std::numeric_limits<int64_t>::max())
     {
-        std::pair<Awaiter*, std::shared_ptr<Process> > a;
-        auto found = POP_Q.try_dequeue(a);
-        if(found)
+        // The awaiter lives inside the coroutine frame, so the
+        // process has to be owned before it is touched. If it has
+        // been killed or has finished, it belongs to the reaper and
+        // this item is stale. Otherwise the thread which queued it
+        // has not let go of it yet, so try again later.
+        auto & P = *a.second;
+        auto owner = _acquireProcess(P);
+        if(!owner)
+            return !(P.runState.load(std::memory_order_relaxed) & Process::KILLED) && !P.finished;
+
+        if(!a.first->handle_)
         {
-            if(!a.first->handle_)
-                return false;
-            // its possible that the process had been forcefully killed
-            // and the handle to the coroutine no longer valid. So make sure
-            // that we do not resume any of those coroutines
-            if(a.second->force_terminate || a.second->is_complete || a.second->should_remove)
-                return found;
+            _releaseProcess(P);
+            return false;
+        }
 
-            assert(!a.second->should_remove);
-            if(a.first->await_ready())
-            {
-                a.second->control->queue_name = queue_name;
-                a.second->control->env["QUEUE"] = queue_name;
-                a.second->control->env["THREAD_ID"] = std::format("{}", std::this_thread::get_id());
-                DEBUG_SYSTEM("  Resuming on QUEUE: {} PID: {} : {}", queue_name, a.second->control->pid, join(a.second->control->args));
-                a.first->resume();
-            }
-            else
+        // if the process was woken up from a wait list, make sure
+        // it is no longer on any of the other lists
+        if(!P.waitingOn.empty())
+            _unpark(P);
+
+        bool ready = a.first->await_ready();
+        if(!ready)
+        {
+            // Not ready, take it off the queue until one
+            // of its wait lists is notified
+            if(_park(a.first, a.second))
             {
-                PUSH_Q.enqueue(std::move(a));
+                _releaseProcess(P);
+                return false;
             }
+            ready = a.first->m_ready;
+        }
+
+        // poll it again, unless it was killed in the meantime
+        if(!ready)
+            return _releaseProcess(P);
+
+        auto & ctrl = *a.second->control;
+        _setQueue(ctrl, queue_id);
+        ctrl.thread_id = std::this_thread::get_id();
+        DEBUG_SYSTEM("  Resuming on QUEUE: {} PID: {} : {}", ctrl.queue_name, a.second->control->pid, join(a.second->control->args));
+
+        auto T0 = _now();
+        P.waitTime.fetch_add(T0 - P.queuedAt.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        P.blockedOn.store(AwaiterKind::NONE, std::memory_order_relaxed);
+        ctrl.yield_deadline = std::min(deadline, T0 + m_timeSlice.load(std::memory_order_relaxed));
+
+        PSEUDONIX_TRACE(m_tracer, TraceEvent::RESUME_BEGIN, ctrl.pid);
+        P.resumeStart = T0;
+        a.first->resume();
+
+        // Nothing else can be done with the frame here. The process
+        // may already be on another queue, or finished and reaped,
+        // and be running or destroyed on another thread. The time
+        // spent in resume() is accounted for by _endResume() before
+        // the process suspends, see handleAwaiter() and
+        // _onFinalSuspend(), which also give up ownership of it.
+        //
+        // If this thread still owns the process, it suspended
+        // without going through an Awaiter, eg: co_await
+        // std::suspend_always{}. Nothing will resume it, but let go
+        // of it so that it can still be killed.
+        if((P.runState.load(std::memory_order_acquire) & ~uint64_t(Process::KILLED)) == owner)
+            _releaseProcess(P);
+        return false;
+    }
+
+    /**
+     * @brief _acquireProcess
+     * @param P
+     * @return
+     *
+     * Take ownership of a process which is not owned by another
+     * thread and has not been killed. Returns the new run state,
+     * which identifies this owner, or 0 if the process could not
+     * be taken. See Process::runState
+     */
+    uint64_t _acquireProcess(Process & P)
+    {
+        auto s = P.runState.load(std::memory_order_relaxed);
+        while(!(s & (Process::OWNED | Process::KILLED)))
+        {
+            auto n = (s + Process::EPOCH) | Process::OWNED;
+            if(P.runState.compare_exchange_weak(s, n, std::memory_order_acq_rel))
+                return n;
+        }
+        return 0;
+    }
+
+    /**
+     * @brief _releaseProcess
+     * @param P
+     * @return
+     *
+     * Give up ownership of the process. If it was killed while it
+     * was owned, it is handed to the reaper instead and false is
+     * returned. The coroutine frame must not be touched afterwards.
+     */
+    bool _releaseProcess(Process & P)
+    {
+        auto s = P.runState.load(std::memory_order_relaxed);
+        while(!(s & Process::KILLED))
+        {
+            if(P.runState.compare_exchange_weak(s, s & ~uint64_t(Process::OWNED), std::memory_order_acq_rel))
+                return true;
+        }
+        _handToReaper(P);
+        return false;
+    }
+
+    // Pass ownership of the process to the reaper on the
+    // DEFAULT_QUEUE. Only called by the owner of the process
+    void _handToReaper(Process & P)
+    {
+        P.runState.fetch_add(Process::EPOCH, std::memory_order_acq_rel);
+        m_completed.enqueue(P.control->pid);
+    }
+
+    /**
+     * @brief _endResume
+     * @param P
+     *
+     * Called on the thread which resumed the process, when the
+     * process suspends and before it can be placed on any queue.
+     * Records the time spent in resume() and moves the process
+     * down a priority level if it used up its allotment.
+     */
+    void _endResume(Process & P)
+    {
+        auto T0 = std::exchange(P.resumeStart, 0);
+        if(T0 == 0)
+            return; // not resumed by a task queue
+        PSEUDONIX_TRACE(m_tracer, TraceEvent::RESUME_END, P.control->pid);
+
+        auto dt = _now() - T0;
+        P.resumeCount.fetch_add(1, std::memory_order_relaxed);
+        P.cpuTime.fetch_add(dt, std::memory_order_relaxed);
+        auto m = P.maxResume.load(std::memory_order_relaxed);
+        while(dt > m && !P.maxResume.compare_exchange_weak(m, dt, std::memory_order_relaxed))
+        {
+        }
+
+        // move the process down a priority level once it
+        // has used up its allotment on the current level
+        auto used  = P.levelTime.fetch_add(dt, std::memory_order_relaxed) + dt;
+        auto level = P.level.load(std::memory_order_relaxed);
+        auto allot = static_cast<double>(m_allotment.load(std::memory_order_relaxed)) * P.weight.load(std::memory_order_relaxed);
+        if(level + 1 < priority_levels && static_cast<double>(used) >= allot)
+        {
+            P.level.store(level + 1, std::memory_order_relaxed);
+            P.levelTime.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Called from the final suspend point of a process's coroutine.
+    // The frame can be destroyed as soon as the pid is on the
+    // completed list, so that has to be the last thing done. The
+    // process stays owned, the reaper takes it over.
+    static void _onFinalSuspend(void * p)
+    {
+        auto & P = *static_cast<Process*>(p);
+        auto & S = *P.control->system;
+        S._endResume(P);
+        P.finished = true;
+
+        // the DEFAULT_QUEUE will reap it
+        S._handToReaper(P);
+    }
+
+    /**
+     * @brief _schedLevel
+     * @param P
+     * @return
+     *
+     * Returns the priority level the process should be queued on.
+     * If there has been a priority boost since the process was last
+     * queued, it is moved back to the top level.
+     */
+    size_t _schedLevel(Process & P)
+    {
+        auto epoch = m_boostEpoch.load(std::memory_order_relaxed);
+        if(P.boostEpoch.load(std::memory_order_relaxed) != epoch)
+        {
+            P.boostEpoch.store(epoch, std::memory_order_relaxed);
+            P.level.store(0, std::memory_order_relaxed);
+            P.levelTime.store(0, std::memory_order_relaxed);
+        }
+        return P.level.load(std::memory_order_relaxed);
+    }
+
+    void _priorityBoost()
+    {
+        auto now  = _now();
+        auto last = m_lastBoost.load(std::memory_order_relaxed);
+        if(now - last >= m_boostInterval.load(std::memory_order_relaxed) &&
+           m_lastBoost.compare_exchange_strong(last, now, std::memory_order_relaxed))
+        {
+            m_boostEpoch.fetch_add(1, std::memory_order_relaxed);
         }
-        return found;
     }
 
+    static int64_t _now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    ProcessStats _processStats(pid_type pid, Process const & P) const
+    {
+        ProcessStats s;
+        s.pid        = pid;
+        s.parent     = P.parent;
+        s.args       = P.control->args;
+        s.queue      = P.control->queue_name;
+        s.nice       = P.nice.load(std::memory_order_relaxed);
+        s.level      = P.level.load(std::memory_order_relaxed);
+        s.waiting_on = P.blockedOn.load(std::memory_order_relaxed);
+        s.parked     = P.waitState.load(std::memory_order_relaxed) == Process::PARKED;
+        s.resumes    = P.resumeCount.load(std::memory_order_relaxed);
+        s.cpu_time   = std::chrono::nanoseconds(P.cpuTime.load(std::memory_order_relaxed));
+        s.max_resume = std::chrono::nanoseconds(P.maxResume.load(std::memory_order_relaxed));
+        s.wait_time  = std::chrono::nanoseconds(P.waitTime.load(std::memory_order_relaxed));
+        return s;
+    }
 
 };
 
@@ -0,0 +1,370 @@
+#ifndef PSEUDONIX_TRACE_H
+#define PSEUDONIX_TRACE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+//
+// Scheduler tracing is compiled out unless PSEUDONIX_ENABLE_TRACE
+// is defined (cmake -DPseudoNix_ENABLE_TRACE=ON). When it is compiled
+// in, nothing is recorded until Tracer::start() is called.
+//
+#if defined PSEUDONIX_ENABLE_TRACE
+#define PSEUDONIX_TRACE(TRACER, ...) (TRACER).record(__VA_ARGS__)
+#else
+#define PSEUDONIX_TRACE(TRACER, ...)
+#endif
+
+namespace PseudoNix
+{
+
+enum class TraceEvent : uint8_t
+{
+    SPAWN,        // arg = parent pid, label = process name
+    RESUME_BEGIN,
+    RESUME_END,
+    PARK,         // label = what the process is waiting on
+    SIGNAL,       // arg = signal
+    QUEUE_HOP,    // label = the new queue
+    REAP          // arg = exit code
+};
+
+/**
+ * @brief The TraceRecord struct
+ *
+ * A single scheduler event. The label must point to a string which
+ * lives as long as the Tracer, eg: a string literal or a string
+ * returned by Tracer::label().
+ */
+struct TraceRecord
+{
+    int64_t      time  = 0; // steady_clock, nanoseconds
+    int64_t      arg   = 0;
+    char const * label = nullptr;
+    uint32_t     pid   = 0;
+    TraceEvent   event = TraceEvent::SPAWN;
+};
+
+/**
+ * @brief The Tracer class
+ *
+ * Records scheduler events into a ring buffer for each thread that
+ * produces them. Recording an event does not take a lock: each thread
+ * writes to its own buffer, and once a buffer is full the oldest
+ * events are overwritten.
+ *
+ * Each slot in a buffer has a sequence number which the writer bumps
+ * before and after it fills in the slot. Readers skip any slot whose
+ * sequence number is not the one they expect or changes while they
+ * copy it, so the events can be read while other threads record.
+ *
+ * The events can be written out in the Chrome trace JSON format, which
+ * can be opened in Perfetto (ui.perfetto.dev) or chrome://tracing.
+ * Each thread is shown as a track, with a slice for every time a
+ * process was resumed.
+ */
+class Tracer
+{
+public:
+    static constexpr size_t buffer_size = 1u << 16; // events per thread
+
+    Tracer() : m_id(_nextId())
+    {
+    }
+
+    Tracer(Tracer const &) = delete;
+    Tracer & operator=(Tracer const &) = delete;
+
+    void start()
+    {
+        m_enabled.store(true, std::memory_order_release);
+    }
+
+    void stop()
+    {
+        m_enabled.store(false, std::memory_order_release);
+    }
+
+    bool is_enabled() const
+    {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief clear
+     *
+     * Remove all the recorded events
+     */
+    void clear()
+    {
+        std::lock_guard L(m_mutex);
+        for(auto & b : m_buffers)
+            b->tail.store(b->head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    /**
+     * @brief label
+     * @param s
+     * @return
+     *
+     * Returns a copy of the string which lives as long as the tracer,
+     * so that it can be used as the label of an event. Labelling the
+     * same string twice returns the same pointer.
+     */
+    char const * label(std::string_view s)
+    {
+        std::lock_guard L(m_labelMutex);
+        auto it = m_labels.find(s);
+        if(it == m_labels.end())
+            it = m_labels.emplace(s).first;
+        return it->c_str();
+    }
+
+    void record(TraceEvent event, uint32_t pid, int64_t arg = 0, char const * label = nullptr)
+    {
+        if(!is_enabled())
+            return;
+
+        auto & B = _buffer();
+        auto h = B.head.load(std::memory_order_relaxed);
+        auto & S = B.slots[h & (buffer_size - 1)];
+
+        // odd while the slot is being written
+        S.seq.store(2*h + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        S.time.store(_now(), std::memory_order_relaxed);
+        S.arg.store(arg, std::memory_order_relaxed);
+        S.label.store(label, std::memory_order_relaxed);
+        S.pid.store(pid, std::memory_order_relaxed);
+        S.event.store(event, std::memory_order_relaxed);
+        S.seq.store(2*h + 2, std::memory_order_release);
+
+        B.head.store(h + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief events
+     * @return
+     *
+     * Returns the recorded events sorted by time, paired with
+     * the index of the thread which recorded them. The tracer does
+     * not need to be stopped: events which are overwritten or still
+     * being written while they are copied are left out.
+     */
+    std::vector<std::pair<uint32_t, TraceRecord>> events() const
+    {
+        std::vector<std::pair<uint32_t, TraceRecord>> out;
+        std::lock_guard L(m_mutex);
+        for(uint32_t t=0; t<m_buffers.size(); t++)
+        {
+            auto & B = *m_buffers[t];
+            auto h = B.head.load(std::memory_order_acquire);
+            auto s = std::max(B.tail.load(std::memory_order_acquire), h > buffer_size ? h - buffer_size : 0);
+            for(auto i=s; i<h; i++)
+            {
+                TraceRecord r;
+                if(B.slots[i & (buffer_size - 1)].read(i, r))
+                    out.emplace_back(t, r);
+            }
+        }
+        std::stable_sort(out.begin(), out.end(), [](auto & a, auto & b){ return a.second.time < b.second.time; });
+        return out;
+    }
+
+    /**
+     * @brief write_chrome_json
+     * @param out
+     * @param name_of - used to name processes whose SPAWN event
+     *                  was not recorded
+     *
+     * Write the events in the Chrome trace event format
+     */
+    void write_chrome_json(std::ostream & out, std::function<std::string(uint32_t)> name_of = {}) const
+    {
+        auto E = events();
+
+        std::unordered_map<uint32_t, std::string> names;
+        for(auto & [t, r] : E)
+        {
+            if(r.event == TraceEvent::SPAWN && r.label)
+                names[r.pid] = r.label;
+        }
+        auto name = [&](uint32_t pid) -> std::string const &
+        {
+            auto it = names.find(pid);
+            if(it == names.end())
+            {
+                auto n = name_of ? name_of(pid) : std::string();
+                it = names.emplace(pid, n.empty() ? std::format("pid {}", pid) : n).first;
+            }
+            return it->second;
+        };
+
+        int64_t T0 = E.empty() ? 0 : E.front().second.time;
+        auto ts = [&](int64_t t) { return static_cast<double>(t - T0) / 1000.0; };
+
+        out << "{\"traceEvents\":[\n";
+        bool first = true;
+        auto emit = [&](std::string const & s)
+        {
+            out << (first ? "" : ",\n") << s;
+            first = false;
+        };
+
+        uint32_t threads = 0;
+        {
+            std::lock_guard L(m_mutex);
+            threads = static_cast<uint32_t>(m_buffers.size());
+        }
+        for(uint32_t t=0; t<threads; t++)
+            emit(std::format(R"({{"name":"thread_name","ph":"M","pid":1,"tid":{},"args":{{"name":"thread {}"}}}})", t, t));
+
+        for(auto & [t, r] : E)
+        {
+            auto common = std::format(R"("pid":1,"tid":{},"ts":{:.3f})", t, ts(r.time));
+            switch(r.event)
+            {
+                case TraceEvent::RESUME_BEGIN:
+                    emit(std::format(R"({{"name":"{}","cat":"resume","ph":"B",{},"args":{{"pid":{}}}}})", _escape(name(r.pid)), common, r.pid));
+                    break;
+                case TraceEvent::RESUME_END:
+                    emit(std::format(R"({{"name":"{}","cat":"resume","ph":"E",{}}})", _escape(name(r.pid)), common));
+                    break;
+                case TraceEvent::SPAWN:
+                    emit(std::format(R"({{"name":"spawn","cat":"process","ph":"i","s":"t",{},"args":{{"pid":{},"parent":{},"name":"{}"}}}})", common, r.pid, r.arg, _escape(name(r.pid))));
+                    break;
+                case TraceEvent::PARK:
+                    emit(std::format(R"({{"name":"park","cat":"scheduler","ph":"i","s":"t",{},"args":{{"pid":{},"on":"{}"}}}})", common, r.pid, _escape(r.label ? r.label : "")));
+                    break;
+                case TraceEvent::SIGNAL:
+                    emit(std::format(R"({{"name":"signal","cat":"process","ph":"i","s":"t",{},"args":{{"pid":{},"signal":{}}}}})", common, r.pid, r.arg));
+                    break;
+                case TraceEvent::QUEUE_HOP:
+                    emit(std::format(R"({{"name":"queue","cat":"scheduler","ph":"i","s":"t",{},"args":{{"pid":{},"queue":"{}"}}}})", common, r.pid, _escape(r.label ? r.label : "")));
+                    break;
+                case TraceEvent::REAP:
+                    emit(std::format(R"({{"name":"reap","cat":"process","ph":"i","s":"t",{},"args":{{"pid":{},"exit_code":{}}}}})", common, r.pid, r.arg));
+                    break;
+            }
+        }
+        out << "\n]}\n";
+    }
+
+protected:
+    // A TraceRecord which can be read while it is being written.
+    // seq is 2*i+2 once the i'th event has been written to it.
+    struct Slot
+    {
+        std::atomic<uint64_t>      seq   = 0;
+        std::atomic<int64_t>       time  = 0;
+        std::atomic<int64_t>       arg   = 0;
+        std::atomic<char const *>  label = nullptr;
+        std::atomic<uint32_t>      pid   = 0;
+        std::atomic<TraceEvent>    event = TraceEvent::SPAWN;
+
+        // copy the i'th event into r, returns false if the slot
+        // holds a different event or was written while copying
+        bool read(uint64_t i, TraceRecord & r) const
+        {
+            auto want = 2*i + 2;
+            if(seq.load(std::memory_order_acquire) != want)
+                return false;
+            r.time  = time.load(std::memory_order_relaxed);
+            r.arg   = arg.load(std::memory_order_relaxed);
+            r.label = label.load(std::memory_order_relaxed);
+            r.pid   = pid.load(std::memory_order_relaxed);
+            r.event = event.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return seq.load(std::memory_order_relaxed) == want;
+        }
+    };
+
+    struct Buffer
+    {
+        std::atomic<uint64_t>                  head = 0;
+        std::atomic<uint64_t>                  tail = 0; // moved forward by clear()
+        std::unique_ptr<Slot[]>                slots = std::make_unique<Slot[]>(buffer_size);
+    };
+
+    static int64_t _now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static uint64_t _nextId()
+    {
+        static std::atomic<uint64_t> id = 0;
+        return ++id;
+    }
+
+    static std::string _escape(std::string const & s)
+    {
+        std::string out;
+        out.reserve(s.size());
+        for(auto c : s)
+        {
+            if(c == '"' || c == '\\')
+            {
+                out += '\\';
+                out += c;
+            }
+            else if(static_cast<unsigned char>(c) < 0x20)
+                out += std::format("\\u{:04x}", static_cast<int>(c));
+            else
+                out += c;
+        }
+        return out;
+    }
+
+    // Returns this thread's buffer. The buffer is looked up once
+    // and cached, so the lock is only taken the first time a thread
+    // records an event or when it switches between Tracers.
+    Buffer & _buffer()
+    {
+        struct Cache
+        {
+            uint64_t id     = 0;
+            Buffer * buffer = nullptr;
+        };
+        static thread_local Cache cache;
+        if(cache.id == m_id)
+            return *cache.buffer;
+
+        std::lock_guard L(m_mutex);
+        auto & idx = m_threads[std::this_thread::get_id()];
+        if(idx == 0)
+        {
+            m_buffers.push_back(std::make_unique<Buffer>());
+            idx = m_buffers.size();
+        }
+        cache = {m_id, m_buffers[idx-1].get()};
+        return *cache.buffer;
+    }
+
+    uint64_t                                m_id;
+    std::atomic<bool>                       m_enabled = false;
+    mutable std::mutex                      m_mutex;
+    std::vector<std::unique_ptr<Buffer>>    m_buffers;
+    std::map<std::thread::id, size_t>       m_threads; // index+1 into m_buffers
+
+    std::mutex                              m_labelMutex;
+    std::set<std::string, std::less<>>      m_labels;
+};
+
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef PSEUDONIX_WAIT_LIST_H
+#define PSEUDONIX_WAIT_LIST_H
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+namespace PseudoNix
+{
+
+/**
+ * @brief The Waiter struct
+ *
+ * Anything that can be placed on a WaitList and woken up
+ * when the event it is waiting on happens.
+ */
+struct Waiter
+{
+    virtual ~Waiter()
+    {
+    }
+    virtual void wake() = 0;
+};
+
+/**
+ * @brief The WaitList class
+ *
+ * A list of Waiters that are waiting for an event to happen.
+ *
+ * notify_all() wakes everyone on the list and clears it. A waiter
+ * has to add itself again if it wants to keep waiting. When no one
+ * is waiting, notify_all() does not lock.
+ *
+ * To avoid missing a wakeup, a waiter should add itself to the
+ * list first and then check the condition it is waiting on.
+ */
+class WaitList
+{
+public:
+    void add(Waiter * w)
+    {
+        std::lock_guard<std::mutex> L(_m);
+        _waiters.push_back(w);
+        _count.store(_waiters.size());
+    }
+
+    void remove(Waiter * w)
+    {
+        std::lock_guard<std::mutex> L(_m);
+        _waiters.erase(std::remove(_waiters.begin(), _waiters.end(), w), _waiters.end());
+        _count.store(_waiters.size());
+    }
+
+    void notify_all()
+    {
+        // pairs with the fence in the waiter after it
+        // has added itself to the list
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(_count.load(std::memory_order_relaxed) == 0)
+            return;
+
+        std::lock_guard<std::mutex> L(_m);
+        for(auto w : _waiters)
+        {
+            w->wake();
+        }
+        _waiters.clear();
+        _count.store(0);
+    }
+
+    size_t size() const
+    {
+        return _count.load(std::memory_order_relaxed);
+    }
+
+protected:
+    std::mutex            _m;
+    std::vector<Waiter*>  _waiters;
+    std::atomic<size_t>   _count = 0;
+};
+
+}
+
+#endif
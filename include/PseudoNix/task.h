@@ -5,10 +5,60 @@
 #include <exception>
 #include <iostream>
 #include <utility>
+#include <new>
+#include <cstddef>
 
 namespace PseudoNix
 {
 
+/**
+ * @brief The FrameAllocator struct
+ *
+ * Interface used to allocate coroutine frames. When a coroutine is
+ * created, its frame is allocated from the current thread's allocator,
+ * or from the global heap if there isn't one. Use FrameAllocatorScope
+ * to set the allocator while calling a coroutine function.
+ *
+ * Frames remember which allocator they came from, so they can be
+ * freed on any thread. The allocator must be thread safe and must
+ * outlive every frame allocated from it.
+ */
+struct FrameAllocator
+{
+    virtual ~FrameAllocator()
+    {
+    }
+    virtual void* allocate(size_t n) = 0;
+    virtual void  deallocate(void * p, size_t n) = 0;
+
+    static FrameAllocator*& current()
+    {
+        static thread_local FrameAllocator * _current = nullptr;
+        return _current;
+    }
+};
+
+/**
+ * @brief The FrameAllocatorScope struct
+ *
+ * Sets the current thread's FrameAllocator until the
+ * scope is exited.
+ */
+struct FrameAllocatorScope
+{
+    explicit FrameAllocatorScope(FrameAllocator * a) : m_previous(std::exchange(FrameAllocator::current(), a))
+    {
+    }
+    ~FrameAllocatorScope()
+    {
+        FrameAllocator::current() = m_previous;
+    }
+    FrameAllocatorScope(FrameAllocatorScope const &) = delete;
+    FrameAllocatorScope& operator=(FrameAllocatorScope const &) = delete;
+protected:
+    FrameAllocator * m_previous = nullptr;
+};
+
 template<typename T>
 struct promise_value
 {
@@ -39,6 +89,30 @@ struct Task_t
         // must have a default consturctor
         promise_type() = default;
 
+        // The frame is prefixed with a header which stores the
+        // allocator it came from, so that it can be returned
+        // to the same allocator when it is destroyed
+        static constexpr size_t frame_header_size = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+        static void* operator new(size_t n)
+        {
+            auto a = FrameAllocator::current();
+            auto total = n + frame_header_size;
+            void * p = a ? a->allocate(total) : ::operator new(total);
+            *static_cast<FrameAllocator**>(p) = a;
+            return static_cast<std::byte*>(p) + frame_header_size;
+        }
+
+        static void operator delete(void * ptr, size_t n)
+        {
+            auto p = static_cast<std::byte*>(ptr) - frame_header_size;
+            auto a = *reinterpret_cast<FrameAllocator**>(p);
+            if(a)
+                a->deallocate(p, n + frame_header_size);
+            else
+                ::operator delete(p);
+        }
+
         // this is the first method to get
         // executed when a coroutine is
         // called for the first time
@@ -62,10 +136,32 @@ struct Task_t
             return {};
         }
 
+        // Called once the coroutine has suspended at its final
+        // suspend point. Another thread may destroy the frame as
+        // soon as it is called, so it must not touch the coroutine.
+        // Only called if final_suspend_t suspends.
+        void (*on_final_suspend)(void*) = nullptr;
+        void  *on_final_suspend_arg     = nullptr;
+
+        struct final_awaiter : final_suspend_t
+        {
+            promise_type * promise;
+
+            void await_suspend(std::coroutine_handle<promise_type>) noexcept
+            {
+                // this awaiter lives in the frame, so copy
+                // everything out before calling the hook
+                auto f   = promise->on_final_suspend;
+                auto arg = promise->on_final_suspend_arg;
+                if(f)
+                    f(arg);
+            }
+        };
+
         // executes when the coroutine finishes
         // executing.
-        final_suspend_t final_suspend() noexcept {
-            return {};
+        final_awaiter final_suspend() noexcept {
+            return {{}, this};
         }
 
         // if there are any exceptions thrown
@@ -78,6 +78,52 @@ SCENARIO("find_last_valid_virtual_node")
     REQUIRE(F.exists("/hello2") == FSResult::False);
 }
 
+SCENARIO("Resolved paths are cached")
+{
+    FileSystem F;
+    REQUIRE(F.mkdir("/bin") == FSResult::True);
+    REQUIRE(F.mkfile("/bin/ls") == FSResult::True);
+
+    REQUIRE(F.exists("/bin/ls") == FSResult::True);
+    REQUIRE(F.exists("/bin/../bin/ls/") == FSResult::True);
+    REQUIRE(F.dentry_cache().size() > 0);
+
+    THEN("Missing paths are not cached")
+    {
+        auto n = F.dentry_cache().size();
+        REQUIRE(F.exists("/bin/nothing") == FSResult::False);
+        REQUIRE(F.dentry_cache().size() == n);
+    }
+
+    THEN("Removing a file invalidates it")
+    {
+        REQUIRE(F.remove("/bin/ls") == FSResult::True);
+        REQUIRE(F.exists("/bin/ls") == FSResult::False);
+        REQUIRE(F.getType("/bin/ls") == NodeType::NoExist);
+    }
+
+    THEN("Moving a directory invalidates everything below it")
+    {
+        REQUIRE(F.mkdir("/usr") == FSResult::True);
+        REQUIRE(F.move("/bin", "/usr/bin") == FSResult::True);
+        REQUIRE(F.exists("/bin/ls") == FSResult::False);
+        REQUIRE(F.exists("/usr/bin/ls") == FSResult::True);
+    }
+
+    THEN("Mounting and unmounting invalidates the mount point")
+    {
+        REQUIRE(F.mkdir("/mnt") == FSResult::True);
+        REQUIRE(F.getType("/mnt") == NodeType::MemDir);
+        REQUIRE(F.mount<FSNodeHostMount>("/mnt", CMAKE_SOURCE_DIR) == FSResult::True);
+        REQUIRE(F.getType("/mnt") == NodeType::MountDir);
+        REQUIRE(F.exists("/mnt/README.md") == FSResult::True);
+
+        REQUIRE(F.unmount("/mnt") == FSResult::True);
+        REQUIRE(F.getType("/mnt") == NodeType::MemDir);
+        REQUIRE(F.exists("/mnt/README.md") == FSResult::False);
+    }
+}
+
 SCENARIO("Exists")
 {
     FileSystem F;
@@ -382,6 +428,79 @@ SCENARIO("Remove files/directories on host")
 }
 
 
+SCENARIO("Large host files are memory mapped when read")
+{
+    GIVEN("A host folder with a small and a large file")
+    {
+        std::filesystem::remove_all(CMAKE_BINARY_DIR "/mapped");
+        std::filesystem::create_directories(CMAKE_BINARY_DIR "/mapped");
+
+        std::string large;
+        for(size_t i=0; large.size() < 2*FSNodeHostMount::mmap_threshold; i++)
+            large += std::format("line {}\n", i);
+        {
+            std::ofstream out(CMAKE_BINARY_DIR "/mapped/large.txt", std::ios::binary);
+            out << large;
+            std::ofstream out2(CMAKE_BINARY_DIR "/mapped/small.txt", std::ios::binary);
+            out2 << "small";
+        }
+
+        FileSystem F;
+        REQUIRE(F.mkdir("/mapped") == FSResult::True);
+        REQUIRE(F.mount<FSNodeHostMount>("/mapped", CMAKE_BINARY_DIR "/mapped") == FSResult::True);
+
+        THEN("The whole large file can be accessed without reading it")
+        {
+            auto in = F.openRead("/mapped/large.txt");
+            auto data = in.data();
+            REQUIRE(std::string(data.begin(), data.end()) == large);
+
+            std::string line;
+            std::getline(in, line);
+            REQUIRE(line == "line 0");
+            REQUIRE(in.data().size() == large.size() - 7);
+
+            in.seekg(-7, std::ios::end);
+            std::getline(in, line);
+            REQUIRE(line == large.substr(large.size() - 7, 6));
+        }
+
+        THEN("Small files are read with a buffer")
+        {
+            auto in = F.openRead("/mapped/small.txt");
+            REQUIRE(in.data().empty());
+            std::string s;
+            in >> s;
+            REQUIRE(s == "small");
+        }
+
+        THEN("The large file can be copied into memory")
+        {
+            REQUIRE(F.copy("/mapped/large.txt", "/large.txt") == FSResult::True);
+            std::string s = F.fs("/large.txt");
+            REQUIRE(s == large);
+        }
+
+        THEN("cat and cp can read the large file")
+        {
+            System M;
+            REQUIRE(M.mkdir("/mapped") == FSResult::True);
+            REQUIRE(M.mount<FSNodeHostMount>("/mapped", CMAKE_BINARY_DIR "/mapped") == FSResult::True);
+
+            System::Exec E({"cat", "/mapped/large.txt"});
+            E.out = System::make_stream();
+            M.runRawCommand(E);
+            M.spawnProcess({"cp", "/mapped/large.txt", "/copy.txt"});
+            while(M.taskQueueExecute());
+
+            REQUIRE(E.out->str() == large);
+            std::string s = M.fs("/copy.txt");
+            REQUIRE(s == large);
+            M.destroy();
+        }
+    }
+}
+
 SCENARIO("Copying file from Mem->Mem")
 {
     GIVEN("A filesystem with some directories and files")
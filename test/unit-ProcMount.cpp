@@ -0,0 +1,123 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <PseudoNix/System.h>
+#include <PseudoNix/ProcMount.h>
+
+using namespace PseudoNix;
+
+static std::string read_file(System & M, System::path_type path)
+{
+    std::string s;
+    M.fs(path) >> s;
+    return s;
+}
+
+SCENARIO("ProcMount: Process state is visible in /proc")
+{
+    System M;
+    REQUIRE(mount_proc(M) == FSResult::True);
+
+    M.setFunction("waiter", [](System::e_type ctrl) -> System::task_type {
+        PSEUDONIX_PROC_START(ctrl);
+        HANDLE_AWAIT_INT_TERM(co_await ctrl->await_signal(), ctrl);
+        co_return 0;
+    });
+
+    auto pid = M.spawnProcess({"MYVAR=hello", "waiter", "arg1"});
+    auto dir = System::path_type("/proc") / std::to_string(pid);
+    M.taskQueueExecute();
+
+    THEN("The mount is read only")
+    {
+        REQUIRE(M.getType("/proc") == NodeType::MountDir);
+        REQUIRE(M.mkfile("/proc/file") != FSResult::True);
+        REQUIRE(M.mkdir("/proc/dir") != FSResult::True);
+    }
+
+    THEN("Each process has a directory")
+    {
+        REQUIRE(M.getType(dir) == NodeType::MountDir);
+        REQUIRE(M.getType(dir / "status") == NodeType::MountFile);
+        REQUIRE(M.getType(dir / "nothing") == NodeType::NoExist);
+        REQUIRE(M.getType("/proc/99999") == NodeType::NoExist);
+
+        std::vector<std::string> names;
+        for(auto p : M.list_dir("/proc"))
+            names.push_back(p.generic_string());
+        REQUIRE(std::find(names.begin(), names.end(), std::to_string(pid)) != names.end());
+        REQUIRE(std::find(names.begin(), names.end(), "stat") != names.end());
+        REQUIRE(std::find(names.begin(), names.end(), "queues") != names.end());
+    }
+
+    THEN("The files are generated when they are read")
+    {
+        REQUIRE(read_file(M, dir / "cmdline") == "waiter\narg1\n");
+        REQUIRE(read_file(M, dir / "environ").find("MYVAR=hello\n") != std::string::npos);
+        REQUIRE(read_file(M, dir / "exit_code") == "-1\n");
+
+        auto status = read_file(M, dir / "status");
+        REQUIRE(status.find(std::format("Pid: {}\n", pid)) != std::string::npos);
+        REQUIRE(status.find("State: parked\n") != std::string::npos);
+        REQUIRE(status.find("WaitingOn: signal\n") != std::string::npos);
+        REQUIRE(status.find("Resumes: 1\n") != std::string::npos);
+
+        REQUIRE(read_file(M, "/proc/stat").find("processes 1\n") != std::string::npos);
+        REQUIRE(read_file(M, "/proc/queues").find("MAIN ") != std::string::npos);
+    }
+
+    THEN("A process can read its own status with cat")
+    {
+        System::Exec E({"cat", (dir / "status").generic_string()});
+        E.out = System::make_stream();
+        M.runRawCommand(E);
+        while(M.taskQueueExecute() > 1);
+
+        REQUIRE(E.out->str().find("Name: waiter\n") != std::string::npos);
+    }
+
+    WHEN("The process exits")
+    {
+        M.interrupt(pid);
+        while(M.taskQueueExecute());
+
+        THEN("Its directory is removed")
+        {
+            REQUIRE(M.exists(dir) == FSResult::False);
+            REQUIRE(read_file(M, "/proc/stat").find("processes 0\n") != std::string::npos);
+        }
+    }
+
+    M.destroy();
+}
+
+SCENARIO("ProcMount: environ shows the variables a process set before it suspended")
+{
+    System M;
+    REQUIRE(mount_proc(M) == FSResult::True);
+
+    M.setFunction("setter", [](System::e_type ctrl) -> System::task_type {
+        PSEUDONIX_PROC_START(ctrl);
+        ENV["STEP"] = "one";
+        HANDLE_AWAIT_INT_TERM(co_await ctrl->await_yield(), ctrl);
+        ENV["STEP"] = "two";
+        HANDLE_AWAIT_INT_TERM(co_await ctrl->await_signal(), ctrl);
+        co_return 0;
+    });
+
+    auto pid = M.spawnProcess({"setter"});
+    auto environ_file = System::path_type("/proc") / std::to_string(pid) / "environ";
+
+    // published when the process is created
+    REQUIRE(read_file(M, environ_file).find("STEP=") == std::string::npos);
+
+    M.taskQueueExecute();
+    REQUIRE(read_file(M, environ_file).find("STEP=one\n") != std::string::npos);
+
+    M.taskQueueExecute();
+    REQUIRE(read_file(M, environ_file).find("STEP=two\n") != std::string::npos);
+
+    M.interrupt(pid);
+    while(M.taskQueueExecute());
+    M.destroy();
+}
@@ -27,6 +27,63 @@ SCENARIO("Test SplitVar")
     }
 }
 
+SCENARIO("Environment")
+{
+    Environment parent;
+    parent["PATH"] = "/bin";
+    parent["LOCAL"] = "local";
+    parent.set_exported("PATH");
+
+    REQUIRE(parent.count("PATH") == 1);
+    REQUIRE(parent.count("MISSING") == 0);
+
+    Environment child;
+    child["0"] = "sh";
+    child.inherit(parent);
+
+    THEN("The child only sees the exported variables")
+    {
+        REQUIRE(child.at("PATH") == "/bin");
+        REQUIRE(child.count("LOCAL") == 0);
+        REQUIRE(child.at("0") == "sh");
+        REQUIRE(child.size() == 2);
+    }
+
+    THEN("Children share the same snapshot until an exported variable changes")
+    {
+        auto S0 = parent.exported_snapshot();
+        REQUIRE(S0 == parent.exported_snapshot());
+
+        parent["LOCAL"] = "changed";
+        REQUIRE(S0 == parent.exported_snapshot());
+
+        parent["PATH"] = "/usr/bin";
+        REQUIRE(S0 != parent.exported_snapshot());
+
+        // the child keeps the value it was given
+        REQUIRE(child.at("PATH") == "/bin");
+    }
+
+    THEN("Writing to an inherited variable does not change the parent")
+    {
+        child["PATH"] += ":/usr/bin";
+        REQUIRE(child.at("PATH") == "/bin:/usr/bin");
+        REQUIRE(parent.at("PATH") == "/bin");
+    }
+
+    THEN("entries() visits every variable in order without copying the base")
+    {
+        auto S0 = parent.exported_snapshot();
+        auto uses = S0.use_count();
+
+        std::vector<std::string> names;
+        for(auto & [var, val] : child.entries())
+            names.emplace_back(var);
+        REQUIRE(names == std::vector<std::string>{"0", "PATH"});
+        REQUIRE(S0.use_count() == uses);
+    }
+}
+
 SCENARIO("Test parseArguments")
 {
     {
@@ -162,6 +219,31 @@ SCENARIO("runRawCommand")
     }
 }
 
+SCENARIO("runRawCommand: The pre-exec hook sees the positional variables")
+{
+    System S;
+
+    std::map<std::string, std::string> seen;
+    S.m_preExec = [&](System::Exec & E)
+    {
+        seen = E.env;
+        E.env["USER"] = "bob";
+    };
+
+    System::Exec exec({"echo", "hello"});
+    auto pid = S.runRawCommand(exec);
+    REQUIRE(seen.at("0") == "echo");
+    REQUIRE(seen.at("1") == "hello");
+    REQUIRE(S.getProcessControl(pid)->getenv("USER") == "bob");
+    REQUIRE(S.getProcessControl(pid)->getenv("1") == "hello");
+
+    seen.clear();
+    S.spawnBatch(System::Exec({"echo", "again"}), 2);
+    REQUIRE(seen.at("1") == "again");
+
+    while(S.taskQueueExecute());
+}
+
 SCENARIO("System: Run a single command manually read from input")
 {
     System M;
@@ -254,6 +336,841 @@ SCENARIO("System: Execute two commands and have one piped into the other")
     REQUIRE(exec[1].out->str() == "dlrow olleH\n");
 }
 
+SCENARIO("System: Pipeline using ring streams")
+{
+    System M;
+
+    auto E = System::genPipeline({
+        {"echo", "Hello world"},
+        {"rev"}
+    }, StreamBackend::RING);
+
+    REQUIRE(dynamic_cast<RingStream*>(E[0].out.get()) != nullptr);
+    REQUIRE(E[0].out == E[1].in);
+
+    auto pids = M.runPipeline(E);
+    REQUIRE(pids.size() == 2);
+
+    while (M.taskQueueExecute());
+
+    REQUIRE(E[1].out->str() == "dlrow olleH\n");
+}
+
+
+SCENARIO("System: Bounded streams apply backpressure to the producer")
+{
+    System M;
+
+    System::Exec E({"yes"});
+    E.out = System::make_stream("", StreamBackend::CHUNKED, 8);
+
+    auto pid = M.runRawCommand(E);
+
+    for(int i=0;i<100;i++)
+        M.taskQueueExecute();
+
+    // yes is waiting for room in the output
+    REQUIRE(M.isRunning(pid));
+    REQUIRE(E.out->size_approx() == 8);
+
+    std::array<char, 4> buffer;
+    REQUIRE(E.out->read(buffer) == 4);
+    REQUIRE(std::string_view(buffer.data(), 4) == "y\ny\n");
+
+    for(int i=0;i<100;i++)
+        M.taskQueueExecute();
+
+    REQUIRE(E.out->size_approx() == 8);
+
+    M.kill(pid);
+    M.taskQueueExecute();
+    REQUIRE(!M.isRunning(pid));
+
+    // A reader that only reads 2 lines
+    M.setFunction("head2", [](System::e_type control) -> System::task_type {
+        PSEUDONIX_PROC_START(control);
+        std::string line;
+        for(int i=0;i<2;i++)
+        {
+            if(AwaiterResult::SUCCESS != co_await control->await_read_line(control->in, line))
+                break;
+            COUT << line << '\n';
+            line.clear();
+        }
+        co_return 0;
+    });
+
+    // Once the reader exits, no one is reading
+    // the output of yes, so it should exit too
+    auto pids = M.runPipeline(System::genPipeline({{"yes"}, {"head2"}}, StreamBackend::CHUNKED, 8));
+    while(M.taskQueueExecute());
+    REQUIRE(!M.isRunning(pids[0]));
+    REQUIRE(!M.isRunning(pids[1]));
+}
+
+
+SCENARIO("System: Task queue run by a pool of worker threads")
+{
+    System M;
+    M.taskQueueCreate("THREADPOOL");
+
+    static std::atomic<size_t> count = 0;
+    count = 0;
+
+    // hop onto the thread pool, do some work
+    // and then hop back onto the main queue
+    M.setFunction("work", [](System::e_type control) -> System::task_type {
+        PSEUDONIX_PROC_START(control);
+
+        for(int i=0;i<10;i++)
+        {
+            HANDLE_AWAIT_INT_TERM(co_await control->await_yield("THREADPOOL"), control);
+            if(control->queue_name == "THREADPOOL")
+                count++;
+        }
+        HANDLE_AWAIT_INT_TERM(co_await control->await_yield("MAIN"), control);
+        REQUIRE(control->queue_name == "MAIN");
+        co_return 0;
+    });
+
+    auto bg = M.spawnProcess({"bgrunner", "THREADPOOL", "2"});
+    M.taskQueueExecute();
+
+    REQUIRE(M.isRunning(bg));
+    REQUIRE(M.taskQueueHasExecutor("THREADPOOL"));
+    REQUIRE(M.taskQueueExecutorStats("THREADPOOL").size() == 2);
+
+    // only one executor per queue
+    REQUIRE(!M.taskQueueStartExecutor("THREADPOOL", 1));
+    REQUIRE(!M.taskQueueStartExecutor(System::DEFAULT_QUEUE, 1));
+
+    std::vector<System::pid_type> pids;
+    for(int i=0;i<8;i++)
+        pids.push_back(M.spawnProcess({"work"}));
+
+    auto T0 = std::chrono::steady_clock::now();
+    while(std::chrono::steady_clock::now() - T0 < std::chrono::seconds(10))
+    {
+        M.taskQueueExecute();
+        if(std::none_of(pids.begin(), pids.end(), [&](auto p){ return M.isRunning(p);}))
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    for(auto p : pids)
+        REQUIRE(!M.isRunning(p));
+    REQUIRE(count == 80);
+
+    size_t resumes = 0;
+    for(auto & w : M.taskQueueExecutorStats("THREADPOOL"))
+    {
+        resumes += w.resumes;
+        REQUIRE(w.utilization() >= 0.0);
+        REQUIRE(w.utilization() <= 1.0);
+    }
+    REQUIRE(resumes >= 80);
+
+    WHEN("The bgrunner is interrupted")
+    {
+        M.interrupt(bg);
+        M.taskQueueExecute();
+        M.taskQueueExecute();
+
+        THEN("The worker threads are stopped")
+        {
+            REQUIRE(!M.isRunning(bg));
+            REQUIRE(!M.taskQueueHasExecutor("THREADPOOL"));
+            REQUIRE(M.taskQueueExecutorStats("THREADPOOL").empty());
+        }
+    }
+}
+
+SCENARIO("System: Task queues are referred to by id")
+{
+    System M;
+    auto id = M.taskQueueCreate("OTHER");
+
+    REQUIRE(M.taskQueueId(System::DEFAULT_QUEUE) == System::DEFAULT_QUEUE_ID);
+    REQUIRE(M.taskQueueId("OTHER") == id);
+    REQUIRE(M.taskQueueCreate("OTHER") == id);
+    REQUIRE(M.taskQueueName(id) == "OTHER");
+    REQUIRE(M.taskQueueId("NOTHING") == System::invalid_queue_id);
+
+    static System::queue_id_type other = System::invalid_queue_id;
+    other = id;
+    M.setFunction("hop", [](System::e_type control) -> System::task_type {
+        PSEUDONIX_PROC_START(control);
+        HANDLE_AWAIT_INT_TERM(co_await control->await_yield(other), control);
+        HANDLE_AWAIT_INT_TERM(co_await control->await_yield(other), control);
+        co_return 0;
+    });
+
+    auto pid = M.spawnProcess({"hop"});
+    M.taskQueueExecute();
+    REQUIRE(M.taskQueueSize(id) == 1);
+
+    WHEN("The queue is executed by id")
+    {
+        M.taskQueueExecute(id);
+        REQUIRE(M.processStats(pid).queue == "OTHER");
+        REQUIRE(M.taskQueueSize(id) == 1);
+    }
+
+    WHEN("The queue is removed")
+    {
+        REQUIRE(!M.taskQueueRemove(System::DEFAULT_QUEUE));
+        REQUIRE(M.taskQueueRemove("OTHER"));
+
+        THEN("Its tasks are moved to the default queue")
+        {
+            REQUIRE(!M.taskQueueExists("OTHER"));
+            while(M.taskQueueExecute());
+            REQUIRE(!M.isRunning(pid));
+        }
+
+        THEN("Creating it again gives back the same id")
+        {
+            REQUIRE(M.taskQueueCreate("OTHER") == id);
+            REQUIRE(M.taskQueueExists("OTHER"));
+        }
+    }
+    M.destroy();
+}
+
+SCENARIO("System: Spawning a batch of processes")
+{
+    System M;
+
+    M.setFunction("child", [](System::e_type ctrl) -> System::task_type {
+        PSEUDONIX_PROC_START(ctrl);
+        COUT << std::format("{} {} {}\n", ARGS[1], ctrl->getenv("VAR"), ctrl->getenv("PWD"));
+        ctrl->env["VAR"] = "changed";
+        co_return 0;
+    });
+
+    auto out = System::make_stream();
+    System::Exec E({"child", "arg"}, {{"VAR", "value"}});
+    E.out = out;
+
+    auto pids = M.spawnBatch(E, 100);
+
+    THEN("Each process gets its own pid")
+    {
+        REQUIRE(pids.size() == 100);
+        for(size_t i=1;i<pids.size();i++)
+            REQUIRE(pids[i] == pids[0] + i);
+        REQUIRE(M.process_count() == 100);
+    }
+
+    WHEN("The processes are executed")
+    {
+        while(M.taskQueueExecute());
+
+        THEN("They all ran with the same arguments and environment")
+        {
+            std::string expected;
+            for(size_t i=0;i<100;i++)
+                expected += "arg value /\n";
+            REQUIRE(out->str() == expected);
+            REQUIRE(M.process_count() == 0);
+        }
+    }
+
+    THEN("Spawning an unknown function does nothing")
+    {
+        REQUIRE(M.spawnBatch(System::Exec({"nothing"}), 10).empty());
+    }
+
+    THEN("The spawn function uses a batch")
+    {
+        while(M.taskQueueExecute());
+
+        System::Exec S({"spawn", "5", "echo", "hello"});
+        S.out = System::make_stream();
+        M.runRawCommand(S);
+        while(M.taskQueueExecute());
+
+        REQUIRE(S.out->str() == "hello\nhello\nhello\nhello\nhello\n");
+    }
+    M.destroy();
+}
+
+SCENARIO("System: Processes are reaped when they complete or are killed")
+{
+    System M;
+    M.taskQueueCreate("OTHER");
+
+    M.setFunction("waiter", [](System::e_type ctrl) -> System::task_type {
+        PSEUDONIX_PROC_START(ctrl);
+        HANDLE_AWAIT_INT_TERM(co_await ctrl->await_signal(), ctrl);
+        co_return 0;
+    });
+    M.setFunction("other", [](System::e_type ctrl) -> System::task_type {
+        PSEUDONIX_PROC_START(ctrl);
+        HANDLE_AWAIT_INT_TERM(co_await ctrl->await_yield("OTHER"), ctrl);
+        co_return 7;
+    });
+
+    auto pids = M.spawnBatch(System::Exec({"waiter"}), 100);
+    M.taskQueueExecute();
+    REQUIRE(M.process_count() == 100);
+
+    WHEN("A parked process is killed")
+    {
+        M.kill(pids[50]);
+        M.taskQueueExecute();
+
+        THEN("Only that process is removed")
+        {
+            REQUIRE(!M.processExists(pids[50]));
+            REQUIRE(M.process_count() == 99);
+        }
+    }
+
+    WHEN("A process completes on another queue")
+    {
+        auto pid = M.spawnProcess({"other"});
+        auto exit_code = M.getProcessExitCode(pid);
+        M.taskQueueExecute();
+        M.taskQueueExecute("OTHER");
+        REQUIRE(M.processExists(pid));
+
+        THEN("It is removed the next time the DEFAULT_QUEUE is executed")
+        {
+            M.taskQueueExecute();
+            REQUIRE(!M.processExists(pid));
+            REQUIRE(*exit_code == 7);
+            REQUIRE(M.process_count() == 100);
+        }
+    }
+    M.destroy();
+}
+
+SCENARIO("System: Spawning and reaping processes from multiple threads")
+{
+    System M;
+
+    std::atomic<bool> done = false;
+
+    // keep replacing a function while the
+    // other threads are spawning processes
+    std::thread registry([&]()
+    {
+        size_t i=0;
+        while(!done)
+        {
+            M.setFunction(std::format("func_{}", i++ % 16), [](System::e_type control) -> System::task_type {
+                (void)control;
+                co_return 0;
+            });
+        }
+    });
+
+    std::vector<std::thread> spawners;
+    std::atomic<size_t> spawned = 0;
+    for(int t=0;t<4;t++)
+    {
+        spawners.emplace_back([&]()
+        {
+            for(int i=0;i<250;i++)
+            {
+                if(M.spawnProcess({"true"}) != invalid_pid)
+                    spawned++;
+            }
+        });
+    }
+
+    // reap the processes on the main thread
+    // while they are being spawned
+    while(spawned < 1000)
+    {
+        M.taskQueueExecute();
+    }
+    for(auto & t : spawners)
+        t.join();
+    done = true;
+    registry.join();
+
+    while(M.taskQueueExecute());
+
+    REQUIRE(spawned == 1000);
+    REQUIRE(M.process_count() == 0);
+    REQUIRE(M.functions()->count("func_0") == 1);
+}
+
+SCENARIO("System: Signalling a parent while its children are spawned and reaped on other threads")
+{
+    System M;
+
+    auto parent = M.spawnProcess({"sleep", "100"});
+    M.taskQueueExecute();
+
+    // the default signal handler passes the signal on
+    // to the children. 10 is not a signal the awaiters
+    // react to, so nothing is interrupted
+    std::atomic<bool> done = false;
+    std::thread signaller([&]()
+    {
+        while(!done)
+        {
+            M.signal(parent, 10);
+        }
+    });
+
+    std::vector<std::thread> spawners;
+    std::atomic<size_t> spawned = 0;
+    for(int t=0;t<4;t++)
+    {
+        spawners.emplace_back([&]()
+        {
+            for(int i=0;i<250;i++)
+            {
+                if(M.runRawCommand(System::Exec({"true"}), parent) != invalid_pid)
+                    spawned++;
+            }
+        });
+    }
+
+    while(spawned < 1000)
+    {
+        M.taskQueueExecute();
+    }
+    for(auto & t : spawners)
+        t.join();
+    done = true;
+    signaller.join();
+
+    M.kill(parent);
+    while(M.taskQueueExecute());
+
+    REQUIRE(spawned == 1000);
+    REQUIRE(M.process_count() == 0);
+}
+
+SCENARIO("System: Replacing the signal handler while the process is being signalled")
+{
+    System M;
+    M.taskQueueCreate("THREADPOOL");
+
+    static std::atomic<size_t> handled = 0;
+    handled = 0;
+
+    // keeps replacing its signal handler on a worker thread
+    M.setFunction("handler", [](System::e_type control) -> System::task_type {
+        PSEUDONIX_PROC_START(control);
+        HANDLE_AWAIT_INT_TERM(co_await control->await_yield("THREADPOOL"), control);
+        for(int i=0;i<2000;i++)
+        {
+            control->setSignalHandler([name = std::format("handler {} with a long name", i)](int)
+            {
+                if(!name.empty())
+                    handled++;
+            });
+            HANDLE_AWAIT_INT_TERM(co_await control->await_yield(), control);
+        }
+        co_return 0;
+    });
+
+    auto bg = M.spawnProcess({"bgrunner", "THREADPOOL", "2"});
+    M.taskQueueExecute();
+
+    auto pid = M.spawnProcess({"handler"});
+    size_t sent = 0;
+    while(M.isRunning(pid))
+    {
+        // 10 is not a signal the awaiters react to
+        if(M.signal(pid, 10))
+            sent++;
+        M.taskQueueExecute();
+    }
+    M.interrupt(bg);
+    while(M.taskQueueExecute());
+
+    REQUIRE(sent > 0);
+    REQUIRE(handled <= sent);
+}
+
+SCENARIO("System: Killing processes while they spin on worker threads")
+{
+    System M;
+    M.taskQueueCreate("THREADPOOL");
+
+    // keeps a worker busy and only yields at the
+    // end of its time slice
+    M.setFunction("spin", [](System::e_type control) -> System::task_type {
+        PSEUDONIX_PROC_START(control);
+        HANDLE_AWAIT_INT_TERM(co_await control->await_yield("THREADPOOL"), control);
+        std::string work;
+        while(true)
+        {
+            work += 'x';
+            if(work.size() > 1000)
+                work.clear();
+            if(control->should_yield())
+                HANDLE_AWAIT_INT_TERM(co_await control->await_yield(), control);
+        }
+        co_return 0;
+    });
+
+    auto bg = M.spawnProcess({"bgrunner", "THREADPOOL", "4"});
+    M.taskQueueExecute();
+
+    for(int round=0; round<10; round++)
+    {
+        std::vector<System::pid_type> pids;
+        std::vector<std::shared_ptr<System::exit_code_type>> codes;
+        for(int i=0;i<16;i++)
+        {
+            pids.push_back(M.spawnProcess({"spin"}));
+            codes.push_back(M.getProcessExitCode(pids.back()));
+        }
+
+        // let them hop onto the workers
+        auto T0 = std::chrono::steady_clock::now();
+        while(std::chrono::steady_clock::now() - T0 < std::chrono::milliseconds(5))
+            M.taskQueueExecute();
+
+        for(auto p : pids)
+            REQUIRE(M.kill(p));
+
+        T0 = std::chrono::steady_clock::now();
+        while(std::chrono::steady_clock::now() - T0 < std::chrono::seconds(10))
+        {
+            M.taskQueueExecute();
+            if(std::none_of(pids.begin(), pids.end(), [&](auto p){ return M.isRunning(p); }))
+                break;
+        }
+
+        for(size_t i=0;i<pids.size();i++)
+        {
+            REQUIRE(!M.isRunning(pids[i]));
+            REQUIRE(*codes[i] == -1);
+        }
+    }
+
+    M.interrupt(bg);
+    while(M.taskQueueExecute());
+    REQUIRE(M.process_count() == 0);
+}
+
+SCENARIO("System: Process frames and records are reused from the pool")
+{
+    System M;
+
+    auto run = [&](size_t count)
+    {
+        for(size_t i=0;i<count;i++)
+            M.spawnProcess({"true"});
+        while(M.taskQueueExecute());
+    };
+
+    // warm up the pool
+    run(100);
+    auto S0 = M.allocatorStats();
+
+    REQUIRE(S0.allocations > 0);
+    REQUIRE(S0.slabs > 0);
+
+    // the pool only has to grow to hold the peak
+    // number of processes
+    for(int i=0;i<10;i++)
+        run(100);
+    auto S1 = M.allocatorStats();
+
+    THEN("Spawning more processes does not grow the pool")
+    {
+        REQUIRE(S1.allocations > S0.allocations);
+        REQUIRE(S1.slabs == S0.slabs);
+        REQUIRE(S1.heap_allocations == S0.heap_allocations);
+        REQUIRE(S1.in_use() == S0.in_use());
+    }
+}
+
+SCENARIO("System: Per-process scheduler statistics")
+{
+    System M;
+
+    M.setFunction("spin", [](System::e_type ctrl) -> System::task_type {
+        PSEUDONIX_PROC_START(ctrl);
+        for(int i=0;i<5;i++)
+        {
+            auto T0 = std::chrono::steady_clock::now();
+            while(std::chrono::steady_clock::now() - T0 < std::chrono::milliseconds(1));
+            HANDLE_AWAIT_INT_TERM(co_await ctrl->await_yield(), ctrl);
+        }
+        HANDLE_AWAIT_INT_TERM(co_await ctrl->await_signal(), ctrl);
+        co_return 0;
+    });
+
+    auto pid = M.spawnProcess({"spin"});
+    REQUIRE(M.processStats(pid).waiting_on == AwaiterKind::START);
+
+    for(int i=0;i<20;i++)
+        M.taskQueueExecute();
+
+    WHEN("The process is waiting on a signal")
+    {
+        auto S = M.processStats(pid);
+
+        REQUIRE(S.pid == pid);
+        REQUIRE(S.args == std::vector<std::string>{"spin"});
+        REQUIRE(S.queue == System::DEFAULT_QUEUE);
+        REQUIRE(S.waiting_on == AwaiterKind::SIGNAL);
+        REQUIRE(S.parked);
+
+        THEN("Every resume has been accounted for")
+        {
+            REQUIRE(S.resumes == 6);
+            REQUIRE(S.cpu_time >= std::chrono::milliseconds(5));
+            REQUIRE(S.max_resume >= std::chrono::milliseconds(1));
+            REQUIRE(S.max_resume <= S.cpu_time);
+        }
+
+        THEN("The system totals include the process")
+        {
+            auto T = M.stats();
+            REQUIRE(T.processes.size() == 1);
+            REQUIRE(T.processes[0].pid == pid);
+            REQUIRE(T.resumes == S.resumes);
+            REQUIRE(T.cpu_time == S.cpu_time);
+        }
+
+        THEN("ps -l lists the process")
+        {
+            System::Exec E({"ps", "-l"});
+            E.out = System::make_stream();
+            M.runRawCommand(E);
+            while(M.taskQueueExecute() > 1);
+
+            auto out = E.out->str();
+            REQUIRE(out.find("RESUMES") != std::string::npos);
+            REQUIRE(out.find("signal") != std::string::npos);
+        }
+    }
+
+    M.kill(pid);
+    while(M.taskQueueExecute());
+}
+
+SCENARIO("System: Busy processes are moved to lower priority levels")
+{
+    System M;
+    M.setSchedulerConfig({std::chrono::milliseconds(2), std::chrono::hours(1)});
+
+    // spins for 1ms between each yield
+    M.setFunction("busy", [](System::e_type ctrl) -> System::task_type {
+        PSEUDONIX_PROC_START(ctrl);
+        while(true)
+        {
+            auto T0 = std::chrono::steady_clock::now();
+            while(std::chrono::steady_clock::now() - T0 < std::chrono::milliseconds(1));
+            HANDLE_AWAIT_INT_TERM(co_await ctrl->await_yield(), ctrl);
+        }
+        co_return 0;
+    });
+    M.setFunction("light", [](System::e_type ctrl) -> System::task_type {
+        PSEUDONIX_PROC_START(ctrl);
+        while(true)
+        {
+            HANDLE_AWAIT_INT_TERM(co_await ctrl->await_yield(), ctrl);
+        }
+        co_return 0;
+    });
+
+    auto busy  = M.spawnProcess({"busy"});
+    auto light = M.spawnProcess({"light"});
+
+    for(int i=0;i<10;i++)
+        M.taskQueueExecute();
+
+    THEN("The busy process sinks to the lowest level")
+    {
+        REQUIRE(M.processStats(busy).level == System::priority_levels-1);
+        REQUIRE(M.processStats(light).level == 0);
+    }
+
+    WHEN("There is no time left in the budget")
+    {
+        auto b0 = M.processStats(busy).resumes;
+        auto l0 = M.processStats(light).resumes;
+        for(int i=0;i<10;i++)
+            M.taskQueueExecute(System::DEFAULT_QUEUE, std::chrono::milliseconds(0));
+
+        THEN("Only the top level is run")
+        {
+            REQUIRE(M.processStats(busy).resumes == b0);
+            REQUIRE(M.processStats(light).resumes == l0 + 10);
+        }
+
+        THEN("The busy process runs again once there is time")
+        {
+            M.taskQueueExecute();
+            M.taskQueueExecute();
+            REQUIRE(M.processStats(busy).resumes > b0);
+        }
+    }
+
+    WHEN("The priorities are boosted")
+    {
+        M.setSchedulerConfig({std::chrono::hours(1), std::chrono::nanoseconds(0)});
+        M.taskQueueExecute();
+        M.taskQueueExecute();
+
+        THEN("The busy process is moved back to the top level")
+        {
+            REQUIRE(M.processStats(busy).level == 0);
+        }
+    }
+
+    WHEN("The light process is given the highest nice value")
+    {
+        REQUIRE(M.setNice(light, 100));
+        REQUIRE(M.getNice(light) == 19);
+        REQUIRE(M.processStats(light).nice == 19);
+    }
+
+    M.kill(busy);
+    M.kill(light);
+    while(M.taskQueueExecute());
+}
+
+SCENARIO("System: taskQueueExecute keeps to its time budget")
+{
+    System M;
+    M.setFunction("light", [](System::e_type ctrl) -> System::task_type {
+        PSEUDONIX_PROC_START(ctrl);
+        while(true)
+        {
+            HANDLE_AWAIT_INT_TERM(co_await ctrl->await_yield(), ctrl);
+        }
+        co_return 0;
+    });
+
+    std::vector<System::pid_type> pids;
+    for(int i=0;i<5;i++)
+        pids.push_back(M.spawnProcess({"light"}));
+
+    WHEN("There is no time in the budget")
+    {
+        // a single process is resumed on each call
+        for(int i=0;i<3;i++)
+            M.taskQueueExecute(System::DEFAULT_QUEUE, std::chrono::milliseconds(0));
+
+        THEN("The processes which did not run are kept in order")
+        {
+            REQUIRE(M.taskQueueSize(System::DEFAULT_QUEUE) == 5);
+            for(size_t i=0;i<5;i++)
+                REQUIRE(M.processStats(pids[i]).resumes == (i < 3 ? 1u : 0u));
+
+            M.taskQueueExecute(System::DEFAULT_QUEUE, std::chrono::milliseconds(0));
+            M.taskQueueExecute(System::DEFAULT_QUEUE, std::chrono::milliseconds(0));
+            for(auto p : pids)
+                REQUIRE(M.processStats(p).resumes == 1);
+        }
+
+        THEN("They all run once there is time")
+        {
+            M.taskQueueExecute();
+            for(size_t i=0;i<5;i++)
+                REQUIRE(M.processStats(pids[i]).resumes == (i < 3 ? 2u : 1u));
+        }
+    }
+
+    for(auto p : pids)
+        M.kill(p);
+    while(M.taskQueueExecute());
+}
+
+SCENARIO("System: Built-ins yield when their time slice is used up")
+{
+    System M;
+    auto config = M.schedulerConfig();
+    config.time_slice = std::chrono::nanoseconds(0);
+    M.setSchedulerConfig(config);
+
+    M.setFunction("check_yield", [](System::e_type ctrl) -> System::task_type {
+        PSEUDONIX_PROC_START(ctrl);
+        COUT << std::format("{}\n", ctrl->should_yield());
+        co_return 0;
+    });
+
+    THEN("should_yield is true straight away")
+    {
+        System::Exec E({"check_yield"});
+        E.out = System::make_stream();
+        M.runRawCommand(E);
+        while(M.taskQueueExecute());
+        REQUIRE(E.out->str() == "true\n");
+    }
+
+    THEN("cp copies large files over several resumes")
+    {
+        std::string data(200*1024, 'x');
+        REQUIRE(M.mkfile("/src.txt") == FSResult::True);
+        M.fs("/src.txt") << data;
+
+        M.spawnProcess({"cp", "/src.txt", "/dst.txt"});
+        while(M.taskQueueExecute());
+
+        std::string out;
+        M.fs("/dst.txt") >> out;
+        REQUIRE(out == data);
+    }
+
+    THEN("ls -R lists each directory")
+    {
+        REQUIRE(M.mkdir("/a") == FSResult::True);
+        REQUIRE(M.mkdir("/a/b") == FSResult::True);
+        REQUIRE(M.mkfile("/a/b/file") == FSResult::True);
+        REQUIRE(M.mkfile("/a/top") == FSResult::True);
+
+        System::Exec E({"ls", "-R", "/a"});
+        E.out = System::make_stream();
+        M.runRawCommand(E);
+        while(M.taskQueueExecute());
+
+        auto s = E.out->str();
+        REQUIRE(s.find("/a:\n") == 0);
+        REQUIRE(s.find("\n/a/b:\nfile\n") != std::string::npos);
+    }
+}
+
+SCENARIO("System: nice runs a command with a higher nice value")
+{
+    System M;
+
+    System::Exec E({"nice", "-n", "5", "nice"});
+    E.out = System::make_stream();
+    auto pid = M.runRawCommand(E);
+    REQUIRE(M.setNice(pid, 2));
+
+    while(M.taskQueueExecute());
+
+    // the inner nice prints its own value
+    REQUIRE(E.out->str() == "7\n");
+}
+
+SCENARIO("System: The nice value and working directory are set before a process is queued")
+{
+    System M;
+
+    System::Exec E({"sleep", "10"});
+    E.nice = 4;
+    auto pid = M.runRawCommand(E);
+
+    // nothing has been executed yet
+    REQUIRE(M.processStats(pid).nice == 4);
+    REQUIRE(M.getProcessControl(pid)->getenv("PWD") == "/");
+
+    auto pids = M.spawnBatch(E, 2);
+    for(auto p : pids)
+        REQUIRE(M.processStats(p).nice == 4);
+
+    M.kill(pid);
+    for(auto p : pids)
+        M.kill(p);
+    while(M.taskQueueExecute());
+}
 
 SCENARIO("Test await_yield")
 {
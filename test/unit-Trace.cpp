@@ -0,0 +1,141 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#ifndef PSEUDONIX_ENABLE_TRACE
+#define PSEUDONIX_ENABLE_TRACE
+#endif
+#include <PseudoNix/System.h>
+
+using namespace PseudoNix;
+
+static size_t count_events(std::vector<std::pair<uint32_t, TraceRecord>> const & E, TraceEvent e, uint32_t pid)
+{
+    return static_cast<size_t>(std::count_if(E.begin(), E.end(), [&](auto & r){ return r.second.event == e && r.second.pid == pid; }));
+}
+
+SCENARIO("Trace: Scheduler events are recorded")
+{
+    System M;
+    M.setFunction("waiter", [](System::e_type ctrl) -> System::task_type {
+        PSEUDONIX_PROC_START(ctrl);
+        HANDLE_AWAIT_INT_TERM(co_await ctrl->await_signal(), ctrl);
+        co_return 0;
+    });
+
+    WHEN("The tracer has not been started")
+    {
+        auto pid = M.spawnProcess({"waiter"});
+        M.taskQueueExecute();
+        M.interrupt(pid);
+        while(M.taskQueueExecute());
+
+        THEN("Nothing is recorded")
+        {
+            REQUIRE(M.tracer().events().empty());
+        }
+    }
+
+    WHEN("The tracer is started")
+    {
+        M.tracer().start();
+        auto pid = M.spawnProcess({"waiter"});
+        M.taskQueueExecute();
+        M.interrupt(pid);
+        while(M.taskQueueExecute());
+        M.tracer().stop();
+
+        auto E = M.tracer().events();
+
+        THEN("The life of the process is recorded in order")
+        {
+            REQUIRE(count_events(E, TraceEvent::SPAWN, pid) == 1);
+            REQUIRE(count_events(E, TraceEvent::PARK, pid) == 1);
+            REQUIRE(count_events(E, TraceEvent::SIGNAL, pid) == 1);
+            REQUIRE(count_events(E, TraceEvent::REAP, pid) == 1);
+            REQUIRE(count_events(E, TraceEvent::RESUME_BEGIN, pid) == 2);
+            REQUIRE(count_events(E, TraceEvent::RESUME_END, pid) == 2);
+
+            std::vector<TraceEvent> order;
+            for(auto & [t, r] : E)
+                if(r.pid == pid)
+                    order.push_back(r.event);
+            REQUIRE(!order.empty());
+            REQUIRE(order.front() == TraceEvent::SPAWN);
+            REQUIRE(order.back() == TraceEvent::REAP);
+
+            // the process name is stored once by the tracer
+            for(auto & [t, r] : E)
+                if(r.pid == pid && r.event == TraceEvent::SPAWN)
+                    REQUIRE(r.label == M.tracer().label(std::string("waiter")));
+        }
+
+        THEN("The events can be written as Chrome trace JSON")
+        {
+            std::ostringstream out;
+            M.tracer().write_chrome_json(out);
+            auto s = out.str();
+            REQUIRE(s.find("{\"traceEvents\":[") == 0);
+            REQUIRE(s.find("\"name\":\"waiter\",\"cat\":\"resume\",\"ph\":\"B\"") != std::string::npos);
+            REQUIRE(s.find("\"on\":\"signal\"") != std::string::npos);
+        }
+    }
+
+    WHEN("The trace command is used")
+    {
+        M.spawnProcess({"trace", "start"});
+        M.taskQueueExecute();
+        auto pid = M.spawnProcess({"waiter"});
+        M.taskQueueExecute();
+        M.spawnProcess({"trace", "dump", "/trace.json"});
+        while(M.taskQueueExecute() > 1);
+
+        THEN("The trace is written to the file")
+        {
+            REQUIRE(!M.tracer().is_enabled());
+            std::string s;
+            M.fs("/trace.json") >> s;
+            REQUIRE(s.find("\"name\":\"waiter\"") != std::string::npos);
+        }
+        M.interrupt(pid);
+        while(M.taskQueueExecute());
+    }
+}
+
+SCENARIO("Trace: Events can be read while other threads are recording")
+{
+    Tracer T;
+    T.start();
+
+    std::atomic<bool> done = false;
+    std::vector<std::thread> writers;
+    for(uint32_t t=0; t<2; t++)
+    {
+        writers.emplace_back([&, t]()
+        {
+            // wrap around the buffer so that slots
+            // are overwritten while they are read
+            for(uint64_t i=0; !done || i < Tracer::buffer_size * 2; i++)
+                T.record(TraceEvent::RESUME_BEGIN, t, static_cast<int64_t>(i));
+        });
+    }
+
+    // every event read from a thread's buffer
+    // must be one that thread wrote
+    bool valid = true;
+    std::map<uint32_t, uint32_t> writerOf;
+    for(int i=0; i<20; i++)
+    {
+        for(auto & [t, r] : T.events())
+        {
+            auto it = writerOf.emplace(t, r.pid).first;
+            valid &= it->second == r.pid && r.event == TraceEvent::RESUME_BEGIN;
+        }
+    }
+    done = true;
+    for(auto & w : writers)
+        w.join();
+    T.stop();
+
+    REQUIRE(valid);
+    REQUIRE(T.events().size() == 2 * Tracer::buffer_size);
+}
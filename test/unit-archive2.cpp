@@ -103,9 +103,9 @@ SCENARIO("Uncompress")
     std::vector<uint8_t> randomData(1024);
 
     auto p = std::make_shared<ArchiveMount>(randomData.data(), randomData.size());
-    for(auto d : p->_files)
+    for(auto d : p->list_dir("."))
     {
-        std::cout << d.first << std::endl;
+        std::cout << d << std::endl;
     }
     std::cout << "---" << std::endl;
 }
@@ -212,3 +212,258 @@ SCENARIO("Mounting From Memory")
         }
     }
 }
+
+// Write a tar (or tar.gz) with files large enough for the
+// gzip index to need more than one checkpoint
+static std::vector<uint8_t> make_archive(std::map<std::string, std::string> const & files, bool gzip)
+{
+    std::vector<uint8_t> out(16u * 1024u * 1024u);
+    size_t used = 0;
+
+    auto a = archive_write_new();
+    archive_write_set_format_pax_restricted(a);
+    if(gzip)
+        archive_write_add_filter_gzip(a);
+    archive_write_open_memory(a, out.data(), out.size(), &used);
+    for(auto & [name, data] : files)
+    {
+        auto e = archive_entry_new();
+        archive_entry_set_pathname(e, name.c_str());
+        archive_entry_set_filetype(e, AE_IFREG);
+        archive_entry_set_perm(e, 0644);
+        archive_entry_set_size(e, static_cast<la_int64_t>(data.size()));
+        archive_write_header(a, e);
+        archive_write_data(a, data.data(), data.size());
+        archive_entry_free(e);
+    }
+    archive_write_close(a);
+    archive_write_free(a);
+    out.resize(used);
+    return out;
+}
+
+SCENARIO("Archive entries are read at their offset")
+{
+    // text which does not compress too well, so that
+    // the compressed archive has many deflate blocks
+    std::map<std::string, std::string> files;
+    uint32_t seed = 1;
+    for(int i=0; i<24; i++)
+    {
+        std::string data;
+        auto size = 100000u + static_cast<uint32_t>(i) * 7919u;
+        while(data.size() < size)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            data += static_cast<char>('a' + (seed >> 24) % 26);
+            if((seed >> 8) % 7 == 0)
+                data += ' ';
+        }
+        files[std::format("dir{}/file{}.txt", i % 3, i)] = data;
+    }
+
+    for(bool gzip : {false, true})
+    {
+        auto archive = make_archive(files, gzip);
+        auto path    = std::string(CMAKE_BINARY_DIR) + (gzip ? "/large.tar.gz" : "/large.tar");
+        writeVectorToFile(archive, path);
+
+        WHEN(std::format("Mounting {} from memory and from a file", gzip ? "a tar.gz" : "a tar"))
+        {
+            THEN("The archive is indexed")
+            {
+                auto mem  = std::make_shared<ArchiveMount>(archive.data(), archive.size());
+                auto host = std::make_shared<ArchiveMount>(std::filesystem::path(path));
+                for(auto & m : {mem, host})
+                {
+                    REQUIRE(m->_index);
+                    REQUIRE(m->_index->is_gzip == gzip);
+                    if(gzip)
+                        REQUIRE(m->_index->checkpoints.size() > 1);
+                }
+            }
+
+            THEN("Every file can be read in any order")
+            {
+                FileSystem F;
+                REQUIRE(F.mkdir("/mem") == FSResult::True);
+                REQUIRE(F.mkdir("/host") == FSResult::True);
+                REQUIRE(F.mount<ArchiveMount>("/mem", archive.data(), archive.size()) == FSResult::True);
+                REQUIRE(F.mount<ArchiveMount>("/host", std::filesystem::path(path)) == FSResult::True);
+
+                for(auto it = files.rbegin(); it != files.rend(); ++it)
+                {
+                    REQUIRE(file_to_string(F, "/mem/" + it->first) == it->second);
+                    REQUIRE(file_to_string(F, "/host/" + it->first) == it->second);
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("Archive directories are indexed as a tree")
+{
+    // no entries are written for the directories
+    std::map<std::string, std::string> files = {
+        {"a/b/c/deep.txt", "deep"},
+        {"a/b/two.txt",    "two"},
+        {"a/one.txt",      "one"},
+        {"top.txt",        "top"},
+    };
+    for(int i=0; i<100; i++)
+        files[std::format("many/file{:03}.txt", i)] = std::to_string(i);
+
+    auto archive = make_archive(files, true);
+
+    FileSystem F;
+    REQUIRE(F.mkdir("/tar") == FSResult::True);
+    REQUIRE(F.mount<ArchiveMount>("/tar", archive.data(), archive.size()) == FSResult::True);
+
+    auto list = [&](FileSystem::path_type p)
+    {
+        std::vector<std::string> names;
+        for(auto f : F.list_dir(p))
+            names.push_back(f.generic_string());
+        return names;
+    };
+
+    THEN("Missing parent directories are added")
+    {
+        REQUIRE(F.getType("/tar/a") == NodeType::MountDir);
+        REQUIRE(F.getType("/tar/a/b") == NodeType::MountDir);
+        REQUIRE(F.getType("/tar/a/b/c") == NodeType::MountDir);
+        REQUIRE(F.getType("/tar/a/b/c/deep.txt") == NodeType::MountFile);
+        REQUIRE(F.getType("/tar/a/b/nothing") == NodeType::NoExist);
+        REQUIRE(F.getType("/tar/top.txt/nothing") == NodeType::NoExist);
+        REQUIRE(F.exists("/tar/a/b") == FSResult::True);
+    }
+
+    THEN("Directories list only their own children, sorted by name")
+    {
+        REQUIRE(list("/tar") == std::vector<std::string>{"a", "many", "top.txt"});
+        REQUIRE(list("/tar/a") == std::vector<std::string>{"b", "one.txt"});
+        REQUIRE(list("/tar/a/b") == std::vector<std::string>{"c", "two.txt"});
+        REQUIRE(list("/tar/many").size() == 100);
+        REQUIRE(list("/tar/top.txt").empty());
+    }
+
+    THEN("Files are read through the tree")
+    {
+        REQUIRE(file_to_string(F, "/tar/a/b/c/deep.txt") == "deep");
+        REQUIRE(file_to_string(F, "/tar/many/file042.txt") == "42");
+    }
+
+    THEN("The entries keep their size")
+    {
+        ArchiveMount M(archive.data(), archive.size());
+        auto i = M._tree.find("a/b/two.txt");
+        REQUIRE(i != ArchiveTree::npos);
+        REQUIRE(M._tree.node(i).size == 3);
+        REQUIRE(M._tree.node(i).mode == (AE_IFREG | 0644));
+        REQUIRE(M._tree.find("a/b/none.txt") == ArchiveTree::npos);
+    }
+}
+
+SCENARIO("Decompressed archive entries are cached")
+{
+    std::map<std::string, std::string> files = {
+        {"config/a.conf", "alpha=1\n"},
+        {"config/b.conf", "beta=2\n"},
+        {"big.bin",       std::string(300000, 'x')},
+    };
+    auto archive = make_archive(files, true);
+
+    ArchiveMount M(archive.data(), archive.size());
+    auto read = [&](std::string const & path)
+    {
+        auto buf = M.open(path, std::ios::in);
+        std::stringstream ss;
+        ss << buf.get();
+        return ss.str();
+    };
+
+    WHEN("A file is read twice")
+    {
+        REQUIRE(read("config/a.conf") == "alpha=1\n");
+        REQUIRE(read("config/a.conf") == "alpha=1\n");
+
+        THEN("The second read comes from the cache")
+        {
+            auto S = M.cache().stats();
+            REQUIRE(S.misses == 1);
+            REQUIRE(S.hits == 1);
+            REQUIRE(S.entries == 1);
+            REQUIRE(S.bytes == 8);
+        }
+    }
+
+    WHEN("A file is larger than the largest entry")
+    {
+        M.cache().set_limits(1024 * 1024, 1024);
+        REQUIRE(read("big.bin") == files["big.bin"]);
+        REQUIRE(read("big.bin") == files["big.bin"]);
+
+        THEN("It is not cached")
+        {
+            auto S = M.cache().stats();
+            REQUIRE(S.entries == 0);
+            REQUIRE(S.hits == 0);
+        }
+    }
+
+    WHEN("The cache is full")
+    {
+        M.cache().set_limits(10);
+        REQUIRE(read("config/a.conf") == "alpha=1\n");
+        REQUIRE(read("config/b.conf") == "beta=2\n");
+
+        THEN("The least recently used entry is evicted")
+        {
+            auto S = M.cache().stats();
+            REQUIRE(S.evictions == 1);
+            REQUIRE(S.entries == 1);
+            REQUIRE(S.bytes == 7);
+
+            REQUIRE(read("config/b.conf") == "beta=2\n");
+            REQUIRE(M.cache().stats().hits == 1);
+        }
+    }
+
+    WHEN("A stream outlives its cache entry")
+    {
+        auto buf = M.open("config/a.conf", std::ios::in);
+        M.cache().clear();
+
+        THEN("It can still be read")
+        {
+            std::stringstream ss;
+            ss << buf.get();
+            REQUIRE(ss.str() == "alpha=1\n");
+        }
+    }
+}
+
+SCENARIO("The archive command shows the cache statistics")
+{
+    std::map<std::string, std::string> files = {{"a.txt", "hello"}};
+    auto archive = make_archive(files, true);
+
+    System M;
+    enable_archive_mount(M);
+    REQUIRE(M.mkdir("/tar") == FSResult::True);
+    REQUIRE(M.mount<ArchiveMount>("/tar", archive.data(), archive.size()) == FSResult::True);
+
+    file_to_string(M, "/tar/a.txt");
+    file_to_string(M, "/tar/a.txt");
+
+    System::Exec E({"archive", "stats", "/tar"});
+    E.out = System::make_stream();
+    M.runRawCommand(E);
+    while(M.taskQueueExecute());
+
+    auto out = E.out->str();
+    REQUIRE(out.find("hits 1\n") != std::string::npos);
+    REQUIRE(out.find("misses 1\n") != std::string::npos);
+
+    M.destroy();
+}
@@ -0,0 +1,79 @@
+#include <cstdlib>
+#include <new>
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <PseudoNix/System.h>
+#include <PseudoNix/Shell.h>
+
+
+using namespace PseudoNix;
+
+// This test replaces the global operator new/delete to count the
+// allocations made on each thread, so it is kept in its own
+// executable. The replacements are not inlined so that the compiler
+// does not pair the free() with the callers' operator new.
+#if defined(_MSC_VER)
+#define NOINLINE __declspec(noinline)
+#else
+#define NOINLINE [[gnu::noinline]]
+#endif
+
+static thread_local size_t allocation_count = 0;
+
+NOINLINE void* operator new(std::size_t n)
+{
+    ++allocation_count;
+    if(auto p = std::malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+NOINLINE void operator delete(void * p) noexcept
+{
+    std::free(p);
+}
+NOINLINE void operator delete(void * p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+SCENARIO("The built-in awaiters do not allocate")
+{
+    System M;
+    static size_t allocations = 0;
+
+    M.setFunction("test", [](System::e_type ctrl) -> System::task_type {
+        PSEUDONIX_PROC_START(ctrl);
+
+        std::string line;
+        auto n0 = allocation_count;
+        {
+            auto a = ctrl->await_yield();
+            auto b = ctrl->await_signal();
+            auto c = ctrl->await_read_line(ctrl->in, line);
+            auto d = ctrl->await_has_data(ctrl->in);
+            auto e = ctrl->await_writable(ctrl->out);
+            auto f = ctrl->await_finished(ctrl->get_pid());
+            REQUIRE(!a.await_ready());
+            REQUIRE(!b.await_ready());
+            REQUIRE(!c.await_ready());
+            REQUIRE(!d.await_ready());
+            REQUIRE(e.await_ready());
+            REQUIRE(!f.await_ready());
+        }
+        allocations = allocation_count - n0;
+
+        HANDLE_AWAIT_INT_TERM(co_await ctrl->await_yield(), ctrl);
+        co_return 0;
+    });
+
+    System::Exec E({"test"});
+    E.in  = System::make_stream();
+    E.out = System::make_stream();
+    auto pid = M.runRawCommand(E);
+
+    while(M.isRunning(pid))
+        M.taskQueueExecute();
+
+    REQUIRE(allocations == 0);
+}
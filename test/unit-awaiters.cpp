@@ -90,3 +90,136 @@ SCENARIO("test await_read_line")
 }
 
 #endif
+
+
+SCENARIO("Blocked processes are parked until they are woken up")
+{
+    System M;
+
+    M.setFunction("reader", [](System::e_type control) -> System::task_type {
+        PSEUDONIX_PROC_START(control);
+
+        std::string line;
+        while(AwaiterResult::SUCCESS == co_await control->await_read_line(control->in, line))
+        {
+            COUT << line << '\n';
+            line.clear();
+        }
+        co_return 0;
+    });
+
+    M.setFunction("waiter", [](System::e_type control) -> System::task_type {
+        PSEUDONIX_PROC_START(control);
+
+        auto pid = std::stoul(ARGS[1]);
+        (void)co_await control->await_finished(static_cast<System::pid_type>(pid));
+        COUT << "done\n";
+        co_return 0;
+    });
+
+    System::Exec E({"reader"});
+    E.in  = System::make_stream();
+    E.out = System::make_stream();
+
+    auto reader = M.runRawCommand(E);
+
+    System::Exec W({"waiter", std::to_string(reader)});
+    W.out = System::make_stream();
+    auto waiter = M.runRawCommand(W);
+
+    for(int i=0;i<10;i++)
+        M.taskQueueExecute();
+
+    // nothing can run, so the task queue is empty
+    REQUIRE(M.isRunning(reader));
+    REQUIRE(M.isRunning(waiter));
+    REQUIRE(M.taskQueueSize(System::DEFAULT_QUEUE) == 0);
+
+    WHEN("Data is written to the stream")
+    {
+        *E.in << "hello\n";
+
+        THEN("The reader is placed back on the queue")
+        {
+            REQUIRE(M.taskQueueSize(System::DEFAULT_QUEUE) == 1);
+            M.taskQueueExecute();
+            REQUIRE(E.out->str() == "hello\n");
+            REQUIRE(M.taskQueueSize(System::DEFAULT_QUEUE) == 0);
+        }
+    }
+
+    WHEN("A partial line is written")
+    {
+        *E.in << "hel";
+        M.taskQueueExecute();
+
+        THEN("The reader is parked again")
+        {
+            REQUIRE(M.taskQueueSize(System::DEFAULT_QUEUE) == 0);
+            *E.in << "lo\n";
+            M.taskQueueExecute();
+            REQUIRE(E.out->str() == "hello\n");
+        }
+    }
+
+    WHEN("The stream is closed")
+    {
+        E.in->set_eof();
+        while(M.taskQueueExecute());
+
+        THEN("The reader exits and wakes up the waiter")
+        {
+            REQUIRE(!M.isRunning(reader));
+            REQUIRE(!M.isRunning(waiter));
+            REQUIRE(W.out->str() == "done\n");
+        }
+    }
+
+    WHEN("The reader is signaled")
+    {
+        M.interrupt(reader);
+        while(M.taskQueueExecute());
+
+        THEN("It wakes up and exits")
+        {
+            REQUIRE(!M.isRunning(reader));
+            REQUIRE(!M.isRunning(waiter));
+        }
+    }
+}
+
+
+SCENARIO("Sleeping processes are woken up by the timer list")
+{
+    System M;
+
+    REQUIRE(M.nextTimerDeadline() == std::chrono::steady_clock::time_point::max());
+
+    auto T0 = std::chrono::steady_clock::now();
+    System::Exec E({"sleep", "0.2"});
+    auto pid = M.runRawCommand(E);
+
+    // start the process, it will then be parked
+    // on the timer list
+    M.taskQueueExecute();
+    M.taskQueueExecute();
+
+    REQUIRE(M.isRunning(pid));
+    REQUIRE(M.taskQueueSize(System::DEFAULT_QUEUE) == 0);
+
+    auto deadline = M.nextTimerDeadline();
+    REQUIRE(deadline >= T0 + std::chrono::milliseconds(200));
+    REQUIRE(deadline <= std::chrono::steady_clock::now() + std::chrono::milliseconds(200));
+
+    // Nothing happens before the deadline
+    M.taskQueueExecute();
+    REQUIRE(M.isRunning(pid));
+
+    std::this_thread::sleep_until(deadline);
+
+    // the timer expires and the process is resumed
+    M.taskQueueExecute();
+    M.taskQueueExecute();
+    REQUIRE(!M.isRunning(pid));
+    REQUIRE(M.nextTimerDeadline() == std::chrono::steady_clock::time_point::max());
+}
@@ -167,3 +167,283 @@ SCENARIO("Tokenizer 3")
 
 
 }
+
+
+SCENARIO("Bulk read and write")
+{
+    using Stream = ReaderWriterStream;
+
+    GIVEN("A Stream")
+    {
+        Stream S;
+
+        WHEN("We write blocks of data into the stream")
+        {
+            std::string_view hello = "Hello world\n";
+            S.write(hello);
+            S.write(std::string("This is a test"));
+            S.set_eof();
+
+            THEN("The size is the total number of characters")
+            {
+                REQUIRE(S.size_approx() == 26);
+            }
+            THEN("We can read it back in blocks")
+            {
+                std::array<char, 5> buffer;
+                std::string out;
+                while(auto n = S.read(buffer))
+                {
+                    REQUIRE(n <= buffer.size());
+                    out.append(buffer.data(), n);
+                }
+                REQUIRE(out == "Hello world\nThis is a test");
+                REQUIRE(S.size_approx() == 0);
+                REQUIRE(S.check() == Stream::Result::END_OF_STREAM);
+            }
+            THEN("Single character reads can be mixed with block reads")
+            {
+                char c = 0;
+                REQUIRE(S.get(&c) == Stream::Result::SUCCESS);
+                REQUIRE(c == 'H');
+
+                std::array<char, 10> buffer;
+                REQUIRE(S.read(buffer) == 10);
+                REQUIRE(std::string_view(buffer.data(), 10) == "ello world");
+
+                std::string line;
+                REQUIRE(S.append_line(line) == Stream::Result::SUCCESS);
+                REQUIRE(line.empty());
+                REQUIRE(S.append_line(line) == Stream::Result::END_OF_STREAM);
+                REQUIRE(line == "This is a test");
+            }
+            THEN("Streams can be moved into other streams")
+            {
+                Stream S2;
+                char c = 0;
+                REQUIRE(S.get(&c) == Stream::Result::SUCCESS);
+                S2 << S;
+                REQUIRE(S.has_data() == false);
+                REQUIRE(S2.size_approx() == 25);
+                REQUIRE(S2.str() == "ello world\nThis is a test");
+            }
+        }
+    }
+}
+
+
+SCENARIO("Ring stream")
+{
+    // use a tiny segment size so that reads and
+    // writes have to cross segment boundaries
+    using Stream = RingStream_t<char, 4>;
+
+    GIVEN("A Stream")
+    {
+        Stream S;
+
+        WHEN("We write more data than fits into a single segment")
+        {
+            S.write(std::string_view("Hello world\nThis is a test"));
+            S.set_eof();
+
+            THEN("The size is the total number of characters")
+            {
+                REQUIRE(S.has_data());
+                REQUIRE(S.size_approx() == 26);
+            }
+            THEN("peek returns at most one segment")
+            {
+                auto s = S.peek();
+                REQUIRE(std::string_view(s.data(), s.size()) == "Hell");
+                S.release(2);
+                s = S.peek();
+                REQUIRE(std::string_view(s.data(), s.size()) == "ll");
+                S.release(2);
+                s = S.peek();
+                REQUIRE(std::string_view(s.data(), s.size()) == "o wo");
+            }
+            THEN("Lines can be read across segments")
+            {
+                std::string line;
+                REQUIRE(S.read_line(line) == Stream::Result::SUCCESS);
+                REQUIRE(line == "Hello world");
+                REQUIRE(S.read_line(line) == Stream::Result::END_OF_STREAM);
+                REQUIRE(line == "This is a test");
+                REQUIRE(S.check() == Stream::Result::EMPTY);
+            }
+            THEN("We can read it back in blocks")
+            {
+                std::array<char, 5> buffer;
+                std::string out;
+                while(auto n = S.read(buffer))
+                {
+                    out.append(buffer.data(), n);
+                }
+                REQUIRE(out == "Hello world\nThis is a test");
+                REQUIRE(S.has_data() == false);
+                REQUIRE(S.check() == Stream::Result::END_OF_STREAM);
+            }
+        }
+
+        WHEN("We reserve and commit directly into the segments")
+        {
+            auto w = S.reserve(10);
+            REQUIRE(w.size() == 4);
+            std::memcpy(w.data(), "abcd", 4);
+
+            THEN("Nothing is visible until it is committed")
+            {
+                REQUIRE(S.has_data() == false);
+                REQUIRE(S.peek().empty());
+
+                S.commit(3);
+                REQUIRE(S.size_approx() == 3);
+                REQUIRE(S.str() == "abc");
+            }
+        }
+
+        WHEN("The producer and consumer take turns")
+        {
+            // segments which have been drained are reused
+            // and new segments are added when the consumer
+            // lags behind
+            std::string expected;
+            std::string out;
+            for(int i=0;i<100;i++)
+            {
+                auto line = std::to_string(i) + "\n";
+                S << line;
+                expected += line;
+                if(i % 3 == 0)
+                {
+                    std::string l;
+                    while(S.append_line(l) == Stream::Result::SUCCESS)
+                    {
+                        out += l + "\n";
+                        l.clear();
+                    }
+                    out += l;
+                }
+            }
+            out += S.str();
+            REQUIRE(out == expected);
+        }
+    }
+}
+
+SCENARIO("Ring stream producer and consumer on different threads")
+{
+    RingStream_t<char, 64> S;
+
+    constexpr size_t count = 100000;
+    std::thread producer([&]()
+    {
+        for(size_t i=0;i<count;i++)
+        {
+            S.put(static_cast<char>('a' + i%26));
+        }
+        S.set_eof();
+    });
+
+    size_t total = 0;
+    bool ordered = true;
+    while(total < count)
+    {
+        auto s = S.peek();
+        for(auto c : s)
+        {
+            ordered &= c == static_cast<char>('a' + total%26);
+            ++total;
+        }
+        S.release(s.size());
+    }
+    producer.join();
+
+    REQUIRE(ordered);
+    REQUIRE(total == count);
+    REQUIRE(S.has_data() == false);
+}
+
+SCENARIO("Single items and blocks written on a different thread are read in order")
+{
+    ReaderWriterStream S;
+
+    constexpr size_t count = 100000;
+    std::thread producer([&]()
+    {
+        for(size_t i=0;i<count;)
+        {
+            if(i % 7 == 0 && i + 3 <= count)
+            {
+                std::array<char, 3> block;
+                for(auto & b : block)
+                {
+                    b = static_cast<char>('a' + i%26);
+                    ++i;
+                }
+                S.write(block);
+            }
+            else
+            {
+                S.put(static_cast<char>('a' + i%26));
+                ++i;
+            }
+        }
+        S.set_eof();
+    });
+
+    size_t total = 0;
+    bool ordered = true;
+    while(total < count)
+    {
+        auto s = S.peek();
+        for(auto c : s)
+        {
+            ordered &= c == static_cast<char>('a' + total%26);
+            ++total;
+        }
+        S.release(s.size());
+    }
+    producer.join();
+
+    REQUIRE(ordered);
+    REQUIRE(total == count);
+    REQUIRE(S.has_data() == false);
+    REQUIRE(S.size_approx() == 0);
+}
+
+
+SCENARIO("Stream capacity")
+{
+    GIVEN("A bounded stream")
+    {
+        auto S = System::make_stream("", StreamBackend::CHUNKED, 8);
+
+        REQUIRE(S->capacity() == 8);
+        REQUIRE(S->writable() == 8);
+
+        WHEN("We write into the stream")
+        {
+            S->write(std::string_view("abcde"));
+
+            THEN("The writable space is reduced")
+            {
+                REQUIRE(S->writable() == 3);
+            }
+            THEN("Writes past the capacity are not rejected")
+            {
+                S->write(std::string_view("fghij"));
+                REQUIRE(S->writable() == 0);
+                REQUIRE(S->str() == "abcdefghij");
+                REQUIRE(S->writable() == 8);
+            }
+        }
+    }
+    GIVEN("An unbounded stream")
+    {
+        auto S = System::make_stream("hello", StreamBackend::RING);
+        REQUIRE(S->capacity() == 0);
+        REQUIRE(S->writable() == std::numeric_limits<size_t>::max());
+    }
+}